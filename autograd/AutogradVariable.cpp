@@ -3,12 +3,23 @@
 //
 
 #include "AutogradVariable.h"
+#include "Checkpoint.h"
 namespace autograd {
     template<typename T>
     Tensor<T>& AutogradVariable<T>::forward() {
+        if (this->is_data_released()) {
+            static const size_t activation_tag = blas::memory::register_tag("activation");
+            blas::memory::MemoryTag tag(activation_tag);
+            this->_data = Tensor<T>(output_shape());
+        }
         Tensor<T>& out = this->data();
-        if (!this->is_leaf())
+        if (!this->is_leaf()) {
+            INSTRUMENT_FORWARD(*source_functor_ptr);
             source_functor_ptr->apply_forward(get_args(),& out);
+        }
+        // The intermediates of the segment are no longer needed until backward.
+        if (checkpoint_ptr)
+            checkpoint_ptr->release();
         return out;
     }
 
@@ -26,19 +37,30 @@ namespace autograd {
             if (!this->grad_accumulation_complete())
                 return;
         }
+        // Bring back the intermediates of the segment before using them.
+        if (checkpoint_ptr)
+            checkpoint_ptr->recompute();
         auto args = get_args();
         Tensor<T>& curr_data = this->data();
         Tensor<T>& curr_grad = this->grad();
+        static const size_t grad_tag = blas::memory::register_tag("grad");
+        blas::memory::MemoryTag tag(grad_tag);
         for (int i = 0; i < this->dependencies.size(); ++i) {
             auto& dep = this->dependencies[i];
             if (!dep->requires_grad)
                 continue;
-            Tensor<T> local_grad(dep->grad().shape);
-            source_functor_ptr->apply_backward(i, args,& curr_data,& curr_grad,& local_grad);
+            Tensor<T> local_grad(dep->shape());
+            {
+                INSTRUMENT_BACKWARD(*source_functor_ptr, i);
+                source_functor_ptr->apply_backward(i, args,& curr_data,& curr_grad,& local_grad);
+            }
             dep->accumulate_grad(local_grad);
             if (recursive)
                 dep->backward(this, true);
         }
+        // The whole segment was backpropagated through - drop it again.
+        if (checkpoint_ptr && recursive)
+            checkpoint_ptr->release();
     }
     
     template<typename T>
@@ -56,6 +78,11 @@ namespace autograd {
         return _args;
     }
 
+    template<typename T>
+    string AutogradVariable<T>::get_name() const {
+        return this->name.empty() ? source_functor_ptr->name() : this->name;
+    }
+
     template<typename T>
     bool AutogradVariable<T>::is_root() const {
         return VariableBase<T>::is_root() && this->_data.size == 1;
@@ -64,7 +91,7 @@ namespace autograd {
     template<typename T>
     AutogradVariable<T>::AutogradVariable(const string& name, const Functor<T>& source_functor, bool requires_grad) :
             VariableBase<T>(name, Tensor<T>(source_functor.output_shape), requires_grad),
-            source_functor_ptr(source_functor.clone()) {}
+            source_functor_ptr(source_functor.share()) {}
 
 #define INSTANTIATE_AUTOGRADVARIABLE(dtype) \
     template class AutogradVariable<dtype>;
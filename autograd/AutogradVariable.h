@@ -16,6 +16,13 @@ namespace autograd {
         // The functor that creates the data for the current variable.
         shared_ptr<Functor<T>> source_functor_ptr;
 
+        // The checkpointed segment this variable is the output of (if any).
+        shared_ptr<Checkpoint<T>> checkpoint_ptr;
+
+        friend class Checkpoint<T>;
+        friend class ElemwiseFusion<T>;
+        friend class FrozenGraph<T>;
+
         const vector<const Tensor<T>*>& get_args() const;
 
         vector<const Tensor<T>*> _args;
@@ -32,6 +39,13 @@ namespace autograd {
         // Autograd variable cannot be a root if its' shape isn't 1.
         bool is_root() const override;
 
+        // Unless renamed, the variable is named after its functor.
+        string get_name() const override;
+
+        inline const shape_t& output_shape() const { return source_functor_ptr->output_shape; }
+
+        inline const shared_ptr<Checkpoint<T>>& get_checkpoint() const { return checkpoint_ptr; }
+
         static Variable<T> make(const string& name, const Functor<T>& source_functor, bool requires_grad = true) {
             Variable<T> res{new AutogradVariable(name, source_functor, requires_grad)};
             return res;
@@ -0,0 +1,127 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Checkpoint.h"
+#include <numeric>
+
+namespace autograd {
+
+    template<typename T>
+    Checkpoint<T>::Checkpoint(const Variable<T>& output, const vector<Variable<T>>& inputs) : output(output.get()) {
+        if (dynamic_cast<AutogradVariable<T> *>(this->output) == nullptr)
+            throw std::invalid_argument("The output of a checkpointed segment must be computed by a functor.");
+        unordered_set<VariableBase<T> *> input_set, visited;
+        for (const auto& input: inputs)
+            input_set.insert(input.get());
+        visited.insert(this->output);
+        for (const auto& dep: this->output->dependencies)
+            gather_intermediates(dep.get(), input_set, visited);
+        // Every intermediate must only feed the segment, or we can't drop it.
+        for (AutogradVariable<T> *var: intermediates)
+            for (VariableBase<T> *dependee: var->dependees)
+                if (visited.count(dependee) == 0)
+                    throw std::invalid_argument("Variable '" + var->get_name() + "' is used outside of the "
+                                                "checkpointed segment, add it to the segment's inputs.");
+    }
+
+    template<typename T>
+    void Checkpoint<T>::gather_intermediates(VariableBase<T> *var, const unordered_set<VariableBase<T> *>& inputs,
+                                             unordered_set<VariableBase<T> *>& visited) {
+        if (visited.count(var) > 0 || inputs.count(var) > 0 || var->is_leaf())
+            return;
+        visited.insert(var);
+        auto autograd_var = dynamic_cast<AutogradVariable<T> *>(var);
+        if (autograd_var == nullptr)
+            return;
+        if (autograd_var->checkpoint_ptr)
+            throw std::invalid_argument("Checkpointed segments cannot be nested, '" + var->get_name() +
+                                        "' is already the output of a checkpointed segment.");
+        for (const auto& dep: var->dependencies)
+            gather_intermediates(dep.get(), inputs, visited);
+        // Post-order: all of the dependencies were already added.
+        intermediates.push_back(autograd_var);
+    }
+
+    template<typename T>
+    void Checkpoint<T>::release() {
+        for (AutogradVariable<T> *var: intermediates)
+            var->release_data();
+        released = true;
+    }
+
+    template<typename T>
+    void Checkpoint<T>::recompute() {
+        if (!released)
+            return;
+        // The gradient buffers are allocated again lazily by the backward pass.
+        for (AutogradVariable<T> *var: intermediates)
+            var->forward();
+        released = false;
+    }
+
+    template<typename T>
+    size_t Checkpoint<T>::released_bytes() const {
+        size_t total = 0;
+        for (AutogradVariable<T> *var: intermediates) {
+            const shape_t& shape = var->output_shape();
+            size_t size = std::accumulate(shape.begin(), shape.end(), size_t(1), std::multiplies<size_t>{});
+            total += 2 * size * sizeof(T); // data + grad
+        }
+        return total;
+    }
+
+    template<typename T>
+    shared_ptr<Checkpoint<T>> Checkpoint<T>::make(const Variable<T>& output, const vector<Variable<T>>& inputs) {
+        auto checkpoint_ptr = std::make_shared<Checkpoint<T>>(output, inputs);
+        auto output_ptr = dynamic_cast<AutogradVariable<T> *>(output.get());
+        output_ptr->checkpoint_ptr = checkpoint_ptr;
+        checkpoint_ptr->release();
+        return checkpoint_ptr;
+    }
+
+    template<typename T>
+    void Checkpoint<T>::gather_memory_report(VariableBase<T> *var, unordered_set<VariableBase<T> *>& visited,
+                                         CheckpointMemoryReport& report) {
+        if (visited.count(var) > 0)
+            return;
+        visited.insert(var);
+        auto autograd_var = dynamic_cast<AutogradVariable<T> *>(var);
+        if (autograd_var && autograd_var->get_checkpoint()) {
+            const auto& checkpoint_ptr = autograd_var->get_checkpoint();
+            report.num_segments++;
+            if (checkpoint_ptr->is_released())
+                report.released_bytes += checkpoint_ptr->released_bytes();
+        }
+        if (var->is_data_released())
+            report.num_released_variables++;
+        else
+            report.retained_bytes += (var->_data.size + var->_grad.size) * sizeof(T);
+        for (const auto& dep: var->dependencies)
+            gather_memory_report(dep.get(), visited, report);
+    }
+
+    template<typename T>
+    CheckpointMemoryReport Checkpoint<T>::memory_report(const Variable<T>& root) {
+        CheckpointMemoryReport report;
+        unordered_set<VariableBase<T> *> visited;
+        gather_memory_report(root.get(), visited, report);
+        return report;
+    }
+
+    ostream& CheckpointMemoryReport::print(ostream& os) const {
+        os << "Checkpointed segments: " << num_segments
+           << ", released variables: " << num_released_variables << endl
+           << "Released bytes: " << released_bytes
+           << ", retained bytes: " << retained_bytes;
+        if (released_bytes + retained_bytes > 0)
+            os << " (saved " << 100.0 * released_bytes / (released_bytes + retained_bytes) << "%)";
+        return os << endl;
+    }
+
+#define INSTANTIATE_CHECKPOINT(dtype) \
+    template class Checkpoint<dtype>;
+
+    INSTANTIATE_CHECKPOINT(double)
+    INSTANTIATE_CHECKPOINT(float)
+}
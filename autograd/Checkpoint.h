@@ -0,0 +1,86 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_CHECKPOINT_H
+#define TARGETPRACTICE_CHECKPOINT_H
+
+#include "AutogradVariable.h"
+
+namespace autograd {
+
+    // Summary of the activation memory of a graph that contains checkpointed segments.
+    struct CheckpointMemoryReport {
+        size_t num_segments = 0;
+        size_t num_released_variables = 0;
+        // Bytes of data and gradients currently freed by the checkpointed segments.
+        size_t released_bytes = 0;
+        // Bytes of data and gradients currently held by the variables of the graph.
+        size_t retained_bytes = 0;
+
+        ostream& print(ostream& os) const;
+    };
+
+    /**
+     * A checkpointed segment of the graph (gradient checkpointing).
+     * Only the inputs and the output of the segment keep their data after forward,
+     * the data (and gradients) of the intermediates are dropped, and recomputed from
+     * the inputs when the gradient flows back through the output of the segment.
+     * This trades one extra forward of the segment for the memory of its intermediates.
+     * @tparam T the data type.
+     * @note Every intermediate must only be used inside the segment, i.e. all of its
+     *       dependees are either the output or other intermediates.
+     */
+    template<typename T>
+    class Checkpoint {
+    public:
+        Checkpoint(const Variable<T>& output, const vector<Variable<T>>& inputs);
+
+        // Drops the data of all the intermediates of the segment.
+        void release();
+
+        // Recomputes the data of all the intermediates from the inputs of the segment.
+        void recompute();
+
+        inline bool is_released() const { return released; }
+
+        inline size_t num_intermediates() const { return intermediates.size(); }
+
+        // The number of bytes of data and gradients that are freed while the segment is released.
+        size_t released_bytes() const;
+
+        static shared_ptr<Checkpoint<T>> make(const Variable<T>& output, const vector<Variable<T>>& inputs);
+
+        static CheckpointMemoryReport memory_report(const Variable<T>& root);
+
+    private:
+        VariableBase<T> *output;
+        // Topologically sorted - every intermediate comes after its dependencies.
+        vector<AutogradVariable<T> *> intermediates;
+        bool released = false;
+
+        void gather_intermediates(VariableBase<T> *var, const unordered_set<VariableBase<T> *>& inputs,
+                                  unordered_set<VariableBase<T> *>& visited);
+
+        static void gather_memory_report(VariableBase<T> *var, unordered_set<VariableBase<T> *>& visited,
+                                         CheckpointMemoryReport& report);
+    };
+
+    /**
+     * Marks the subgraph between inputs and output as a checkpointed segment, and releases it.
+     * @param output the output of the segment, its data is kept.
+     * @param inputs the inputs of the segment, their data is kept.
+     * @return the checkpoint (also owned by the output).
+     */
+    template<typename T>
+    inline shared_ptr<Checkpoint<T>> checkpoint(const Variable<T>& output, const vector<Variable<T>>& inputs) {
+        return Checkpoint<T>::make(output, inputs);
+    }
+
+    template<typename T>
+    inline CheckpointMemoryReport checkpoint_memory_report(const Variable<T>& root) {
+        return Checkpoint<T>::memory_report(root);
+    }
+}
+
+#endif //TARGETPRACTICE_CHECKPOINT_H
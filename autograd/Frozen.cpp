@@ -0,0 +1,289 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Frozen.h"
+#include <functional>
+#include <map>
+
+namespace autograd {
+
+    template<typename T>
+    static AutogradVariable<T> *as_computed(VariableBase<T> *var) {
+        auto autograd_var = dynamic_cast<AutogradVariable<T> *>(var);
+        return autograd_var && !autograd_var->is_leaf() ? autograd_var : nullptr;
+    }
+
+    // The shape of a variable, even if its data was released by a checkpoint.
+    template<typename T>
+    static const shape_t& shape_of(VariableBase<T> *var) {
+        auto autograd_var = dynamic_cast<AutogradVariable<T> *>(var);
+        return autograd_var ? autograd_var->output_shape() : var->shape();
+    }
+
+    template<typename T>
+    FrozenGraph<T>::FrozenGraph(const Variable<T>& output_var, const vector<Variable<T>>& inputs) {
+        unordered_map<VariableBase<T> *, size_t> input_index;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (!inputs[i]->is_leaf())
+                throw std::invalid_argument("The inputs of a frozen graph must be leaves, '" +
+                                            inputs[i]->get_name() + "' isn't.");
+            input_index[inputs[i].get()] = i;
+            graph_input_shapes.push_back(inputs[i].shape());
+        }
+        graph_output_shape = shape_of(output_var.get());
+
+        // Post order from the output, the dependencies of the inputs don't matter.
+        vector<VariableBase<T> *> order;
+        unordered_set<VariableBase<T> *> visited;
+        std::function<void(VariableBase<T> *)> visit = [&](VariableBase<T> *var) {
+            if (!visited.insert(var).second)
+                return;
+            if (input_index.count(var) == 0)
+                for (const auto& dep: var->dependencies)
+                    visit(dep.get());
+            order.push_back(var);
+        };
+        visit(output_var.get());
+
+        // Constant folding - the leaves that aren't inputs are copied, and every variable that
+        // only depends on constants is computed once.
+        unordered_map<VariableBase<T> *, Tensor<T>> constant_values;
+        unordered_map<VariableBase<T> *, size_t> num_readers;
+        for (VariableBase<T> *var: order) {
+            if (input_index.count(var) > 0)
+                continue;
+            AutogradVariable<T> *computed = as_computed(var);
+            if (computed == nullptr) {
+                if (var->is_input_buffer())
+                    throw std::invalid_argument("The output depends on the input buffer '" + var->get_name() +
+                                                "', which isn't an input of the frozen graph.");
+                constant_values.emplace(var, Tensor<T>(var->data()));
+                continue;
+            }
+            bool is_constant = true;
+            for (const auto& dep: var->dependencies) {
+                num_readers[dep.get()]++;
+                is_constant = is_constant && constant_values.count(dep.get()) > 0;
+            }
+            if (!is_constant)
+                continue;
+            vector<const Tensor<T> *> args;
+            for (const auto& dep: var->dependencies)
+                args.push_back(&constant_values.at(dep.get()));
+            Tensor<T> value(computed->output_shape());
+            computed->source_functor_ptr->apply_forward(args, &value);
+            constant_values.emplace(var, std::move(value));
+        }
+
+        // Element-wise variables read by a single element-wise variable are fused into it.
+        auto is_elemwise_step = [&](VariableBase<T> *var) {
+            AutogradVariable<T> *computed = as_computed(var);
+            return computed && input_index.count(var) == 0 && constant_values.count(var) == 0 &&
+                   FusedElemwiseFunctor<T>::is_elemwise(*computed->source_functor_ptr);
+        };
+        unordered_set<VariableBase<T> *> folded;
+        for (VariableBase<T> *var: order) {
+            if (!is_elemwise_step(var))
+                continue;
+            for (const auto& dep: var->dependencies)
+                if (dep.get() != output_var.get() && is_elemwise_step(dep.get()) && num_readers[dep.get()] == 1)
+                    folded.insert(dep.get());
+        }
+
+        unordered_map<VariableBase<T> *, Operand> operands;
+        for (const auto& input: input_index)
+            operands[input.first] = {Source::Input, input.second};
+        // Only the constants read by the steps (or the output) are kept.
+        auto operand_of = [&](VariableBase<T> *var) -> Operand {
+            auto it = operands.find(var);
+            if (it != operands.end())
+                return it->second;
+            Operand operand{Source::Constant, constants.size()};
+            constants.push_back(std::move(constant_values.at(var)));
+            operands[var] = operand;
+            return operand;
+        };
+
+        using Builder = typename FusedElemwiseFunctor<T>::Builder;
+        for (VariableBase<T> *var: order) {
+            if (input_index.count(var) > 0 || constant_values.count(var) > 0 || folded.count(var) > 0)
+                continue;
+            AutogradVariable<T> *computed = as_computed(var);
+            Step step;
+            bool has_folded = std::any_of(var->dependencies.begin(), var->dependencies.end(),
+                                          [&](const Variable<T>& dep) { return folded.count(dep.get()) > 0; });
+            if (has_folded) {
+                Builder builder;
+                unordered_map<VariableBase<T> *, int> registers;
+                std::function<void(VariableBase<T> *)> gather_inputs = [&](VariableBase<T> *v) {
+                    for (const auto& dep: v->dependencies) {
+                        if (folded.count(dep.get()) > 0)
+                            gather_inputs(dep.get());
+                        else if (registers.count(dep.get()) == 0) {
+                            registers[dep.get()] = builder.add_input(shape_of(dep.get()));
+                            step.args.push_back(operand_of(dep.get()));
+                        }
+                    }
+                };
+                std::function<int(VariableBase<T> *)> emit = [&](VariableBase<T> *v) {
+                    vector<int> registers_of_deps;
+                    for (const auto& dep: v->dependencies)
+                        registers_of_deps.push_back(folded.count(dep.get()) > 0 ? emit(dep.get())
+                                                                               : registers.at(dep.get()));
+                    return builder.add_op(*as_computed(v)->source_functor_ptr, registers_of_deps);
+                };
+                gather_inputs(var);
+                emit(var);
+                step.functor = std::make_shared<FusedElemwiseFunctor<T>>(builder.build());
+                fused_steps++;
+            } else {
+                step.functor = computed->source_functor_ptr;
+                for (const auto& dep: var->dependencies)
+                    step.args.push_back(operand_of(dep.get()));
+            }
+            step.output = buffers.size();
+            buffers.push_back({computed->output_shape(), 0});
+            operands[var] = {Source::Buffer, step.output};
+            steps.push_back(std::move(step));
+        }
+        output = operand_of(output_var.get());
+        plan_arena();
+    }
+
+    template<typename T>
+    void FrozenGraph<T>::plan_arena() {
+        // Buffers start at 64 bytes boundaries.
+        const size_t alignment = std::max<size_t>(1, 64 / sizeof(T));
+        vector<size_t> last_read(buffers.size(), 0);
+        for (size_t s = 0; s < steps.size(); ++s)
+            for (const Operand& arg: steps[s].args)
+                if (arg.source == Source::Buffer)
+                    last_read[arg.index] = s;
+        if (output.source == Source::Buffer)
+            last_read[output.index] = steps.size();
+
+        // The live buffers, by offset -> end. A new buffer takes the first gap it fits in.
+        std::map<size_t, size_t> live;
+        arena_elements = 0;
+        for (size_t s = 0; s < steps.size(); ++s) {
+            Buffer& buffer = buffers[steps[s].output];
+            size_t size = std::max(alignment, (shape2size(buffer.shape) + alignment - 1) / alignment * alignment);
+            size_t offset = 0;
+            for (const auto& block: live) {
+                if (block.first - offset >= size)
+                    break;
+                offset = block.second;
+            }
+            buffer.offset = offset;
+            live[offset] = offset + size;
+            arena_elements = std::max(arena_elements, offset + size);
+            // The output of a step never shares memory with its arguments - they are only freed after it.
+            for (const Operand& arg: steps[s].args)
+                if (arg.source == Source::Buffer && last_read[arg.index] == s)
+                    live.erase(buffers[arg.index].offset);
+        }
+    }
+
+    template<typename T>
+    size_t FrozenGraph<T>::unplanned_size() const {
+        size_t total = 0;
+        for (const Buffer& buffer: buffers)
+            total += shape2size(buffer.shape);
+        return total;
+    }
+
+    template<typename T>
+    vector<const Tensor<T> *> FrozenGraph<T>::get_tensor_ptrs(const vector<Tensor<T>>& tensors) {
+        vector<const Tensor<T> *> ptrs;
+        ptrs.reserve(tensors.size());
+        for (const auto& tensor: tensors)
+            ptrs.push_back(&tensor);
+        return ptrs;
+    }
+
+    template<typename T>
+    const Tensor<T> *FrozenGraph<T>::resolve(const Operand& operand, const Arena& arena,
+                                            const vector<const Tensor<T> *>& inputs) const {
+        switch (operand.source) {
+            case Source::Input:
+                return inputs[operand.index];
+            case Source::Constant:
+                return &constants[operand.index];
+            case Source::Buffer:
+                return &arena.buffers[operand.index];
+        }
+        return nullptr;
+    }
+
+    template<typename T>
+    std::unique_ptr<typename FrozenGraph<T>::Arena> FrozenGraph<T>::make_arena() const {
+        std::unique_ptr<Arena> arena(new Arena);
+        arena->memory.resize(arena_elements);
+        arena->buffers.reserve(buffers.size());
+        for (const Buffer& buffer: buffers)
+            arena->buffers.push_back(Tensor<T>::wrap(arena->memory.data() + buffer.offset, buffer.shape));
+        // The inputs are only known when running.
+        arena->args.resize(steps.size());
+        for (size_t s = 0; s < steps.size(); ++s)
+            for (const Operand& arg: steps[s].args)
+                arena->args[s].push_back(arg.source == Source::Input ? nullptr : resolve(arg, *arena, {}));
+        return arena;
+    }
+
+    template<typename T>
+    Tensor<T> FrozenGraph<T>::run(const vector<const Tensor<T> *>& inputs) const {
+        if (inputs.size() != graph_input_shapes.size())
+            throw std::invalid_argument("Expected " + std::to_string(graph_input_shapes.size()) + " inputs, got " +
+                                        std::to_string(inputs.size()) + ".");
+        for (size_t i = 0; i < inputs.size(); ++i)
+            if (inputs[i]->shape != graph_input_shapes[i])
+                throw std::invalid_argument("Input " + std::to_string(i) + " should be of shape " +
+                                            shape2str(graph_input_shapes[i]) + ", got " +
+                                            shape2str(inputs[i]->shape) + ".");
+        std::unique_ptr<Arena> arena;
+        {
+            std::lock_guard<std::mutex> lock(arenas_mutex);
+            if (!free_arenas.empty()) {
+                arena = std::move(free_arenas.back());
+                free_arenas.pop_back();
+            }
+        }
+        if (!arena)
+            arena = make_arena();
+        for (size_t s = 0; s < steps.size(); ++s) {
+            const Step& step = steps[s];
+            vector<const Tensor<T> *>& args = arena->args[s];
+            for (size_t k = 0; k < step.args.size(); ++k)
+                if (step.args[k].source == Source::Input)
+                    args[k] = inputs[step.args[k].index];
+            INSTRUMENT_FORWARD(*step.functor);
+            step.functor->apply_forward(args, &arena->buffers[step.output]);
+        }
+        Tensor<T> result(*resolve(output, *arena, inputs));
+        {
+            std::lock_guard<std::mutex> lock(arenas_mutex);
+            free_arenas.push_back(std::move(arena));
+        }
+        return result;
+    }
+
+    template<typename T>
+    ostream& FrozenGraph<T>::print(ostream& os) const {
+        os << "FrozenGraph: " << steps.size() << " steps (" << fused_steps << " fused), "
+           << constants.size() << " constants, arena of " << arena_elements << " elements ("
+           << unplanned_size() << " without reuse)" << endl;
+        for (size_t s = 0; s < steps.size(); ++s) {
+            const Buffer& buffer = buffers[steps[s].output];
+            os << "  " << s << ": " << steps[s].functor->name() << " -> " << shape2str(buffer.shape)
+               << " at " << buffer.offset << endl;
+        }
+        return os;
+    }
+
+#define INSTANTIATE_FROZEN_GRAPH(dtype) \
+    template class FrozenGraph<dtype>;
+
+    INSTANTIATE_FROZEN_GRAPH(double)
+    INSTANTIATE_FROZEN_GRAPH(float)
+}
@@ -0,0 +1,124 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_FROZEN_H
+#define TARGETPRACTICE_FROZEN_H
+
+#include <mutex>
+#include "AutogradVariable.h"
+
+namespace autograd {
+
+    /**
+     * An inference-only executor compiled from a graph (see 'freeze').
+     * Compilation:
+     *   - The graph from the inputs to the output is flattened into a list of steps, in topological order.
+     *   - Every leaf that isn't an input (parameters, constants) is copied into the executor, and every
+     *     variable that only depends on such leaves is computed once and kept as a constant.
+     *   - Chains of element-wise functors are fused into a single FusedElemwiseFunctor.
+     *   - The outputs of the steps share a single arena - a buffer is reused as soon as the last step
+     *     that reads it is done.
+     * No gradients, dependees or variables are kept. The executor doesn't change (or depend on) the
+     * graph it was compiled from, so training can continue while it serves.
+     * @tparam T the data type.
+     * @note 'run' is thread safe - each concurrent run uses its own arena, and arenas are reused
+     *       between runs, so a run doesn't allocate (other than the returned output).
+     */
+    template<typename T>
+    class FrozenGraph {
+    public:
+        FrozenGraph(const Variable<T>& output, const vector<Variable<T>>& inputs);
+
+        FrozenGraph(const FrozenGraph&) = delete;
+
+        FrozenGraph& operator=(const FrozenGraph&) = delete;
+
+        // Computes the output from the inputs, given in the order of the inputs of the graph.
+        Tensor<T> run(const vector<const Tensor<T> *>& inputs) const;
+
+        inline Tensor<T> run(const vector<Tensor<T>>& inputs) const {
+            return run(get_tensor_ptrs(inputs));
+        }
+
+        inline const vector<shape_t>& input_shapes() const { return graph_input_shapes; }
+
+        inline const shape_t& output_shape() const { return graph_output_shape; }
+
+        inline size_t num_steps() const { return steps.size(); }
+
+        inline size_t num_constants() const { return constants.size(); }
+
+        inline size_t num_fused_steps() const { return fused_steps; }
+
+        // The number of elements of the arena of a single run.
+        inline size_t arena_size() const { return arena_elements; }
+
+        // The number of elements the outputs of the steps take without sharing the arena.
+        size_t unplanned_size() const;
+
+        ostream& print(ostream& os) const;
+
+    private:
+        enum class Source { Input, Constant, Buffer };
+
+        struct Operand {
+            Source source;
+            size_t index;
+        };
+
+        struct Step {
+            shared_ptr<Functor<T>> functor;
+            vector<Operand> args;
+            // The buffer of the output.
+            size_t output;
+        };
+
+        // The output of a step, in the arena.
+        struct Buffer {
+            shape_t shape;
+            size_t offset;
+        };
+
+        // The memory of a single run, with the views and the arguments of the steps prepared in advance.
+        struct Arena {
+            vector<T> memory;
+            vector<Tensor<T>> buffers;
+            vector<vector<const Tensor<T> *>> args;
+        };
+
+        vector<shape_t> graph_input_shapes;
+        shape_t graph_output_shape;
+        vector<Tensor<T>> constants;
+        vector<Buffer> buffers;
+        vector<Step> steps;
+        Operand output;
+        size_t arena_elements = 0;
+        size_t fused_steps = 0;
+
+        mutable std::mutex arenas_mutex;
+        mutable vector<std::unique_ptr<Arena>> free_arenas;
+
+        static vector<const Tensor<T> *> get_tensor_ptrs(const vector<Tensor<T>>& tensors);
+
+        void plan_arena();
+
+        std::unique_ptr<Arena> make_arena() const;
+
+        const Tensor<T> *resolve(const Operand& operand, const Arena& arena,
+                                 const vector<const Tensor<T> *>& inputs) const;
+    };
+
+    /**
+     * Compiles the graph that computes output from inputs into an inference-only executor.
+     * @param output the output of the graph.
+     * @param inputs the variables that are given to 'run', every InputBuffer the output depends
+     *        on must be one of them. Any other leaf is frozen with its current value.
+     */
+    template<typename T>
+    inline shared_ptr<FrozenGraph<T>> freeze(const Variable<T>& output, const vector<Variable<T>>& inputs) {
+        return std::make_shared<FrozenGraph<T>>(output, inputs);
+    }
+}
+
+#endif //TARGETPRACTICE_FROZEN_H
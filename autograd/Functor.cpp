@@ -4,20 +4,50 @@
 
 #include "Functor.h"
 
+#include <numeric>
+
 #include "AutogradVariable.h"
+#include "Constant.h"
+#include "GradMode.h"
 namespace autograd {
 
+template <typename T>
+string Functor<T>::name() const {
+    if (!fixed_name.empty()) return fixed_name;
+    return kind() + to_string(id) + describe();
+}
+
+template <typename T>
+double Functor<T>::forward_bytes() const {
+    double elems = shape2size(output_shape);
+    for (const auto& shape : input_shapes) elems += shape2size(shape);
+    return elems * sizeof(T);
+}
+
+template <typename T>
+double Functor<T>::backward_bytes(int input_idx) const {
+    // The inputs and the output, the gradient of the output and of the input.
+    return forward_bytes() + (double(shape2size(output_shape)) + shape2size(input_shapes[input_idx])) * sizeof(T);
+}
+
+template <typename T>
+shared_ptr<Functor<T>> Functor<T>::share() const {
+    shared_ptr<const Functor<T>> owner = this->weak_from_this().lock();
+    if (owner) return std::const_pointer_cast<Functor<T>>(owner);
+    return shared_ptr<Functor<T>>(clone());
+}
+
 template <typename T>
 void Functor<T>::check_arg_shapes(const vector<shape_t>& args) const {
     using std::to_string;
     if (args.size() != input_shapes.size())
         throw std::invalid_argument(
-            "Function " + name + " expects " + to_string(input_shapes.size()) +
+            "Function " + name() + " expects " + to_string(input_shapes.size()) +
             " arguments, got " + to_string(args.size()) + " arguments.");
     for (int i = 0; i < args.size(); ++i) {
         if (args[i] != input_shapes[i])
             throw std::invalid_argument(
-                "Function " + name + " argument " + to_string(i) +
+                "Function " + name() + " argument " + to_string(i) +
                 " expects input of shape " + shape2str(input_shapes[i]) +
                 ", got input of shape " + shape2str(args[i]));
     }
@@ -25,6 +55,11 @@ void Functor<T>::check_arg_shapes(const vector<shape_t>& args) const {
 
 template <typename T>
 void Functor<T>::check_args(const vector<Variable<T>>& args) const {
+    bool valid = args.size() == input_shapes.size();
+    for (int i = 0; valid && i < args.size(); ++i)
+        valid = args[i].shape() == input_shapes[i];
+    if (valid) return;
+    // Let check_arg_shapes decide (and build the error message).
     vector<shape_t> shapes(args.size());
     std::transform(args.begin(), args.end(), shapes.begin(),
                    [](const Variable<T>& v) { return v.shape(); });
@@ -35,9 +70,23 @@ template <typename T>
 Variable<T> Functor<T>::operator()(const vector<Variable<T>>& inputs,
                                    bool requires_grad) const {
     check_args(inputs);
-    Variable<T> ret = AutogradVariable<T>::make(name, *this, requires_grad);
+    static const size_t activation_tag = blas::memory::register_tag("activation");
+    blas::memory::MemoryTag tag(activation_tag);
+    // Inference mode - evaluate straight into the output, without building the graph.
+    if (!is_grad_enabled()) {
+        Tensor<T> out(output_shape);
+        INSTRUMENT_FORWARD(*this);
+        apply_forward(get_tensors(inputs), &out);
+        // Named after the functor like the graph's variables, so the results stay distinguishable.
+        return Constant<T>::make(name(), std::move(out));
+    }
+    // The name of the variable is generated lazily from the functor.
+    Variable<T> ret = AutogradVariable<T>::make("", *this, requires_grad);
     Tensor<T>& ret_tensor = ret.data();
-    apply_forward(get_tensors(inputs), &ret_tensor);
+    {
+        INSTRUMENT_FORWARD(*this);
+        apply_forward(get_tensors(inputs), &ret_tensor);
+    }
     for (const auto& v : inputs) ret.add_dependency(v);
     return ret;
 }
@@ -80,9 +129,7 @@ void ScalarTensorElemwiseFunctor<T>::apply_backward(
     int input_idx, const vector<const Tensor<T>*>& input_ptrs,
     const Tensor<T>* output_ptr, const Tensor<T>* output_grad_ptr,
     Tensor<T>* input_grad_ptr) const {
-    if (input_idx ==
-        (!scalar_first))  // We only calculate gradients for the tensor.
-        return;
+    // input_idx == 0 definitely - the scalar is not an input.
     binary_op<T> dop;  // takes 2 elements: (x_input, x_output) -> x_grad
     if (scalar_first) dop = (binary_op<T>)[this](T x, T y) {
             return this->_dop(this->scalar, x, y);
@@ -108,51 +155,49 @@ void TensorTensorElemwiseFunctor<T>::apply_forward(
 }
 
 /**
- * Applies a triop (i.e. (T, T, T) -> T) on 3 input tensors and stores in
- * output.
- * @tparam T the dtype
- * @param out output buffer
- * @param op
- * @param in1
- * @param in2
- * @param in3
- * @note in3.shape == out.shape
+ * Strides of a tensor in the index space of the output it is broadcast to.
+ * @param shape The shape of the tensor.
+ * @param out_shape The broadcast output shape.
+ * @return Right aligned strides, 0 for the missing and broadcast dimensions.
  */
-template <typename T>
-static void apply_triop(Tensor<T>& out, const std::function<T(T, T, T)>& op,
-                        const Tensor<T>& in1, const Tensor<T>& in2,
-                        const Tensor<T>& in3) {
-    using namespace blas;
-    if (in3.shape != out.shape)
-        throw shape_mismatch(in3.shape, out.shape, "apply_triop");
-    SliceGroup sg_in1 = SliceGroup::cover_shape(in1.shape);
-    T x;
-    binary_op<T> kernel = [&x, &op](T e2, T e3) -> T { return op(x, e2, e3); };
-    for (const auto& idx_in1 : sg_in1) {
-        size_t idx_true_in1 = ravel_index(idx_in1, in1.shape, in1.size);
-        x = Tensor<T>::get(in1, idx_true_in1);
-        auto [sg_in2, sg_out] =
-            broadcast_index(idx_in1, in1.shape, in2.shape, out.shape);
-        TensorSliced<T> slice_in2 = in2.unchecked_slice_group(sg_in2);
-        TensorSliced<T> slice_in3 = in3.unchecked_slice_group(sg_out);
-        TensorSliced<T> slice_out = out.unchecked_slice_group(sg_out);
-        slice_in2.apply_tensors(slice_in3, kernel, slice_out);
-    }
+static shape_t get_broadcast_strides(const shape_t& shape,
+                                     const shape_t& out_shape) {
+    shape_t strides = blas::shape2strides(shape);
+    shape_t ret(out_shape.size(), 0);
+    size_t offset = out_shape.size() - shape.size();
+    for (size_t d = 0; d < shape.size(); ++d)
+        if (shape[d] != 1) ret[offset + d] = strides[d];
+    return ret;
 }
 
-inline vector<int> get_output_reduction_dims(const shape_t& input_shape,
-                                             const shape_t& output_shape) {
-    vector<int> ret;
-    size_t dims_in = input_shape.size(), dims_out = output_shape.size();
-    for (int i = 0; i < dims_in; ++i) {
-        int idx_in = dims_in - i - 1;
-        int idx_out = dims_out - i - 1;
-        size_t s_in = input_shape[idx_in];
-        size_t s_out = output_shape[idx_out];
-        if (s_in != s_out && s_in == 1) ret.emplace_back(idx_out);
+/**
+ * Iterates over the elements of a (contiguous) output, carrying the offsets of
+ * the broadcast inputs along.
+ * @param out_shape The shape of the output.
+ * @param strides The broadcast strides of every input, see
+ * get_broadcast_strides.
+ * @param kernel Called as kernel(out_offset, in_offsets) for every element.
+ */
+template <class Kernel>
+static void for_each_broadcast(const shape_t& out_shape,
+                               const vector<shape_t>& strides,
+                               Kernel&& kernel) {
+    size_t size = std::accumulate(out_shape.begin(), out_shape.end(),
+                                  size_t(1), std::multiplies<size_t>{});
+    size_t num_inputs = strides.size();
+    shape_t index(out_shape.size(), 0);
+    vector<size_t> offsets(num_inputs, 0);
+    for (size_t i = 0; i < size; ++i) {
+        kernel(i, offsets);
+        for (int d = out_shape.size() - 1; d >= 0; --d) {
+            for (size_t k = 0; k < num_inputs; ++k)
+                offsets[k] += strides[k][d];
+            if (++index[d] < out_shape[d]) break;
+            for (size_t k = 0; k < num_inputs; ++k)
+                offsets[k] -= strides[k][d] * out_shape[d];
+            index[d] = 0;
+        }
     }
-    for (int i = 0; i < dims_out - dims_in; ++i) ret.emplace_back(i);
-    return ret;
 }
 
 template <typename T>
@@ -160,20 +205,35 @@ void TensorTensorElemwiseFunctor<T>::apply_backward(
     int input_idx, const vector<const Tensor<T>*>& input_ptrs,
     const Tensor<T>* output_ptr, const Tensor<T>* output_grad_ptr,
     Tensor<T>* input_grad_ptr) const {
-    // TODO - debug&  optimize.
     const Tensor<T>& in1 = *input_ptrs[0];
     const Tensor<T>& in2 = *input_ptrs[1];
-    const Tensor<T>& out = *output_ptr;
-    const Tensor<T>& out_grad = *output_grad_ptr;
-    Tensor<T>& in_grad = *input_grad_ptr;
-    Tensor<T>& grad_buffer = *grad_buffer_ptr;
+    const T* a = in1.get_data_ptr();
+    const T* b = in2.get_data_ptr();
+    const T* out = output_ptr->get_data_ptr();
+    const T* out_grad =
+        output_grad_ptr ? output_grad_ptr->get_data_ptr() : nullptr;
+    T* in_grad = input_grad_ptr->get_data_ptr();
     const jac_binary_op<T>& dop = _dops[input_idx];
-    apply_triop(grad_buffer, dop, in1, in2, out);
-    using b = common_math::binary_func_data<T>;
-    grad_buffer *= out_grad;
-    vector<int> reduction_dims =
-        get_output_reduction_dims(in_grad.shape, out_grad.shape);
-    grad_buffer.reduce(b::add, reduction_dims, in_grad);
+    const shape_t& out_shape = this->output_shape;
+    if (in1.shape == out_shape && in2.shape == out_shape) {
+        // Same shapes - the gradient is element-wise.
+        size_t size = output_ptr->size;
+        for (size_t i = 0; i < size; ++i)
+            in_grad[i] =
+                dop(a[i], b[i], out[i]) * (out_grad ? out_grad[i] : T(1));
+        return;
+    }
+    // Broadcast - accumulate the gradient of every output element into the
+    // input element it was broadcast from.
+    input_grad_ptr->fill_(T(0));
+    vector<shape_t> strides{get_broadcast_strides(in1.shape, out_shape),
+                            get_broadcast_strides(in2.shape, out_shape)};
+    for_each_broadcast(out_shape, strides,
+                       [&](size_t i, const vector<size_t>& offsets) {
+                           T grad = dop(a[offsets[0]], b[offsets[1]], out[i]);
+                           if (out_grad) grad *= out_grad[i];
+                           in_grad[offsets[input_idx]] += grad;
+                       });
 }
 
 template <typename T>
@@ -289,7 +349,7 @@ template <typename T>
 MatMulFunctor<T>::MatMulFunctor(const shape_t& m1_shape,
                                 const shape_t& m2_shape)
     : Functor<T>::Functor({m1_shape, m2_shape},
-                          get_mm_shape(m1_shape, m2_shape), "MatMul" + to_string(num_instances++)) {}
+                          get_mm_shape(m1_shape, m2_shape)) {}
 
 template <typename T>
 void MatMulFunctor<T>::apply_forward(const vector<const Tensor<T>*>& input_ptrs,
@@ -317,15 +377,355 @@ void MatMulFunctor<T>::apply_backward(
     }
 }
 
+inline shape_t get_linear_shape(const shape_t& input_shape,
+                                const shape_t& weight_shape) {
+    if (input_shape.size() != 2 || weight_shape.size() != 2)
+        throw std::invalid_argument(
+            "Linear requires an input and a weight with ndims=2.");
+    if (input_shape[1] != weight_shape[0])
+        throw std::invalid_argument("Linear input of shape " +
+                                    shape2str(input_shape) +
+                                    " doesn't match weight of shape " +
+                                    shape2str(weight_shape));
+    return {input_shape[0], weight_shape[1]};
+}
+
+inline vector<shape_t> get_linear_input_shapes(const shape_t& input_shape,
+                                               const shape_t& weight_shape,
+                                               bool has_bias) {
+    shape_t output_shape = get_linear_shape(input_shape, weight_shape);
+    vector<shape_t> shapes{input_shape, weight_shape};
+    if (has_bias) shapes.push_back({output_shape[1]});
+    return shapes;
+}
+
+template <typename T>
+typename LinearFunctor<T>::Activation LinearFunctor<T>::parse_activation(
+    const string& name) {
+    if (name.empty()) return Activation::None;
+    if (name == "relu") return Activation::Relu;
+    if (name == "sigmoid") return Activation::Sigmoid;
+    if (name == "tanh") return Activation::Tanh;
+    throw std::invalid_argument("Unsupported activation for Linear: \"" +
+                                name + "\".");
+}
+
+template <typename T>
+LinearFunctor<T>::LinearFunctor(const shape_t& input_shape,
+                                const shape_t& weight_shape, bool has_bias,
+                                const string& activation)
+    : Functor<T>(
+          get_linear_input_shapes(input_shape, weight_shape, has_bias),
+          get_linear_shape(input_shape, weight_shape)),
+      activation_name(activation),
+      activation(parse_activation(activation)),
+      has_bias(has_bias) {}
+
+template <typename T>
+void LinearFunctor<T>::activate_row(T* row, size_t size) const {
+    using ufd = common_math::unary_func_data<T>;
+    switch (activation) {
+        case Activation::None:
+            break;
+        case Activation::Relu:
+            for (size_t j = 0; j < size; ++j) row[j] = ufd::relu(row[j]);
+            break;
+        case Activation::Sigmoid:
+            for (size_t j = 0; j < size; ++j) row[j] = ufd::sigmoid(row[j]);
+            break;
+        case Activation::Tanh:
+            for (size_t j = 0; j < size; ++j) row[j] = ufd::tanh(row[j]);
+            break;
+    }
+}
+
+template <typename T>
+void LinearFunctor<T>::pre_activation_grad_row(const T* out_row,
+                                               const T* out_grad_row,
+                                               T* grad_row,
+                                               size_t size) const {
+    switch (activation) {
+        case Activation::None:
+            std::copy(out_grad_row, out_grad_row + size, grad_row);
+            break;
+        case Activation::Relu:
+            for (size_t j = 0; j < size; ++j)
+                grad_row[j] = out_row[j] > 0 ? out_grad_row[j] : T(0);
+            break;
+        case Activation::Sigmoid:
+            for (size_t j = 0; j < size; ++j)
+                grad_row[j] = out_grad_row[j] * out_row[j] * (1 - out_row[j]);
+            break;
+        case Activation::Tanh:
+            for (size_t j = 0; j < size; ++j)
+                grad_row[j] = out_grad_row[j] * (1 - out_row[j] * out_row[j]);
+            break;
+    }
+}
+
+template <typename T>
+void LinearFunctor<T>::apply_forward(const vector<const Tensor<T>*>& input_ptrs,
+                                     Tensor<T>* output_ptr) const {
+    size_t n = this->input_shapes[0][0], k = this->input_shapes[0][1],
+           m = this->output_shape[1];
+    const T* x = input_ptrs[0]->get_data_ptr();
+    const T* w = input_ptrs[1]->get_data_ptr();
+    const T* b = has_bias ? input_ptrs[2]->get_data_ptr() : nullptr;
+    T* out = output_ptr->get_data_ptr();
+    for (size_t i = 0; i < n; ++i) {
+        T* out_row = out + i * m;
+        const T* x_row = x + i * k;
+        if (b)
+            std::copy(b, b + m, out_row);
+        else
+            std::fill(out_row, out_row + m, T(0));
+        // i-l-j order - the inner loop runs over contiguous rows of the weight.
+        for (size_t l = 0; l < k; ++l) {
+            T x_il = x_row[l];
+            const T* w_row = w + l * m;
+            for (size_t j = 0; j < m; ++j) out_row[j] += x_il * w_row[j];
+        }
+        activate_row(out_row, m);
+    }
+}
+
+template <typename T>
+void LinearFunctor<T>::apply_backward(
+    int input_idx, const vector<const Tensor<T>*>& input_ptrs,
+    const Tensor<T>* output_ptr, const Tensor<T>* output_grad_ptr,
+    Tensor<T>* input_grad_ptr) const {
+    size_t n = this->input_shapes[0][0], k = this->input_shapes[0][1],
+           m = this->output_shape[1];
+    const T* x = input_ptrs[0]->get_data_ptr();
+    const T* w = input_ptrs[1]->get_data_ptr();
+    const T* out = output_ptr->get_data_ptr();
+    const T* out_grad = output_grad_ptr->get_data_ptr();
+    T* in_grad = input_grad_ptr->get_data_ptr();
+    vector<T> grad_row(m);
+    if (input_idx != 0) input_grad_ptr->fill_(T(0));
+    for (size_t i = 0; i < n; ++i) {
+        pre_activation_grad_row(out + i * m, out_grad + i * m, grad_row.data(),
+                                m);
+        if (input_idx == 0) {
+            // dx[i, :] = grad_row @ weight^T
+            T* in_grad_row = in_grad + i * k;
+            for (size_t l = 0; l < k; ++l) {
+                const T* w_row = w + l * m;
+                T accum = 0;
+                for (size_t j = 0; j < m; ++j) accum += grad_row[j] * w_row[j];
+                in_grad_row[l] = accum;
+            }
+        } else if (input_idx == 1) {
+            // dweight += x[i, :]^T @ grad_row
+            const T* x_row = x + i * k;
+            for (size_t l = 0; l < k; ++l) {
+                T x_il = x_row[l];
+                T* in_grad_row = in_grad + l * m;
+                for (size_t j = 0; j < m; ++j)
+                    in_grad_row[j] += x_il * grad_row[j];
+            }
+        } else {
+            for (size_t j = 0; j < m; ++j) in_grad[j] += grad_row[j];
+        }
+    }
+}
+
+template <typename T>
+int FusedElemwiseFunctor<T>::Builder::add_input(const shape_t& shape) {
+    if (!program.empty())
+        throw std::logic_error(
+            "The inputs of a fused functor must be added before its ops.");
+    input_shapes.push_back(shape);
+    return input_shapes.size() - 1;
+}
+
+template <typename T>
+int FusedElemwiseFunctor<T>::Builder::append(Instruction instruction) {
+    int num_registers = input_shapes.size() + program.size();
+    for (int reg : {instruction.lhs, instruction.rhs})
+        if (reg >= num_registers)
+            throw std::out_of_range("Register " + to_string(reg) +
+                                    " is not defined yet.");
+    program.push_back(std::move(instruction));
+    return num_registers;
+}
+
+template <typename T>
+int FusedElemwiseFunctor<T>::Builder::add_op(const Functor<T>& functor,
+                                             const vector<int>& operands) {
+    using I = Instruction;
+    if (operands.size() != functor.input_shapes.size())
+        throw std::invalid_argument(
+            "Function " + functor.name() + " expects " +
+            to_string(functor.input_shapes.size()) + " operands, got " +
+            to_string(operands.size()) + ".");
+    if (auto f = dynamic_cast<const MathFunctor<T>*>(&functor))
+        return append(I{I::Unary, operands[0], -1, f->_op, f->_dop, {}, {},
+                        T(0), false, f->op_name});
+    if (auto f = dynamic_cast<const ScalarTensorElemwiseFunctor<T>*>(&functor))
+        return append(I{I::Scalar, operands[0], -1, {}, {}, f->_op,
+                        {f->_dop, {}}, f->scalar, f->scalar_first,
+                        f->op_name});
+    if (auto f = dynamic_cast<const TensorTensorElemwiseFunctor<T>*>(&functor))
+        return append(I{I::Binary, operands[0], operands[1], {}, {}, f->_op,
+                        {f->_dops[0], f->_dops[1]}, T(0), false,
+                        f->op_name});
+    if (auto f = dynamic_cast<const FusedElemwiseFunctor<T>*>(&functor)) {
+        // Inline the program, renaming its registers.
+        vector<int> registers(operands);
+        for (I instruction : f->program) {
+            instruction.lhs = registers[instruction.lhs];
+            if (instruction.kind == I::Binary)
+                instruction.rhs = registers[instruction.rhs];
+            registers.push_back(append(std::move(instruction)));
+        }
+        return registers.back();
+    }
+    throw std::invalid_argument("Function " + functor.name() +
+                                " is not element-wise.");
+}
+
+template <typename T>
+FusedElemwiseFunctor<T> FusedElemwiseFunctor<T>::Builder::build() const {
+    return FusedElemwiseFunctor<T>(input_shapes, program);
+}
+
+template <typename T>
+bool FusedElemwiseFunctor<T>::is_elemwise(const Functor<T>& functor) {
+    return dynamic_cast<const MathFunctor<T>*>(&functor) ||
+           dynamic_cast<const ScalarTensorElemwiseFunctor<T>*>(&functor) ||
+           dynamic_cast<const TensorTensorElemwiseFunctor<T>*>(&functor) ||
+           dynamic_cast<const FusedElemwiseFunctor<T>*>(&functor);
+}
+
+static shape_t broadcast_all(const vector<shape_t>& shapes) {
+    shape_t ret;
+    for (const auto& shape : shapes) ret = blas::broadcast_shapes(ret, shape);
+    return ret;
+}
+
+template <typename T>
+string FusedElemwiseFunctor<T>::describe() const {
+    string ret = "[";
+    for (int i = 0; i < program.size(); ++i)
+        ret += (i == 0 ? "" : ", ") + program[i].op_name;
+    return ret + "]";
+}
+
+template <typename T>
+FusedElemwiseFunctor<T>::FusedElemwiseFunctor(
+    const vector<shape_t>& input_shapes, vector<Instruction> program)
+    : Functor<T>(input_shapes, broadcast_all(input_shapes)),
+      program(std::move(program)) {
+    if (this->program.empty())
+        throw std::invalid_argument("A fused functor requires at least one op.");
+    for (const auto& shape : input_shapes)
+        broadcast_strides.push_back(
+            get_broadcast_strides(shape, this->output_shape));
+}
+
+template <typename T>
+void FusedElemwiseFunctor<T>::run(vector<T>& registers) const {
+    using I = Instruction;
+    size_t reg = this->input_shapes.size();
+    for (const I& ins : program) {
+        T x = registers[ins.lhs];
+        switch (ins.kind) {
+            case I::Unary:
+                registers[reg++] = ins.unary(x);
+                break;
+            case I::Scalar:
+                registers[reg++] = ins.scalar_first ? ins.binary(ins.scalar, x)
+                                                    : ins.binary(x, ins.scalar);
+                break;
+            case I::Binary:
+                registers[reg++] = ins.binary(x, registers[ins.rhs]);
+                break;
+        }
+    }
+}
+
+template <typename T>
+void FusedElemwiseFunctor<T>::apply_forward(
+    const vector<const Tensor<T>*>& input_ptrs, Tensor<T>* output_ptr) const {
+    size_t num_inputs = input_ptrs.size();
+    vector<const T*> inputs(num_inputs);
+    for (size_t k = 0; k < num_inputs; ++k)
+        inputs[k] = input_ptrs[k]->get_data_ptr();
+    T* out = output_ptr->get_data_ptr();
+    vector<T> registers(num_inputs + program.size());
+    for_each_broadcast(
+        this->output_shape, broadcast_strides,
+        [&](size_t i, const vector<size_t>& offsets) {
+            for (size_t k = 0; k < num_inputs; ++k)
+                registers[k] = inputs[k][offsets[k]];
+            run(registers);
+            out[i] = registers.back();
+        });
+}
+
+template <typename T>
+void FusedElemwiseFunctor<T>::apply_backward(
+    int input_idx, const vector<const Tensor<T>*>& input_ptrs,
+    const Tensor<T>* output_ptr, const Tensor<T>* output_grad_ptr,
+    Tensor<T>* input_grad_ptr) const {
+    using I = Instruction;
+    size_t num_inputs = input_ptrs.size();
+    vector<const T*> inputs(num_inputs);
+    for (size_t k = 0; k < num_inputs; ++k)
+        inputs[k] = input_ptrs[k]->get_data_ptr();
+    const T* out_grad =
+        output_grad_ptr ? output_grad_ptr->get_data_ptr() : nullptr;
+    // Broadcast inputs get the gradient of several output elements.
+    input_grad_ptr->fill_(T(0));
+    T* in_grad = input_grad_ptr->get_data_ptr();
+    vector<T> registers(num_inputs + program.size());
+    vector<T> adjoints(registers.size());
+    for_each_broadcast(
+        this->output_shape, broadcast_strides,
+        [&](size_t i, const vector<size_t>& offsets) {
+            for (size_t k = 0; k < num_inputs; ++k)
+                registers[k] = inputs[k][offsets[k]];
+            run(registers);
+            std::fill(adjoints.begin(), adjoints.end(), T(0));
+            adjoints.back() = out_grad ? out_grad[i] : T(1);
+            for (int j = program.size() - 1; j >= 0; --j) {
+                const I& ins = program[j];
+                T adj = adjoints[num_inputs + j];
+                T x = registers[ins.lhs], out = registers[num_inputs + j];
+                switch (ins.kind) {
+                    case I::Unary:
+                        adjoints[ins.lhs] += adj * ins.dunary(x);
+                        break;
+                    case I::Scalar:
+                        adjoints[ins.lhs] +=
+                            adj * (ins.scalar_first
+                                       ? ins.dbinary[0](ins.scalar, x, out)
+                                       : ins.dbinary[0](x, ins.scalar, out));
+                        break;
+                    case I::Binary: {
+                        T y = registers[ins.rhs];
+                        adjoints[ins.lhs] += adj * ins.dbinary[0](x, y, out);
+                        adjoints[ins.rhs] += adj * ins.dbinary[1](x, y, out);
+                        break;
+                    }
+                }
+            }
+            in_grad[offsets[input_idx]] += adjoints[input_idx];
+        });
+}
+
 #define INSTANTIATE_TEMPLATE_FUNCTOR(dtype)            \
     template class Functor<dtype>;                     \
     template class MathFunctor<dtype>;                 \
     template class ScalarTensorElemwiseFunctor<dtype>; \
     template class TensorTensorElemwiseFunctor<dtype>; \
+    template class FusedElemwiseFunctor<dtype>;        \
     template class SelectFunctor<dtype>;               \
     template class SliceFunctor<dtype>;                \
     template class ReduceFunctor<dtype>;               \
-    template class MatMulFunctor<dtype>;
+    template class MatMulFunctor<dtype>;               \
+    template class LinearFunctor<dtype>;
 
 INSTANTIATE_TEMPLATE_FUNCTOR(double)
 INSTANTIATE_TEMPLATE_FUNCTOR(float)
@@ -5,8 +5,11 @@
 #ifndef TARGETPRACTICE_FUNCTOR_H
 #define TARGETPRACTICE_FUNCTOR_H
 
+#include <atomic>
+
 #include "VariableBase.h"
 #include "blas/blas.h"
+#include "utils/Tracer.h"
 
 namespace autograd {
 template <typename T>
@@ -26,20 +29,42 @@ inline vector<shape_t> get_shapes(const vector<Tensor<T>>& tensors) {
     return ret;
 }
 
+/**
+ * The state of a functor is immutable after construction, so a functor owned
+ * by a shared_ptr is shared by all the variables it creates instead of being
+ * cloned into each one of them.
+ */
 template <typename T>
-class Functor {
+class Functor : public std::enable_shared_from_this<Functor<T>> {
    public:
     const vector<shape_t> input_shapes;
     const shape_t output_shape;
-    const string name;
 
-    Functor(vector<shape_t> input_shapes, shape_t output_shape, string name)
+    Functor(vector<shape_t> input_shapes, shape_t output_shape)
         : input_shapes(std::move(input_shapes)),
           output_shape(std::move(output_shape)),
-          name(std::move(name)) {}
+          id(num_instances++) {}
+
+    // A functor with a fixed name, instead of one generated from its kind.
+    Functor(vector<shape_t> input_shapes, shape_t output_shape, string name)
+        : Functor(std::move(input_shapes), std::move(output_shape)) {
+        fixed_name = std::move(name);
+    }
 
     virtual ~Functor() = default;
 
+    // The name is only built when needed (graphviz, error messages), it is
+    // too expensive to build on every call of graphs rebuilt every step.
+    string name() const;
+
+    // The name of the op, shared by all of its functors, e.g. "ElemwiseTT[add]".
+    inline string kind_name() const { return kind() + describe(); }
+
+    // Estimates of the bytes read and written by a forward / backward (for instrumentation).
+    double forward_bytes() const;
+
+    double backward_bytes(int input_idx) const;
+
     // Throws exception for invalid arguments.
     virtual void check_arg_shapes(const vector<shape_t>& args) const;
 
@@ -84,26 +109,66 @@ class Functor {
     }
 
     virtual Functor<T>* clone() const = 0;
+
+    // Returns this functor if it is owned by a shared_ptr, else a clone of it.
+    shared_ptr<Functor<T>> share() const;
+
+   protected:
+    // A short name of the functor type, e.g. "MatMul".
+    virtual const char* kind() const { return "Functor"; }
+
+    // Details appended to the name, e.g. the op of an element-wise functor.
+    virtual string describe() const { return ""; }
+
+   private:
+    // Functors are created concurrently by graphs built on several threads.
+    inline static std::atomic<size_t> num_instances{0};
+    size_t id;
+    string fixed_name;
 };
 
+// Records a forward / backward of a functor, see blas/Instrumentation.h, and traces it (utils/Tracer.h).
+#define INSTRUMENT_FORWARD(functor)                                                                 \
+    AUTOGRAD_INSTRUMENT((functor).kind_name() + ".forward",                                         \
+                        ::blas::instrumentation::shapes2str((functor).input_shapes), 0,             \
+                        (functor).forward_bytes());                                                 \
+    TRACE_SCOPE("forward", (functor).name(),                                                        \
+                {{"inputs", ::blas::instrumentation::shapes2str((functor).input_shapes)},           \
+                 {"output", shape2str((functor).output_shape)}})
+#define INSTRUMENT_BACKWARD(functor, input_idx)                                                     \
+    AUTOGRAD_INSTRUMENT((functor).kind_name() + ".backward",                                        \
+                        ::blas::instrumentation::shapes2str((functor).input_shapes), 0,             \
+                        (functor).backward_bytes(input_idx));                                       \
+    TRACE_SCOPE("backward", (functor).name(),                                                       \
+                {{"inputs", ::blas::instrumentation::shapes2str((functor).input_shapes)},           \
+                 {"output", shape2str((functor).output_shape)},                                     \
+                 {"input", std::to_string(input_idx)}})
+
 #define OVERRIDE_CLONE(functor_type) \
     Functor<T>* clone() const override { return new functor_type(*this); }
 
+template <typename T>
+class FusedElemwiseFunctor;
+
 // Elementwise operation on a single tensor.
 template <typename T>
 class MathFunctor : public Functor<T> {
    private:
-    inline static int num_instances = 0;
+    const string op_name;
     const unary_op<T> _op;
     const unary_op<T> _dop;
     using ufd = common_math::unary_func_data<T>;
+    friend class FusedElemwiseFunctor<T>;
+
+   protected:
+    const char* kind() const override { return "ElemwiseT"; }
+    string describe() const override { return "[" + op_name + "]"; }
 
    public:
     inline MathFunctor(const shape_t& input_shape, const string& op_name,
                        const unary_op<T>& op, const unary_op<T>& dop)
-        : Functor<T>(
-              vector<shape_t>{input_shape}, input_shape,
-              "ElemwiseT" + to_string(num_instances++) + "[" + op_name + "]"),
+        : Functor<T>(vector<shape_t>{input_shape}, input_shape),
+          op_name(op_name),
           _op(op),
           _dop(dop) {}
 
@@ -135,12 +200,17 @@ class MathFunctor : public Functor<T> {
 template <typename T>
 class ScalarTensorElemwiseFunctor : public Functor<T> {
    private:
-    inline static int num_instances = 0;
+    const string op_name;
     const T scalar;
     const binary_op<T> _op;
     const jac_binary_op<T> _dop;
     const bool scalar_first;
     using bfd = common_math::binary_func_data<T>;
+    friend class FusedElemwiseFunctor<T>;
+
+   protected:
+    const char* kind() const override { return "ElemwiseST"; }
+    string describe() const override { return "[" + op_name + "]"; }
 
    public:
     inline ScalarTensorElemwiseFunctor(const shape_t& input_shape, T scalar,
@@ -148,9 +218,8 @@ class ScalarTensorElemwiseFunctor : public Functor<T> {
                                        const binary_op<T>& op,
                                        const jac_binary_op<T>& dop,
                                        bool scalar_first)
-        : Functor<T>(
-              vector<shape_t>{input_shape}, input_shape,
-              "ElemwiseST" + to_string(num_instances++) + "[" + op_name + "]"),
+        : Functor<T>(vector<shape_t>{input_shape}, input_shape),
+          op_name(op_name),
           scalar(scalar),
           _op(op),
           _dop(dop),
@@ -178,11 +247,15 @@ class ScalarTensorElemwiseFunctor : public Functor<T> {
 template <typename T>
 class TensorTensorElemwiseFunctor : public Functor<T> {
    private:
-    inline static int num_instances = 0;
-    shared_ptr<Tensor<T>> grad_buffer_ptr;
+    const string op_name;
     const binary_op<T> _op;
     const jac_binary_op<T> _dops[2];
     using bfd = common_math::binary_func_data<T>;
+    friend class FusedElemwiseFunctor<T>;
+
+   protected:
+    const char* kind() const override { return "ElemwiseTT"; }
+    string describe() const override { return "[" + op_name + "]"; }
 
    public:
     inline TensorTensorElemwiseFunctor(const shape_t& in_shape1,
@@ -191,14 +264,11 @@ class TensorTensorElemwiseFunctor : public Functor<T> {
                                        const binary_op<T>& op,
                                        const jac_binary_op<T>& dop1,
                                        const jac_binary_op<T>& dop2)
-        : Functor<T>(
-              {in_shape1, in_shape2},
-              blas::broadcast_shapes(in_shape1, in_shape2),
-              "ElemwiseTT" + to_string(num_instances++) + "[" + op_name + "]"),
+        : Functor<T>({in_shape1, in_shape2},
+                     blas::broadcast_shapes(in_shape1, in_shape2)),
+          op_name(op_name),
           _op(op),
-          _dops{dop1, dop2} {
-        grad_buffer_ptr = std::make_shared<Tensor<T>>(this->output_shape);
-    }
+          _dops{dop1, dop2} {}
 
     inline TensorTensorElemwiseFunctor(const shape_t& in_shape1,
                                        const shape_t& in_shape2,
@@ -221,6 +291,94 @@ class TensorTensorElemwiseFunctor : public Functor<T> {
     OVERRIDE_CLONE(TensorTensorElemwiseFunctor)
 };
 
+/**
+ * A chain of element-wise functors (MathFunctor, ScalarTensorElemwiseFunctor,
+ * TensorTensorElemwiseFunctor) executed as a single functor.
+ * The chain is kept as a small program over registers: the inputs come first,
+ * then one register per operation, and the last register is the output.
+ * Forward runs the program once per output element, so the intermediates
+ * never leave the registers. Backward re-runs the program from the saved
+ * inputs and sweeps it in reverse to get the gradient of a single input.
+ */
+template <typename T>
+class FusedElemwiseFunctor : public Functor<T> {
+   public:
+    struct Instruction {
+        enum Kind { Unary, Scalar, Binary };
+        Kind kind;
+        // Operand registers, rhs is only used by binary operations.
+        int lhs, rhs;
+        unary_op<T> unary, dunary;
+        binary_op<T> binary;
+        // Derivatives of a binary op w.r.t. (lhs, rhs). For a scalar op
+        // only the first one is used - the derivative w.r.t. the tensor.
+        jac_binary_op<T> dbinary[2];
+        T scalar;
+        bool scalar_first;
+        string op_name;
+    };
+
+    /**
+     * Builds the program of a fused functor. All the inputs must be added
+     * before the operations.
+     */
+    class Builder {
+       public:
+        // Adds an input of the fused functor, returns its register.
+        int add_input(const shape_t& shape);
+
+        /**
+         * Appends an element-wise functor applied on the given registers.
+         * @return The register of the result.
+         * @note The functor must be element-wise, see is_elemwise.
+         */
+        int add_op(const Functor<T>& functor, const vector<int>& operands);
+
+        inline size_t num_ops() const { return program.size(); }
+
+        FusedElemwiseFunctor<T> build() const;
+
+       private:
+        vector<shape_t> input_shapes;
+        vector<Instruction> program;
+
+        int append(Instruction instruction);
+    };
+
+    FusedElemwiseFunctor(const vector<shape_t>& input_shapes,
+                         vector<Instruction> program);
+
+    // Returns true if the functor can be a part of a fused functor.
+    static bool is_elemwise(const Functor<T>& functor);
+
+    inline const vector<Instruction>& get_program() const { return program; }
+
+    void apply_forward(const vector<const Tensor<T>*>& input_ptrs,
+                       Tensor<T>* output_ptr) const override;
+
+    void apply_backward(int input_idx,
+                        const vector<const Tensor<T>*>& input_ptrs,
+                        const Tensor<T>* output_ptr,
+                        const Tensor<T>* output_grad_ptr,
+                        Tensor<T>* input_grad_ptr) const override;
+
+    OVERRIDE_CLONE(FusedElemwiseFunctor)
+
+   protected:
+    const char* kind() const override { return "FusedElemwise"; }
+    string describe() const override;
+
+   private:
+    vector<Instruction> program;
+    // Strides of every input in the (broadcast) output index space,
+    // 0 along the broadcast dimensions.
+    vector<shape_t> broadcast_strides;
+
+    // Evaluates the program for a single element, registers[:num_inputs]
+    // must hold the inputs.
+    void run(vector<T>& registers) const;
+};
+
 template <typename T>
 class SelectFunctor : public Functor<T> {
     index_t selector_index;
@@ -238,12 +396,15 @@ class SelectFunctor : public Functor<T> {
         out_shape.erase(out_shape.begin(), out_shape.begin() + idx.size());
         return out_shape;
     }
-    inline static int num_instances = 0;
+
+   protected:
+    const char* kind() const override { return "Select"; }
+    string describe() const override { return vec2string(selector_index); }
 
    public:
     inline SelectFunctor(const shape_t& input_shape, const index_t& idx)
-        : Functor<T>({input_shape}, get_output_shape(input_shape, idx),
-                     "Select" + to_string(num_instances++) + vec2string(idx)) {}
+        : Functor<T>({input_shape}, get_output_shape(input_shape, idx)),
+          selector_index(idx) {}
     inline SelectFunctor(const shape_t& input_shape, long idx)
         : SelectFunctor(input_shape, index_t{idx}) {}
 
@@ -262,13 +423,14 @@ class SelectFunctor : public Functor<T> {
 template <typename T>
 class SliceFunctor : public Functor<T> {
     blas::SliceGroup slice_group;
-    inline static int num_instances = 0;
+
+   protected:
+    const char* kind() const override { return "Slice"; }
+    string describe() const override { return slice_group.to_str(); }
 
    public:
     inline SliceFunctor(const shape_t& input_shape, const blas::SliceGroup& sg)
-        : Functor<T>({input_shape}, sg.shape(),
-                     "Slice" + to_string(num_instances++) + sg.to_str()),
-          slice_group(sg) {}
+        : Functor<T>({input_shape}, sg.shape()), slice_group(sg) {}
     inline SliceFunctor(const shape_t& input_shape, const blas::Slice& slice)
         : SliceFunctor(input_shape,
                        blas::SliceGroup({slice}).fill_to_shape_(input_shape)) {}
@@ -288,7 +450,6 @@ class SliceFunctor : public Functor<T> {
 template <typename T>
 class ReduceFunctor : public Functor<T> {
     using bfd = common_math::binary_func_data<T>;
-    inline static int num_instances = 0;
     static inline shape_t reduced_shape(shape_t input_shape, vector<int> dims) {
         for (int dim : dims) {
             dim = normalize_index(dim, input_shape.size());
@@ -307,9 +468,8 @@ class ReduceFunctor : public Functor<T> {
     inline ReduceFunctor(const shape_t& input_shape, const string& op_name,
                          vector<int> dims, const binary_op<T>& op,
                          const reduce_op_jac& jac)
-        : Functor<T>({input_shape}, reduced_shape(input_shape, dims),
-                     "Reduce" + to_string(num_instances++) + "{" + op_name +
-                         "}" + vec2string(dims)),
+        : Functor<T>({input_shape}, reduced_shape(input_shape, dims)),
+          op_name(op_name),
           dims(dims),
           _op(op),
           _dop(jac),
@@ -317,7 +477,8 @@ class ReduceFunctor : public Functor<T> {
 
     inline ReduceFunctor(const shape_t& input_shape, const string& op_name,
                          const binary_op<T>& op, const reduce_op_jac& jac)
-        : Functor<T>({input_shape}, shape_t{}, "Reduce{" + op_name + "}"),
+        : Functor<T>({input_shape}, shape_t{}),
+          op_name(op_name),
           _op(op),
           _dop(jac),
           reduce_all_dims(true) {}
@@ -336,7 +497,14 @@ class ReduceFunctor : public Functor<T> {
                         const Tensor<T>* output_grad_ptr,
                         Tensor<T>* input_grad_ptr) const override;
 
+   protected:
+    const char* kind() const override { return "Reduce"; }
+    string describe() const override {
+        return "{" + op_name + "}" + (reduce_all_dims ? "" : vec2string(dims));
+    }
+
    private:
+    string op_name;
     vector<int> dims;
     binary_op<T> _op;  // This operation must be symmetric (op(a,b) = op(b,a)),
                        // else this functor isn't well defined!
@@ -346,7 +514,9 @@ class ReduceFunctor : public Functor<T> {
 
 template <typename T>
 class MatMulFunctor : public Functor<T> {
-    inline static int num_instances = 0;
+   protected:
+    const char* kind() const override { return "MatMul"; }
+
    public:
     MatMulFunctor(const shape_t& m1_shape, const shape_t& m2_shape);
 
@@ -361,6 +531,57 @@ class MatMulFunctor : public Functor<T> {
                         
     OVERRIDE_CLONE(MatMulFunctor);
 };
+
+/**
+ * A fully connected layer in a single kernel: activation(x @ weight + bias).
+ * The bias and the activation are applied to each row of the output right
+ * after it is accumulated, while it is still in cache, instead of in separate
+ * passes over the whole output. The backward computes the gradient of the
+ * pre-activation one row at a time and feeds it directly into the GEMMs (or
+ * the bias reduction), without materializing it.
+ * Inputs: x of shape (n, in), weight of shape (in, out), and an optional bias
+ * of shape (out).
+ * @note The supported activations are "relu", "sigmoid" and "tanh" (or "" for
+ *       none). Their derivatives are computed from the output, so the
+ *       pre-activation isn't stored.
+ */
+template <typename T>
+class LinearFunctor : public Functor<T> {
+   private:
+    enum class Activation { None, Relu, Sigmoid, Tanh };
+    const string activation_name;
+    const Activation activation;
+    const bool has_bias;
+
+    static Activation parse_activation(const string& name);
+
+    inline void activate_row(T* row, size_t size) const;
+
+    // The gradient of the pre-activation of a row of the output.
+    inline void pre_activation_grad_row(const T* out_row, const T* out_grad_row,
+                                        T* grad_row, size_t size) const;
+
+   protected:
+    const char* kind() const override { return "Linear"; }
+    string describe() const override {
+        return activation_name.empty() ? "" : "[" + activation_name + "]";
+    }
+
+   public:
+    LinearFunctor(const shape_t& input_shape, const shape_t& weight_shape,
+                  bool has_bias = true, const string& activation = "");
+
+    void apply_forward(const vector<const Tensor<T>*>& input_ptrs,
+                       Tensor<T>* output_ptr) const override;
+
+    void apply_backward(int input_idx,
+                        const vector<const Tensor<T>*>& input_ptrs,
+                        const Tensor<T>* output_ptr,
+                        const Tensor<T>* output_grad_ptr,
+                        Tensor<T>* input_grad_ptr) const override;
+
+    OVERRIDE_CLONE(LinearFunctor);
+};
 }  // namespace autograd
 
 #endif  // TARGETPRACTICE_FUNCTOR_H
@@ -0,0 +1,116 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Fusion.h"
+
+namespace autograd {
+
+    template<typename T>
+    AutogradVariable<T> *ElemwiseFusion<T>::as_elemwise(VariableBase<T> *var) {
+        auto autograd_var = dynamic_cast<AutogradVariable<T> *>(var);
+        if (autograd_var == nullptr || autograd_var->is_leaf() ||
+            !FusedElemwiseFunctor<T>::is_elemwise(*autograd_var->source_functor_ptr))
+            return nullptr;
+        return autograd_var;
+    }
+
+    template<typename T>
+    void ElemwiseFusion<T>::gather_post_order(VariableBase<T> *var, var_set& visited,
+                                              vector<VariableBase<T> *>& order) {
+        if (visited.count(var) > 0)
+            return;
+        visited.insert(var);
+        for (const auto& dep: var->dependencies)
+            gather_post_order(dep.get(), visited, order);
+        order.push_back(var);
+    }
+
+    template<typename T>
+    bool ElemwiseFusion<T>::is_foldable(VariableBase<T> *var, const Variable<T>& dep) {
+        AutogradVariable<T> *dep_elemwise = as_elemwise(dep.get());
+        // The only reference to dep must be the one held by var.
+        return as_elemwise(var) && dep_elemwise &&
+               dep->dependees.size() == 1 && dep.use_count() == 1 &&
+               dep->requires_grad == var->requires_grad &&
+               !dep_elemwise->checkpoint_ptr && !dep->is_data_released();
+    }
+
+    template<typename T>
+    void ElemwiseFusion<T>::gather_inputs(VariableBase<T> *var, const var_set& folded, Builder& builder,
+                                          unordered_map<VariableBase<T> *, int>& registers,
+                                          vector<Variable<T>>& inputs) {
+        for (const auto& dep: var->dependencies) {
+            if (folded.count(dep.get()) > 0)
+                gather_inputs(dep.get(), folded, builder, registers, inputs);
+            else if (registers.count(dep.get()) == 0) {
+                registers[dep.get()] = builder.add_input(dep.shape());
+                inputs.push_back(dep);
+            }
+        }
+    }
+
+    template<typename T>
+    int ElemwiseFusion<T>::emit(VariableBase<T> *var, const var_set& folded, Builder& builder,
+                                const unordered_map<VariableBase<T> *, int>& registers) {
+        vector<int> operands;
+        for (const auto& dep: var->dependencies)
+            operands.push_back(folded.count(dep.get()) > 0 ? emit(dep.get(), folded, builder, registers)
+                                                           : registers.at(dep.get()));
+        return builder.add_op(*as_elemwise(var)->source_functor_ptr, operands);
+    }
+
+    template<typename T>
+    void ElemwiseFusion<T>::rewrite(AutogradVariable<T> *var, const var_set& folded) {
+        Builder builder;
+        unordered_map<VariableBase<T> *, int> registers;
+        vector<Variable<T>> inputs;
+        gather_inputs(var, folded, builder, registers, inputs);
+        emit(var, folded, builder, registers);
+        auto fused_ptr = std::make_shared<FusedElemwiseFunctor<T>>(builder.build());
+
+        // Keep the folded chain alive until the inputs are rewired, it is destroyed
+        // (and detached from the inputs) when old_dependencies goes out of scope.
+        vector<Variable<T>> old_dependencies(var->dependencies);
+        for (const auto& dep: old_dependencies)
+            var->remove_dependency(dep);
+        var->_args.clear();
+        var->source_functor_ptr = fused_ptr;
+        for (const auto& input: inputs)
+            var->add_dependency(input);
+    }
+
+    template<typename T>
+    size_t ElemwiseFusion<T>::fuse(const Variable<T>& root) {
+        var_set visited;
+        vector<VariableBase<T> *> order;
+        gather_post_order(root.get(), visited, order);
+
+        var_set folded;
+        for (VariableBase<T> *var: order)
+            for (const auto& dep: var->dependencies)
+                if (is_foldable(var, dep))
+                    folded.insert(dep.get());
+
+        // Every chain is rewritten from its last variable, the one that isn't folded.
+        vector<AutogradVariable<T> *> chain_outputs;
+        for (VariableBase<T> *var: order) {
+            if (folded.count(var) > 0)
+                continue;
+            for (const auto& dep: var->dependencies)
+                if (folded.count(dep.get()) > 0) {
+                    chain_outputs.push_back(as_elemwise(var));
+                    break;
+                }
+        }
+        for (AutogradVariable<T> *var: chain_outputs)
+            rewrite(var, folded);
+        return chain_outputs.size();
+    }
+
+#define INSTANTIATE_ELEMWISE_FUSION(dtype) \
+    template class ElemwiseFusion<dtype>;
+
+    INSTANTIATE_ELEMWISE_FUSION(double)
+    INSTANTIATE_ELEMWISE_FUSION(float)
+}
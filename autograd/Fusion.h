@@ -0,0 +1,52 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_FUSION_H
+#define TARGETPRACTICE_FUSION_H
+
+#include "AutogradVariable.h"
+
+namespace autograd {
+
+    /**
+     * Graph optimization pass that fuses chains of element-wise functors into a FusedElemwiseFunctor.
+     * A variable is folded into its dependee if both are computed by element-wise functors and the
+     * dependee is its only user, i.e. it has a single dependee and no Variable outside of the graph
+     * refers to it. The folded intermediates are removed from the graph.
+     * @tparam T the data type.
+     * @note Run the pass before marking checkpointed segments - released variables are never folded.
+     */
+    template<typename T>
+    class ElemwiseFusion {
+    public:
+        // Fuses the graph of root in place, returns the number of fused functors created.
+        static size_t fuse(const Variable<T>& root);
+
+    private:
+        using var_set = unordered_set<VariableBase<T> *>;
+        using Builder = typename FusedElemwiseFunctor<T>::Builder;
+
+        static AutogradVariable<T> *as_elemwise(VariableBase<T> *var);
+
+        static void gather_post_order(VariableBase<T> *var, var_set& visited, vector<VariableBase<T> *>& order);
+
+        // Whether dep (a dependency of var) can be folded into var.
+        static bool is_foldable(VariableBase<T> *var, const Variable<T>& dep);
+
+        static void gather_inputs(VariableBase<T> *var, const var_set& folded, Builder& builder,
+                                  unordered_map<VariableBase<T> *, int>& registers, vector<Variable<T>>& inputs);
+
+        static int emit(VariableBase<T> *var, const var_set& folded, Builder& builder,
+                        const unordered_map<VariableBase<T> *, int>& registers);
+
+        static void rewrite(AutogradVariable<T> *var, const var_set& folded);
+    };
+
+    template<typename T>
+    inline size_t fuse_elemwise(const Variable<T>& root) {
+        return ElemwiseFusion<T>::fuse(root);
+    }
+}
+
+#endif //TARGETPRACTICE_FUSION_H
@@ -0,0 +1,18 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "GradMode.h"
+
+namespace autograd {
+
+    static thread_local bool grad_enabled = true;
+
+    bool is_grad_enabled() {
+        return grad_enabled;
+    }
+
+    void set_grad_enabled(bool enabled) {
+        grad_enabled = enabled;
+    }
+}
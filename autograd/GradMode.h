@@ -0,0 +1,36 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_GRADMODE_H
+#define TARGETPRACTICE_GRADMODE_H
+
+namespace autograd {
+
+    // Whether functor calls on the current thread build the graph (true by default).
+    bool is_grad_enabled();
+
+    void set_grad_enabled(bool enabled);
+
+    /**
+     * Disables graph construction on the current thread for the lifetime of the guard (inference mode).
+     * Inside the scope functor calls compute directly into their output tensor and return a constant,
+     * so no functor is cloned, no dependencies are wired and no gradient buffer is allocated.
+     * Guards can be nested, the previous mode is restored on destruction.
+     */
+    class NoGradGuard {
+    public:
+        NoGradGuard() : prev_mode(is_grad_enabled()) { set_grad_enabled(false); }
+
+        ~NoGradGuard() { set_grad_enabled(prev_mode); }
+
+        NoGradGuard(const NoGradGuard&) = delete;
+
+        NoGradGuard& operator=(const NoGradGuard&) = delete;
+
+    private:
+        const bool prev_mode;
+    };
+}
+
+#endif //TARGETPRACTICE_GRADMODE_H
@@ -25,6 +25,16 @@ namespace autograd {
 
         bool is_input_buffer() const final { return true; }
 
+        // Swaps the data of the buffer with t - a pointer swap, nothing is copied.
+        // The shapes must match, since the graph on top of the buffer depends on them.
+        void swap_data(Tensor<T>& t) {
+            if (t.shape != this->_data.shape)
+                throw std::invalid_argument("Cannot swap data of shape " + shape2str(t.shape) +
+                                            " into input buffer '" + this->get_name() + "' of shape " +
+                                            shape2str(this->_data.shape));
+            swap(this->_data, t);
+        }
+
     private:
         string node_style_graphviz() override {
             return "shape=box style=\"rounded, filled\"";
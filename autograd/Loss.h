@@ -18,6 +18,8 @@ namespace autograd {
     template<typename T>
     class Loss : public Functor<T> {
     public:
+        inline explicit Loss(const vector<shape_t>& input_shapes) : Functor<T>(input_shapes, shape_t{}) {}
+
         inline Loss(const vector<shape_t>& input_shapes, const string& name) : Functor<T>(input_shapes, shape_t{}, name) {}
 
         virtual void forward(const vector<const Tensor<T>*>& input_ptrs, Tensor<T>& out) const = 0;
@@ -42,12 +44,13 @@ namespace autograd {
 
     template<typename T>
     class MSELoss : public Loss<T> {
-        inline static int num_instances = 0;
         T normalization_factor;
+    protected:
+        const char *kind() const override { return "MSELoss"; }
+
     public:
         inline explicit MSELoss(const shape_t& input_shape) :
-            Loss<T>({input_shape, input_shape},
-                    "MSELoss" + to_string(num_instances++)) {
+            Loss<T>({input_shape, input_shape}) {
             // We normalize by the batch
             if (input_shape.empty())
                 throw std::runtime_error("MSELoss can only be calculated for rank 1 (or more) tensors.");
@@ -0,0 +1,130 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "MicroBatcher.h"
+#include <cstring>
+
+namespace autograd {
+
+    static shape_t drop_batch_dim(const shape_t& shape) {
+        return shape_t(shape.begin() + 1, shape.end());
+    }
+
+    template<typename T>
+    MicroBatcher<T>::MicroBatcher(shared_ptr<FrozenGraph<T>> graph, MicroBatcherOptions options) :
+            graph(std::move(graph)), options(options) {
+        const FrozenGraph<T>& frozen = *this->graph;
+        if (frozen.input_shapes().empty() || frozen.output_shape().empty())
+            throw std::invalid_argument("A batched graph needs inputs and an output with a batch dimension.");
+        size_t frozen_batch = frozen.output_shape()[0];
+        for (const shape_t& shape: frozen.input_shapes())
+            if (shape.empty() || shape[0] != frozen_batch)
+                throw std::invalid_argument("All the inputs must have the batch of the output (" +
+                                            std::to_string(frozen_batch) + ") as their first dimension, got " +
+                                            shape2str(shape) + ".");
+        if (this->options.max_batch == 0)
+            this->options.max_batch = frozen_batch;
+        if (this->options.max_batch > frozen_batch)
+            throw std::invalid_argument("max_batch can't exceed the frozen batch " + std::to_string(frozen_batch) + ".");
+        for (const shape_t& shape: frozen.input_shapes()) {
+            sample_shapes.push_back(drop_batch_dim(shape));
+            batch_inputs.push_back(blas::zeros<T>(shape));
+        }
+        output_sample_shape = drop_batch_dim(frozen.output_shape());
+        worker = std::thread(&MicroBatcher<T>::work, this);
+        Tracer::global().set_thread_name("MicroBatcher", worker.get_id());
+    }
+
+    template<typename T>
+    MicroBatcher<T>::~MicroBatcher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    template<typename T>
+    std::future<Tensor<T>> MicroBatcher<T>::submit(vector<Tensor<T>> sample) {
+        if (sample.size() != sample_shapes.size())
+            throw std::invalid_argument("Expected " + std::to_string(sample_shapes.size()) + " inputs, got " +
+                                        std::to_string(sample.size()) + ".");
+        for (size_t i = 0; i < sample.size(); ++i)
+            if (sample[i].shape != sample_shapes[i])
+                throw std::invalid_argument("Input " + std::to_string(i) + " should be of shape " +
+                                            shape2str(sample_shapes[i]) + ", got " + shape2str(sample[i].shape) + ".");
+        Request request{std::move(sample), {}, std::chrono::steady_clock::now()};
+        std::future<Tensor<T>> result = request.result.get_future();
+        bool wake_worker;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping)
+                throw std::logic_error("The batcher is stopping.");
+            queue.push_back(std::move(request));
+            // The worker only needs to wake up for the first request of a batch, or a full batch.
+            wake_worker = queue.size() == 1 || queue.size() >= options.max_batch;
+        }
+        if (wake_worker)
+            cv.notify_one();
+        return result;
+    }
+
+    template<typename T>
+    void MicroBatcher<T>::work() {
+        vector<Request> batch;
+        batch.reserve(options.max_batch);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+            auto deadline = queue.front().arrival + options.max_wait;
+            cv.wait_until(lock, deadline, [this] { return stopping || queue.size() >= options.max_batch; });
+            size_t batch_size = std::min(queue.size(), options.max_batch);
+            for (size_t i = 0; i < batch_size; ++i) {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+            lock.unlock();
+            run_batch(batch);
+            batch.clear();
+            lock.lock();
+        }
+    }
+
+    template<typename T>
+    void MicroBatcher<T>::run_batch(vector<Request>& batch) {
+        // Counted before the results are set, so a client that got its result sees its batch counted.
+        batches_run++;
+        requests_run += batch.size();
+        size_t num_done = 0;
+        try {
+            for (size_t i = 0; i < batch_inputs.size(); ++i) {
+                size_t sample_size = shape2size(sample_shapes[i]);
+                T *rows = batch_inputs[i].get_data_ptr();
+                for (size_t r = 0; r < batch.size(); ++r)
+                    Tensor<T>::wrap(rows + r * sample_size, sample_shapes[i]).copy_(batch[r].inputs[i]);
+            }
+            Tensor<T> output = graph->run(batch_inputs);
+            size_t output_sample_size = shape2size(output_sample_shape);
+            for (size_t r = 0; r < batch.size(); ++r) {
+                Tensor<T> row(output_sample_shape);
+                std::memcpy(row.get_data_ptr(), output.get_data_ptr() + r * output_sample_size,
+                            output_sample_size * sizeof(T));
+                batch[r].result.set_value(std::move(row));
+                num_done++;
+            }
+        } catch (...) {
+            for (size_t r = num_done; r < batch.size(); ++r)
+                batch[r].result.set_exception(std::current_exception());
+        }
+    }
+
+#define INSTANTIATE_MICRO_BATCHER(dtype) \
+    template class MicroBatcher<dtype>;
+
+    INSTANTIATE_MICRO_BATCHER(double)
+    INSTANTIATE_MICRO_BATCHER(float)
+}
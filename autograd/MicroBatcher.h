@@ -0,0 +1,90 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_MICROBATCHER_H
+#define TARGETPRACTICE_MICROBATCHER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <thread>
+#include "Frozen.h"
+
+namespace autograd {
+
+    struct MicroBatcherOptions {
+        // The largest batch that is run, 0 means the batch size the graph was frozen with.
+        size_t max_batch = 0;
+        // How long the first request of a batch waits for more requests to join it.
+        std::chrono::microseconds max_wait{500};
+    };
+
+    /**
+     * A serving front-end that coalesces single samples into batches for a frozen graph.
+     * Requests are queued, and a worker thread runs a batch once max_batch requests are waiting or
+     * the oldest one has waited max_wait, so a matmul over the batch is a single GEMM instead of a
+     * GEMV per request. The results are scattered back through futures.
+     * The graph must be frozen with the batch as the first dimension of all of its inputs and of its
+     * output. Batches smaller than the frozen batch are padded (with stale rows), so the rows of the
+     * output must only depend on the same rows of the inputs.
+     * @tparam T the data type.
+     */
+    template<typename T>
+    class MicroBatcher {
+    public:
+        MicroBatcher(shared_ptr<FrozenGraph<T>> graph, MicroBatcherOptions options = {});
+
+        MicroBatcher(const MicroBatcher&) = delete;
+
+        MicroBatcher& operator=(const MicroBatcher&) = delete;
+
+        // Runs the queued requests and stops the worker.
+        ~MicroBatcher();
+
+        // Queues a sample (one tensor per input of the graph, without the batch dimension).
+        std::future<Tensor<T>> submit(vector<Tensor<T>> sample);
+
+        inline std::future<Tensor<T>> submit(Tensor<T> sample) {
+            vector<Tensor<T>> inputs;
+            inputs.push_back(std::move(sample));
+            return submit(std::move(inputs));
+        }
+
+        inline size_t max_batch() const { return options.max_batch; }
+
+        inline size_t num_batches() const { return batches_run; }
+
+        inline size_t num_requests() const { return requests_run; }
+
+    private:
+        struct Request {
+            vector<Tensor<T>> inputs;
+            std::promise<Tensor<T>> result;
+            std::chrono::steady_clock::time_point arrival;
+        };
+
+        shared_ptr<FrozenGraph<T>> graph;
+        MicroBatcherOptions options;
+        // The shapes of a single sample of each input, and of the output.
+        vector<shape_t> sample_shapes;
+        shape_t output_sample_shape;
+        // The batched inputs, reused by all the batches.
+        vector<Tensor<T>> batch_inputs;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Request> queue;
+        bool stopping = false;
+        std::atomic<size_t> batches_run{0}, requests_run{0};
+        std::thread worker;
+
+        void work();
+
+        void run_batch(vector<Request>& batch);
+    };
+}
+
+#endif //TARGETPRACTICE_MICROBATCHER_H
@@ -5,6 +5,7 @@
 #ifndef TARGETPRACTICE_PARAMETER_H
 #define TARGETPRACTICE_PARAMETER_H
 
+#include <atomic>
 #include <utility>
 
 #include "VariableBase.h"
@@ -22,12 +23,41 @@ class Parameter : public VariableBase<T> {
 
     inline bool is_param() const final { return true; }
 
+    // Moves the data and the gradient of this parameter into external buffers
+    // of the same size (e.g. the flat buffers of a module), which must outlive
+    // the parameter. The parameter keeps its values, and a missing gradient is
+    // zeroed - unless keep_values=false, then it takes the values already in
+    // the buffers.
+    void bind_storage(T* data_ptr, T* grad_ptr, bool keep_values = true) {
+        Tensor<T> data = Tensor<T>::wrap(data_ptr, this->shape());
+        Tensor<T> grad = Tensor<T>::wrap(grad_ptr, this->shape());
+        if (keep_values) {
+            data.copy_(this->_data);
+            if (this->has_grad_buffer())
+                grad.copy_(this->_grad);
+            else
+                grad.fill_(T(0));
+        }
+        this->_data = std::move(data);
+        this->_grad = std::move(grad);
+        invalidate_layouts();
+    }
+
+    // A counter of the changes to the storage of the parameters (and to the
+    // parameters of the modules), so that a flat layout can be verified once
+    // and then trusted until the next change, instead of on every use.
+    static inline size_t layout_generation() { return generation.load(std::memory_order_acquire); }
+
+    static inline void invalidate_layouts() { generation.fetch_add(1, std::memory_order_acq_rel); }
+
     static Variable<T> make(const string& name, Tensor<T> t,
                             bool requires_grad = true) {
         return Variable<T>{new Parameter(name, std::move(t), requires_grad)};
     }
 
    private:
+    static inline std::atomic<size_t> generation{0};
+
     string node_style_graphviz() override {
         string style = "shape=box style=\"rounded\" ";
         style += " tooltip=\"shape=" + shape2str(this->shape()) + "\"";
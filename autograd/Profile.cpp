@@ -0,0 +1,145 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Profile.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+namespace autograd {
+
+    using clock_type = std::chrono::steady_clock;
+
+    static inline double seconds_since(clock_type::time_point start) {
+        return std::chrono::duration<double>(clock_type::now() - start).count();
+    }
+
+    template<typename T>
+    void GraphProfile<T>::gather(VariableBase<T> *var, unordered_set<VariableBase<T> *>& visited) {
+        if (visited.count(var) > 0)
+            return;
+        visited.insert(var);
+        for (const auto& dep: var->dependencies)
+            gather(dep.get(), visited);
+        order.push_back(var);
+    }
+
+    template<typename T>
+    GraphProfile<T>::GraphProfile(const Variable<T>& root, size_t repetitions) {
+        if (repetitions == 0)
+            throw std::invalid_argument("A graph profile needs at least one repetition.");
+        unordered_set<VariableBase<T> *> visited;
+        gather(root.get(), visited);
+        vector<NodeProfile> nodes(order.size());
+        for (size_t r = 0; r < repetitions; ++r) {
+            for (size_t i = 0; i < order.size(); ++i) {
+                if (order[i]->is_leaf())
+                    continue;
+                auto start = clock_type::now();
+                order[i]->forward();
+                nodes[i].forward_time += seconds_since(start);
+            }
+            // The backward of the nodes one by one, in reverse topological order - every node has all
+            // of its gradient by the time it is backpropagated.
+            root->zero_grad(true);
+            root->grad().fill_(T(1));
+            for (size_t i = order.size(); i-- > 0;) {
+                if (order[i]->is_leaf())
+                    continue;
+                auto start = clock_type::now();
+                order[i]->backward(nullptr, false);
+                nodes[i].backward_time += seconds_since(start);
+            }
+        }
+        for (size_t i = 0; i < order.size(); ++i) {
+            NodeProfile& node = nodes[i];
+            node.forward_time /= repetitions;
+            node.backward_time /= repetitions;
+            node.output_bytes = order[i]->data().size * sizeof(T);
+            node.grad_bytes = order[i]->has_grad_buffer() ? order[i]->grad().size * sizeof(T) : 0;
+            total_forward_time += node.forward_time;
+            total_backward_time += node.backward_time;
+            names.push_back(order[i]->get_name());
+            profiles[names.back()] = node;
+        }
+    }
+
+    template<typename T>
+    const NodeProfile *GraphProfile<T>::find(const string& name) const {
+        auto it = profiles.find(name);
+        return it == profiles.end() ? nullptr : &it->second;
+    }
+
+    static string format_time(double seconds) {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(1);
+        if (seconds >= 1e-3)
+            ss << seconds * 1e3 << " ms";
+        else
+            ss << seconds * 1e6 << " us";
+        return ss.str();
+    }
+
+    static string format_bytes(size_t bytes) {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(1);
+        if (bytes >= (1 << 20))
+            ss << bytes / double(1 << 20) << " MB";
+        else if (bytes >= (1 << 10))
+            ss << bytes / double(1 << 10) << " KB";
+        else
+            ss << bytes << " B";
+        return ss.str();
+    }
+
+    template<typename T>
+    GraphvizPrinter& GraphProfile<T>::annotate(GraphvizPrinter& gvzp) const {
+        double hottest = 0;
+        for (const auto& entry: profiles)
+            hottest = std::max(hottest, entry.second.total_time());
+        for (const auto& [name, node]: profiles) {
+            string annotation = "out " + format_bytes(node.output_bytes) + ", grad " + format_bytes(node.grad_bytes);
+            string fill_color;
+            // Leaves aren't computed - they keep their own style.
+            if (node.total_time() > 0) {
+                std::ostringstream share;
+                share << std::fixed << std::setprecision(1) << 100 * node.total_time() / total_time();
+                annotation = "fwd " + format_time(node.forward_time) + ", bwd " + format_time(node.backward_time) +
+                             " (" + share.str() + "%)\n" + annotation;
+                // From white (cold) to red (the hottest node), as an HSV color.
+                std::ostringstream hsv;
+                hsv << std::fixed << std::setprecision(3) << "0.000 " << node.total_time() / hottest << " 1.000";
+                fill_color = hsv.str();
+            }
+            gvzp.annotate_node(name, annotation, fill_color);
+        }
+        return gvzp;
+    }
+
+    template<typename T>
+    ostream& GraphProfile<T>::print(ostream& os) const {
+        vector<const string *> sorted;
+        for (const auto& name: names)
+            sorted.push_back(&name);
+        std::stable_sort(sorted.begin(), sorted.end(), [this](const string *a, const string *b) {
+            return profiles.at(*a).total_time() > profiles.at(*b).total_time();
+        });
+        os << std::left << std::setw(32) << "node" << std::right << std::setw(12) << "forward" << std::setw(12)
+           << "backward" << std::setw(12) << "output" << std::setw(12) << "grad" << endl;
+        for (const string *name: sorted) {
+            const NodeProfile& node = profiles.at(*name);
+            os << std::left << std::setw(32) << *name << std::right << std::setw(12) << format_time(node.forward_time)
+               << std::setw(12) << format_time(node.backward_time) << std::setw(12) << format_bytes(node.output_bytes)
+               << std::setw(12) << format_bytes(node.grad_bytes) << endl;
+        }
+        return os << "Total: forward " << format_time(total_forward_time) << ", backward "
+                  << format_time(total_backward_time) << endl;
+    }
+
+#define INSTANTIATE_GRAPH_PROFILE(dtype) \
+    template class GraphProfile<dtype>;
+
+    INSTANTIATE_GRAPH_PROFILE(double)
+    INSTANTIATE_GRAPH_PROFILE(float)
+}
@@ -0,0 +1,72 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_PROFILE_H
+#define TARGETPRACTICE_PROFILE_H
+
+#include "AutogradVariable.h"
+
+namespace autograd {
+
+    struct NodeProfile {
+        // Mean seconds of the forward / backward of the node, 0 for leaves.
+        double forward_time = 0, backward_time = 0;
+        size_t output_bytes = 0, grad_bytes = 0;
+
+        inline double total_time() const { return forward_time + backward_time; }
+    };
+
+    /**
+     * The measured time and memory of every node of a graph, node by node: the graph is run forward
+     * (in topological order) and backward (in reverse order, without recursion) repetitions times,
+     * timing every node separately.
+     * The graph is left with the data of a forward and the gradients of a single backward.
+     * Annotating a GraphvizPrinter turns the exported graph into a profiling view of the model - every
+     * node shows its times and bytes, and is colored by its share of the total time (a heatmap).
+     * @tparam T the data type.
+     */
+    template<typename T>
+    class GraphProfile {
+    public:
+        explicit GraphProfile(const Variable<T>& root, size_t repetitions = 5);
+
+        // The profile of the node of the graph named name, nullptr if there is no such node.
+        const NodeProfile *find(const string& name) const;
+
+        inline double total_time() const { return total_forward_time + total_backward_time; }
+
+        inline double forward_time() const { return total_forward_time; }
+
+        inline double backward_time() const { return total_backward_time; }
+
+        // Annotates the nodes of a printer that gathered the graph with their profiles.
+        GraphvizPrinter& annotate(GraphvizPrinter& gvzp) const;
+
+        // The nodes by total time, one per line.
+        ostream& print(ostream& os) const;
+
+    private:
+        // Topologically sorted - every node comes after its dependencies.
+        vector<VariableBase<T> *> order;
+        vector<string> names;
+        unordered_map<string, NodeProfile> profiles;
+        double total_forward_time = 0, total_backward_time = 0;
+
+        void gather(VariableBase<T> *var, unordered_set<VariableBase<T> *>& visited);
+    };
+
+    /**
+     * Gathers the graph of root with the profile of every node.
+     * @example
+     *   GraphvizPrinter gvzp;
+     *   profile_graphviz(loss, gvzp).export_to("model.svg");
+     */
+    template<typename T>
+    inline GraphvizPrinter& profile_graphviz(const Variable<T>& root, GraphvizPrinter& gvzp, size_t repetitions = 5) {
+        root->gather_connection_graphviz(gvzp);
+        return GraphProfile<T>(root, repetitions).annotate(gvzp);
+    }
+}
+
+#endif //TARGETPRACTICE_PROFILE_H
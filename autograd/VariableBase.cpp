@@ -47,6 +47,11 @@ namespace autograd {
 
     template<typename T>
     inline Tensor<T>& VariableBase<T>::grad() {
+        if (!has_grad_buffer()) {
+            static const size_t grad_tag = blas::memory::register_tag("grad");
+            blas::memory::MemoryTag tag(grad_tag);
+            _grad = blas::zeros_like(_data);
+        }
         return _grad;
     }
 
@@ -69,7 +74,13 @@ namespace autograd {
     template<typename T>
     void VariableBase<T>::accumulate_grad(const Tensor<T>& grad) {
         if (requires_grad)
-            _grad += grad;
+            this->grad() += grad;
+    }
+
+    template<typename T>
+    void VariableBase<T>::release_data() {
+        _data = Tensor<T>();
+        _grad = Tensor<T>();
     }
 
     template<typename T>
@@ -111,10 +122,10 @@ namespace autograd {
 
     template<typename T>
     GraphvizPrinter& VariableBase<T>::gather_connection_graphviz(GraphvizPrinter& gvzp) {
-        gvzp.create_node(this->name, this->node_style_graphviz());
+        gvzp.create_node(this->get_name(), this->node_style_graphviz());
         for (const auto& dep: dependencies) {
             dep->gather_connection_graphviz(gvzp);
-            gvzp.create_dependency(this->name, dep->name);
+            gvzp.create_dependency(this->get_name(), dep->get_name());
         }
         return gvzp;
     }
@@ -21,6 +21,18 @@ namespace autograd {
     template<typename T>
     class AutogradVariable;
 
+    template<typename T>
+    class Checkpoint;
+
+    template<typename T>
+    class ElemwiseFusion;
+
+    template<typename T>
+    class FrozenGraph;
+
+    template<typename T>
+    class GraphProfile;
+
     template<typename T>
     class VariableBase {
     protected:
@@ -41,13 +53,23 @@ namespace autograd {
         unordered_map<VariableBase *, int> unvisited_dependees;
 
         friend class AutogradVariable<T>;
+        friend class Checkpoint<T>;
+        friend class ElemwiseFusion<T>;
+        friend class FrozenGraph<T>;
+        friend class GraphProfile<T>;
+
+        // Drops the data (and gradient) buffers of this variable, keeping only
+        // the graph structure. Used by checkpointed segments, the data must be
+        // recomputed with '.forward()' before it is used again.
+        void release_data();
 
-        VariableBase(string name, const Tensor<T>& data, const Tensor<T>& grad_data, bool requires_grad = true) :
-                name(std::move(name)), _data(data),
-                _grad(grad_data), requires_grad(requires_grad) {}
+        VariableBase(string name, Tensor<T> data, Tensor<T> grad_data, bool requires_grad = true) :
+                name(std::move(name)), _data(std::move(data)),
+                _grad(std::move(grad_data)), requires_grad(requires_grad) {}
 
-        VariableBase(const string& name, const Tensor<T>& data, bool requires_grad = true)
-                : VariableBase(name, data, blas::zeros_like(data), requires_grad) {}
+        // The gradient buffer is allocated lazily, on the first access to '.grad()'.
+        VariableBase(string name, Tensor<T> data, bool requires_grad = true)
+                : VariableBase(std::move(name), std::move(data), Tensor<T>(), requires_grad) {}
 
     public:
         bool requires_grad;
@@ -56,9 +78,17 @@ namespace autograd {
 
         Tensor<T>& data();
 
+        // Returns the gradient, allocating a zeroed buffer if there is none yet.
         Tensor<T>& grad();
 
-        inline shape_t shape() const { return _data.shape; }
+        inline bool has_grad_buffer() const { return _grad.get_data_ptr() != nullptr; }
+
+        inline const shape_t& shape() const { return _data.shape; }
+
+        virtual string get_name() const { return name; }
+
+        // Returns true if the data of this variable was dropped by a checkpoint.
+        inline bool is_data_released() const { return _data.get_data_ptr() == nullptr; }
 
         virtual void add_dependency(const Variable<T>& dep);
 
@@ -121,7 +151,9 @@ namespace autograd {
         inline VariableBase<T>* get() const noexcept { return ptr.get(); }
         inline VariableBase<T>* operator->() const noexcept { return ptr.operator->(); }
         inline bool equals(const Variable& other) const noexcept { return ptr == other.ptr; }
-        inline shape_t shape() const { return ptr->shape(); }
+        // The number of Variables (including the dependencies of other variables) sharing this one.
+        inline long use_count() const noexcept { return ptr.use_count(); }
+        inline const shape_t& shape() const { return ptr->shape(); }
         inline Tensor<T>& data() const { return ptr->data(); }
         inline Tensor<T>& grad() const { return ptr->grad(); }
         inline void add_dependency(const Variable& dep) const { return ptr->add_dependency(dep); }
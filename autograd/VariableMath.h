@@ -15,18 +15,24 @@ namespace autograd {
 #define VARIABLE_BINARY_MATH_MACRO(op, op_name, modifier)                                               \
     template<typename T>                                                                                \
     Variable<T> modifier op(const Variable<T>& v1, const Variable<T>& v2) {                             \
-        TensorTensorElemwiseFunctor<T> functor{v1.shape(), v2.shape(), op_name};                        \
-        return functor({v1, v2});                                                                       \
+        static const auto& data = common_math::binary_func_data<T>::get_function_data(op_name);         \
+        auto functor = std::make_shared<TensorTensorElemwiseFunctor<T>>(                                \
+                v1.shape(), v2.shape(), op_name, get<0>(data), get<1>(data), get<2>(data));             \
+        return (*functor)({v1, v2});                                                                    \
     }                                                                                                   \
     template<typename T>                                                                                \
     Variable<T> modifier op(T scalar, const Variable<T>& v) {                                           \
-        ScalarTensorElemwiseFunctor<T> functor{v.shape(), scalar, op_name, true};                       \
-        return functor({v});                                                                            \
+        static const auto& data = common_math::binary_func_data<T>::get_function_data(op_name);         \
+        auto functor = std::make_shared<ScalarTensorElemwiseFunctor<T>>(                                \
+                v.shape(), scalar, op_name, get<0>(data), get<2>(data), true);                          \
+        return (*functor)({v});                                                                         \
     }                                                                                                   \
     template<typename T>                                                                                \
     Variable<T> modifier op(const Variable<T>& v, T scalar) {                                           \
-        ScalarTensorElemwiseFunctor<T> functor{v.shape(), scalar, op_name, false};                      \
-        return functor({v});                                                                            \
+        static const auto& data = common_math::binary_func_data<T>::get_function_data(op_name);         \
+        auto functor = std::make_shared<ScalarTensorElemwiseFunctor<T>>(                                \
+                v.shape(), scalar, op_name, get<0>(data), get<1>(data), false);                         \
+        return (*functor)({v});                                                                         \
     }
 
 #define VARIABLE_MATH_OP(op, op_name) VARIABLE_BINARY_MATH_MACRO(op, op_name, operator)
@@ -40,13 +46,15 @@ namespace autograd {
 #define VARIABLE_MATH_FUNC(func) \
     template<typename T>         \
     Variable<T> func(const Variable<T>& v) { \
-        MathFunctor<T> functor{v.shape(), #func}; \
-        return functor({v}); \
+        static const auto& data = common_math::unary_func_data<T>::get_function_data(#func); \
+        auto functor = std::make_shared<MathFunctor<T>>(v.shape(), #func, data.first, data.second); \
+        return (*functor)({v}); \
     }
     MACRO_MATH_FUNCTIONS(VARIABLE_MATH_FUNC)
 
     static inline string generate_op_name(){
-        static int i = 0;
+        // Graphs may be built concurrently on several threads.
+        static std::atomic<int> i{0};
         using std::to_string;
         return "op__" + to_string(i++);
     }
@@ -56,8 +64,8 @@ namespace autograd {
                        const binary_op<T>& op, const binary_op<T>& op_jac, const vector<int>& dims, string op_name = "") {
         if (op_name.empty())
             op_name = generate_op_name();
-        ReduceFunctor<T> functor(v.shape(), op_name, dims, op, op_jac);
-        return functor({v});
+        auto functor = std::make_shared<ReduceFunctor<T>>(v.shape(), op_name, dims, op, op_jac);
+        return (*functor)({v});
     }
 
     template<typename T>
@@ -77,14 +85,14 @@ namespace autograd {
 
     template<typename T>
     inline Variable<T> sum(const Variable<T>& v) {
-        ReduceFunctor<T> functor{v.shape(), "add"};
-        return functor({v});
+        auto functor = std::make_shared<ReduceFunctor<T>>(v.shape(), "add");
+        return (*functor)({v});
     }
 
     template<typename T>
     inline Variable<T> sum(const Variable<T>& v, const vector<int>& dims) {
-        ReduceFunctor<T> functor{v.shape(), "add", dims};
-        return functor({v});
+        auto functor = std::make_shared<ReduceFunctor<T>>(v.shape(), "add", dims);
+        return (*functor)({v});
     } 
 
     template<typename T>
@@ -94,8 +102,23 @@ namespace autograd {
 
     template<typename T>
     inline Variable<T> matmul(const Variable<T>& v1, const Variable<T>& v2) {
-        MatMulFunctor<T> functor{v1.shape(), v2.shape()};
-        return functor(v1, v2);
+        auto functor = std::make_shared<MatMulFunctor<T>>(v1.shape(), v2.shape());
+        return (*functor)(v1, v2);
+    }
+
+    // activation(x @ weight + bias) in a single fused functor, see LinearFunctor.
+    template<typename T>
+    inline Variable<T> linear(const Variable<T>& x, const Variable<T>& weight, const Variable<T>& bias,
+                              const string& activation = "") {
+        auto functor = std::make_shared<LinearFunctor<T>>(x.shape(), weight.shape(), true, activation);
+        return (*functor)(x, weight, bias);
+    }
+
+    // activation(x @ weight) in a single fused functor, see LinearFunctor.
+    template<typename T>
+    inline Variable<T> linear(const Variable<T>& x, const Variable<T>& weight, const string& activation = "") {
+        auto functor = std::make_shared<LinearFunctor<T>>(x.shape(), weight.shape(), false, activation);
+        return (*functor)(x, weight);
     }
 }
 
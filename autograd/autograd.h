@@ -12,5 +12,11 @@
 #include "Constant.h"
 #include "VariableMath.h"
 #include "Loss.h"
+#include "Checkpoint.h"
+#include "GradMode.h"
+#include "Fusion.h"
+#include "Frozen.h"
+#include "MicroBatcher.h"
+#include "Profile.h"
 
 #endif //TARGETPRACTICE_AUTOGRAD_H
@@ -0,0 +1,38 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+    std::atomic<size_t> num_allocations{0};
+    std::atomic<size_t> num_allocated_bytes{0};
+}
+
+// operator new[] and the nothrow variants forward to this one.
+void *operator new(std::size_t size) {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    num_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    void *ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace bench {
+
+    AllocationStats allocation_stats() {
+        return {num_allocations.load(std::memory_order_relaxed), num_allocated_bytes.load(std::memory_order_relaxed)};
+    }
+}
@@ -0,0 +1,26 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_ALLOCATIONCOUNTER_H
+#define TARGETPRACTICE_ALLOCATIONCOUNTER_H
+
+#include <cstddef>
+
+namespace bench {
+
+    struct AllocationStats {
+        size_t count;
+        size_t bytes;
+    };
+
+    /**
+     * The number of heap allocations (and their total size) since the start of the program.
+     * The global operator new is replaced by a counting one in every executable that links the
+     * allocationcounter library (all the benchmarks), so this covers the allocations of all the
+     * libraries (e.g. the Tensor buffers).
+     */
+    AllocationStats allocation_stats();
+}
+
+#endif //TARGETPRACTICE_ALLOCATIONCOUNTER_H
@@ -0,0 +1,238 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Baseline.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace bench {
+
+    namespace {
+
+        /**
+         * A reader of the subset of JSON write_json produces: the values it doesn't need are
+         * skipped, so a baseline may carry extra fields.
+         */
+        class JsonReader {
+        public:
+            JsonReader(string text, string source) : text(std::move(text)), source(std::move(source)) {}
+
+            std::map<string, BaselineEntry> read_benchmarks() {
+                std::map<string, BaselineEntry> entries;
+                read_object([&](const string& key) {
+                    if (key != "benchmarks")
+                        return skip_value();
+                    read_array([&]() {
+                        BaselineEntry entry{"", 0, {}};
+                        read_object([&](const string& field) {
+                            if (field == "name")
+                                entry.name = read_string();
+                            else if (field == "median")
+                                entry.median = read_number();
+                            else if (field == "samples")
+                                read_array([&]() { entry.samples.push_back(read_number()); });
+                            else
+                                skip_value();
+                        });
+                        if (entry.name.empty() || entry.samples.empty())
+                            fail("a benchmark without a name or samples");
+                        entries[entry.name] = std::move(entry);
+                    });
+                });
+                return entries;
+            }
+
+        private:
+            string text;
+            string source;
+            size_t pos = 0;
+
+            [[noreturn]] void fail(const string& what) const {
+                throw std::runtime_error("Invalid baseline '" + source + "': " + what + " at offset " +
+                                         std::to_string(pos) + ".");
+            }
+
+            char peek() {
+                while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+                    ++pos;
+                if (pos == text.size())
+                    fail("unexpected end");
+                return text[pos];
+            }
+
+            void expect(char c) {
+                if (peek() != c)
+                    fail(string("expected '") + c + "'");
+                ++pos;
+            }
+
+            template<typename F>
+            void read_object(F&& on_field) {
+                expect('{');
+                if (peek() == '}') {
+                    ++pos;
+                    return;
+                }
+                while (true) {
+                    string key = read_string();
+                    expect(':');
+                    on_field(key);
+                    if (peek() != ',')
+                        break;
+                    ++pos;
+                }
+                expect('}');
+            }
+
+            template<typename F>
+            void read_array(F&& on_element) {
+                expect('[');
+                if (peek() == ']') {
+                    ++pos;
+                    return;
+                }
+                while (true) {
+                    on_element();
+                    if (peek() != ',')
+                        break;
+                    ++pos;
+                }
+                expect(']');
+            }
+
+            string read_string() {
+                expect('"');
+                string out;
+                while (pos < text.size() && text[pos] != '"') {
+                    if (text[pos] == '\\')
+                        ++pos;
+                    if (pos < text.size())
+                        out += text[pos++];
+                }
+                expect('"');
+                return out;
+            }
+
+            double read_number() {
+                peek();
+                const char *begin = text.c_str() + pos;
+                char *end;
+                double value = std::strtod(begin, &end);
+                if (end == begin)
+                    fail("expected a number");
+                pos += end - begin;
+                return value;
+            }
+
+            void skip_value() {
+                char c = peek();
+                if (c == '{')
+                    read_object([&](const string&) { skip_value(); });
+                else if (c == '[')
+                    read_array([&]() { skip_value(); });
+                else if (c == '"')
+                    read_string();
+                else if (text.compare(pos, 4, "true") == 0 || text.compare(pos, 4, "null") == 0)
+                    pos += 4;
+                else if (text.compare(pos, 5, "false") == 0)
+                    pos += 5;
+                else
+                    read_number();
+            }
+        };
+    }
+
+    std::map<string, BaselineEntry> read_baseline(const string& path) {
+        std::ifstream is(path);
+        if (!is)
+            throw std::runtime_error("Couldn't open the baseline '" + path + "'.");
+        std::stringstream ss;
+        ss << is.rdbuf();
+        return JsonReader(ss.str(), path).read_benchmarks();
+    }
+
+    double mann_whitney_p_value(const vector<double>& baseline, const vector<double>& current) {
+        const size_t n1 = baseline.size(), n2 = current.size(), n = n1 + n2;
+        if (n1 == 0 || n2 == 0)
+            return 1;
+        // Rank the pooled samples, ties get the average of their ranks.
+        vector<std::pair<double, bool>> pooled;
+        pooled.reserve(n);
+        for (double x: baseline)
+            pooled.emplace_back(x, false);
+        for (double x: current)
+            pooled.emplace_back(x, true);
+        std::sort(pooled.begin(), pooled.end());
+        double rank_sum = 0, tie_term = 0;
+        for (size_t i = 0; i < n;) {
+            size_t j = i;
+            while (j < n && pooled[j].first == pooled[i].first)
+                ++j;
+            double rank = (i + 1 + j) / 2.;
+            for (size_t k = i; k < j; ++k)
+                if (pooled[k].second)
+                    rank_sum += rank;
+            double t = j - i;
+            tie_term += t * t * t - t;
+            i = j;
+        }
+        // U of current: the number of (baseline, current) pairs where current is slower.
+        double u = rank_sum - n2 * (n2 + 1) / 2.;
+        double mean = n1 * n2 / 2.;
+        double variance = n1 * n2 / 12. * ((n + 1) - tie_term / (double(n) * (n - 1)));
+        if (variance <= 0)
+            return u > mean ? 0 : 1;
+        double z = (u - mean - 0.5) / std::sqrt(variance);
+        return 0.5 * std::erfc(z / std::sqrt(2.));
+    }
+
+    vector<BaselineComparison> compare_to_baseline(const vector<BenchmarkResult>& results,
+                                                   const std::map<string, BaselineEntry>& baseline,
+                                                   double threshold, double alpha) {
+        vector<BaselineComparison> comparisons;
+        for (const auto& result: results) {
+            auto it = baseline.find(result.name);
+            if (it == baseline.end()) {
+                comparisons.push_back({result.name, 0, result.median, 0, 1, BaselineComparison::New});
+                continue;
+            }
+            const BaselineEntry& entry = it->second;
+            double ratio = entry.median > 0 ? result.median / entry.median : 1;
+            double p_slower = mann_whitney_p_value(entry.samples, result.samples);
+            double p_faster = mann_whitney_p_value(result.samples, entry.samples);
+            BaselineComparison comparison{result.name, entry.median, result.median, ratio, p_slower,
+                                          BaselineComparison::Unchanged};
+            if (p_slower < alpha && ratio > 1 + threshold)
+                comparison.verdict = BaselineComparison::Slower;
+            else if (p_faster < alpha && ratio < 1 / (1 + threshold)) {
+                comparison.verdict = BaselineComparison::Faster;
+                comparison.p_value = p_faster;
+            }
+            comparisons.push_back(comparison);
+        }
+        return comparisons;
+    }
+
+    size_t print_comparison(ostream& os, const vector<BaselineComparison>& comparisons) {
+        static const char *verdict_names[] = {"", "faster", "SLOWER", "new"};
+        size_t regressions = 0;
+        os << left << setw(44) << "benchmark" << right << setw(14) << "baseline us" << setw(12) << "median us"
+           << setw(10) << "ratio" << setw(11) << "p-value" << "  verdict" << endl;
+        for (const auto& c: comparisons) {
+            os << left << setw(44) << c.name << right << fixed << setprecision(2) << setw(14)
+               << c.baseline_median * 1e6 << setw(12) << c.median * 1e6 << setw(10) << c.ratio
+               << scientific << setprecision(1) << setw(11) << c.p_value << defaultfloat << "  "
+               << verdict_names[c.verdict] << endl;
+            regressions += c.verdict == BaselineComparison::Slower;
+        }
+        os << regressions << " regression(s) in " << comparisons.size() << " benchmark(s)." << endl;
+        return regressions;
+    }
+}
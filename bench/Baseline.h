@@ -0,0 +1,55 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_BASELINE_H
+#define TARGETPRACTICE_BASELINE_H
+
+#include "Benchmark.h"
+
+namespace bench {
+
+    // A benchmark of a baseline, as written by BenchmarkRunner::write_json.
+    struct BaselineEntry {
+        string name;
+        double median;
+        // Seconds per call, one per sample.
+        vector<double> samples;
+    };
+
+    // Reads the benchmarks of a JSON file written by BenchmarkRunner::write_json, by name.
+    std::map<string, BaselineEntry> read_baseline(const string& path);
+
+    /**
+     * The one-sided Mann-Whitney U test: the probability of seeing samples at least as slow as
+     * current if they came from the same distribution as baseline (normal approximation, with
+     * the tie and continuity corrections). Doesn't assume the timings are normally distributed,
+     * and isn't thrown off by a few outliers.
+     */
+    double mann_whitney_p_value(const vector<double>& baseline, const vector<double>& current);
+
+    struct BaselineComparison {
+        enum Verdict { Unchanged, Faster, Slower, New };
+
+        string name;
+        double baseline_median, median;
+        // median / baseline_median.
+        double ratio;
+        // Of the test that the benchmark is slower (or faster, for a Faster verdict).
+        double p_value;
+        Verdict verdict;
+    };
+
+    /**
+     * Compares results to a baseline. A benchmark is Slower (Faster) only if both the test is significant
+     * (p_value < alpha) and its median moved by more than threshold (relative), so noise isn't reported.
+     */
+    vector<BaselineComparison> compare_to_baseline(const vector<BenchmarkResult>& results,
+                                                   const std::map<string, BaselineEntry>& baseline,
+                                                   double threshold, double alpha);
+
+    // Prints a regression report of the comparisons, returns the number of regressions.
+    size_t print_comparison(ostream& os, const vector<BaselineComparison>& comparisons);
+}
+
+#endif //TARGETPRACTICE_BASELINE_H
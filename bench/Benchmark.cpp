@@ -0,0 +1,220 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Benchmark.h"
+#include "AllocationCounter.h"
+#include "Baseline.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+namespace bench {
+
+    using clock_type = std::chrono::steady_clock;
+
+    BenchmarkRunner::BenchmarkRunner(BenchmarkOptions options) : options(std::move(options)) {
+        if (this->options.repetitions == 0)
+            throw std::invalid_argument("A benchmark needs at least one repetition.");
+        if (this->options.perf_counters) {
+            perf_counters = std::make_unique<PerfCounters>();
+            if (!perf_counters->is_available()) {
+                cout << "Hardware counters are unavailable (" << perf_counters->error() << "), "
+                     << "reporting timings only." << endl;
+                perf_counters.reset();
+            }
+        }
+        cout << left << setw(44) << "benchmark" << right << setw(12) << "median us" << setw(12) << "p95 us"
+             << setw(10) << "GFLOP/s" << setw(10) << "GB/s" << setw(10) << "allocs";
+        if (perf_counters)
+            cout << setw(8) << "IPC" << setw(10) << "LLC miss" << setw(10) << "br miss";
+        cout << endl;
+    }
+
+    BenchmarkOptions BenchmarkRunner::parse_args(int argc, char **argv, BenchmarkOptions defaults) {
+        BenchmarkOptions options = std::move(defaults);
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            size_t eq = arg.find('=');
+            string key = arg.substr(0, eq), value = eq == string::npos ? "" : arg.substr(eq + 1);
+            if (key == "--warmup")
+                options.warmup = std::stoul(value);
+            else if (key == "--reps")
+                options.repetitions = std::stoul(value);
+            else if (key == "--min-time")
+                options.min_sample_time = std::stod(value);
+            else if (key == "--filter")
+                options.filter = value;
+            else if (key == "--csv")
+                options.csv_path = value;
+            else if (key == "--json")
+                options.json_path = value;
+            else if (key == "--baseline")
+                options.baseline_path = value;
+            else if (key == "--update-baseline")
+                options.update_baseline = true;
+            else if (key == "--threshold")
+                options.threshold = std::stod(value);
+            else if (key == "--alpha")
+                options.alpha = std::stod(value);
+            else if (key == "--perf")
+                options.perf_counters = true;
+            else if (key.size() > 2 && options.parameters.count(key.substr(2)) > 0)
+                options.parameters[key.substr(2)] = value;
+            else {
+                string expected = "--warmup=N --reps=N --min-time=SECONDS --filter=S --csv=PATH --json=PATH "
+                                  "--baseline=PATH --update-baseline --threshold=X --alpha=X --perf";
+                for (const auto& parameter: options.parameters)
+                    expected += " --" + parameter.first + "=" + parameter.second;
+                throw std::invalid_argument("Unknown argument '" + arg + "', expected " + expected + ".");
+            }
+        }
+        return options;
+    }
+
+    size_t BenchmarkRunner::parameter(const string& name) const {
+        auto it = options.parameters.find(name);
+        if (it == options.parameters.end())
+            throw std::out_of_range("No benchmark parameter named '" + name + "'.");
+        return std::stoul(it->second);
+    }
+
+    void compute_statistics(BenchmarkResult& result) {
+        vector<double> sorted(result.samples);
+        std::sort(sorted.begin(), sorted.end());
+        size_t n = sorted.size();
+        result.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+        result.p95 = sorted[std::min(n - 1, size_t(0.95 * (n - 1) + 0.5))];
+        result.mean = std::accumulate(sorted.begin(), sorted.end(), 0.) / n;
+        result.min = sorted.front();
+    }
+
+    void BenchmarkRunner::run(const string& name, const std::function<void()>& function, double flops, double bytes) {
+        if (name.find(options.filter) == string::npos)
+            return;
+        // The warmup also finds the number of calls that fill a sample.
+        size_t iterations = 1;
+        for (size_t i = 0; i < options.warmup || i == 0; ++i) {
+            while (true) {
+                auto start = clock_type::now();
+                for (size_t k = 0; k < iterations; ++k)
+                    function();
+                double elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+                if (elapsed >= options.min_sample_time || iterations >= (size_t(1) << 30))
+                    break;
+                iterations = std::max(iterations * 2, size_t(options.min_sample_time / std::max(elapsed, 1e-9) *
+                                                              iterations * 1.1));
+            }
+        }
+        BenchmarkResult result{name, iterations, {}, 0, 0, 0, 0, flops, bytes, 0, 0};
+        for (size_t r = 0; r < options.repetitions; ++r) {
+            auto start = clock_type::now();
+            for (size_t k = 0; k < iterations; ++k)
+                function();
+            result.samples.push_back(std::chrono::duration<double>(clock_type::now() - start).count() / iterations);
+        }
+        compute_statistics(result);
+        AllocationStats before = allocation_stats();
+        function();
+        AllocationStats after = allocation_stats();
+        result.allocations = double(after.count - before.count);
+        result.allocated_bytes = double(after.bytes - before.bytes);
+        // Counted in a run of its own, so reading the counters doesn't disturb the samples.
+        if (perf_counters) {
+            perf_counters->start();
+            for (size_t k = 0; k < iterations; ++k)
+                function();
+            result.counters = perf_counters->stop() / double(iterations);
+        }
+        cout << left << setw(44) << name << right << fixed << setprecision(2) << setw(12) << result.median * 1e6
+             << setw(12) << result.p95 * 1e6 << setw(10) << result.gflops() << setw(10) << result.gbps()
+             << defaultfloat << setw(10) << size_t(result.allocations);
+        if (perf_counters)
+            cout << fixed << setprecision(2) << setw(8) << result.counters.ipc() << setprecision(1)
+                 << setw(9) << result.counters.cache_miss_rate() * 100 << "%"
+                 << setw(9) << result.counters.branch_miss_rate() * 100 << "%" << defaultfloat;
+        cout << endl;
+        benchmark_results.push_back(std::move(result));
+    }
+
+    void BenchmarkRunner::write_csv(ostream& os) const {
+        os << "name,iterations,repetitions,median_s,p95_s,mean_s,min_s,flops,bytes,gflops,gbps,"
+              "allocations,allocated_bytes";
+        // The counts of a call, -1 if not counted.
+        for (size_t i = 0; i < num_perf_events; ++i)
+            os << "," << perf_event_name(PerfEvent(i));
+        os << ",ipc" << endl;
+        os << setprecision(9);
+        for (const auto& r: benchmark_results) {
+            os << r.name << "," << r.iterations << "," << r.samples.size() << "," << r.median << "," << r.p95 << ","
+               << r.mean << "," << r.min << "," << r.flops << "," << r.bytes << "," << r.gflops() << ","
+               << r.gbps() << "," << r.allocations << "," << r.allocated_bytes;
+            for (double count: r.counters.counts)
+                os << "," << count;
+            os << "," << r.counters.ipc() << endl;
+        }
+    }
+
+    static string json_escape(const string& s) {
+        string out;
+        for (char c: s) {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            out += c;
+        }
+        return out;
+    }
+
+    void BenchmarkRunner::write_json(ostream& os) const {
+        os << setprecision(9);
+        os << "{\n  \"machine\": {\"threads\": " << std::thread::hardware_concurrency()
+           << ", \"compiler\": \"" << json_escape(__VERSION__) << "\"},\n  \"benchmarks\": [";
+        for (size_t i = 0; i < benchmark_results.size(); ++i) {
+            const auto& r = benchmark_results[i];
+            os << (i ? "," : "") << "\n    {\"name\": \"" << json_escape(r.name) << "\", \"iterations\": "
+               << r.iterations << ", \"median\": " << r.median << ", \"p95\": " << r.p95 << ", \"mean\": " << r.mean
+               << ", \"min\": " << r.min << ", \"flops\": " << r.flops << ", \"bytes\": " << r.bytes
+               << ", \"allocations\": " << r.allocations << ", \"allocated_bytes\": " << r.allocated_bytes;
+            if (perf_counters) {
+                os << ", \"counters\": {";
+                for (size_t e = 0; e < num_perf_events; ++e)
+                    os << (e ? ", " : "") << "\"" << perf_event_name(PerfEvent(e)) << "\": " << r.counters.counts[e];
+                os << "}";
+            }
+            os << ", \"samples\": [";
+            for (size_t s = 0; s < r.samples.size(); ++s)
+                os << (s ? ", " : "") << r.samples[s];
+            os << "]}";
+        }
+        os << "\n  ]\n}" << endl;
+    }
+
+    int BenchmarkRunner::finish() const {
+        if (!options.csv_path.empty()) {
+            std::ofstream os(options.csv_path);
+            write_csv(os);
+            cout << "Wrote " << options.csv_path << endl;
+        }
+        if (!options.json_path.empty()) {
+            std::ofstream os(options.json_path);
+            write_json(os);
+            cout << "Wrote " << options.json_path << endl;
+        }
+        if (options.baseline_path.empty())
+            return 0;
+        if (options.update_baseline || !std::ifstream(options.baseline_path)) {
+            std::ofstream os(options.baseline_path);
+            write_json(os);
+            cout << "Recorded the baseline " << options.baseline_path << endl;
+            return 0;
+        }
+        cout << endl << "Compared to the baseline " << options.baseline_path << ":" << endl;
+        auto comparisons = compare_to_baseline(benchmark_results, read_baseline(options.baseline_path),
+                                               options.threshold, options.alpha);
+        return print_comparison(cout, comparisons) > 0 ? 1 : 0;
+    }
+}
@@ -0,0 +1,118 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_BENCHMARK_H
+#define TARGETPRACTICE_BENCHMARK_H
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "PerfCounters.h"
+
+using namespace std;
+
+namespace bench {
+
+    // Keeps the compiler from optimizing away a value that is computed only to be timed.
+    template<typename T>
+    inline void do_not_optimize(const T& value) {
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+
+    struct BenchmarkOptions {
+        // Untimed runs before the samples.
+        size_t warmup = 2;
+        // The number of timed samples.
+        size_t repetitions = 15;
+        // A sample repeats the benchmark until it takes at least this long (seconds), and reports
+        // the time per call - so fast kernels aren't dominated by the clock resolution.
+        double min_sample_time = 1e-3;
+        // Only the benchmarks whose name contains the filter are run.
+        string filter;
+        // Written by 'finish' if not empty.
+        string csv_path;
+        string json_path;
+        // If not empty, 'finish' compares the results to this baseline (see Baseline.h), and fails on a
+        // regression. A missing baseline is recorded instead, as is any baseline if update_baseline.
+        string baseline_path;
+        bool update_baseline = false;
+        // A regression is a significant (p-value < alpha) slowdown of the median by more than threshold.
+        double threshold = 0.1;
+        double alpha = 0.01;
+        // The sizes of the benchmarks of an executable, by name. Each can be set by --<name>=VALUE.
+        std::map<string, string> parameters;
+        // Count hardware events (see PerfCounters.h) in an extra run of every benchmark.
+        bool perf_counters = false;
+    };
+
+    struct BenchmarkResult {
+        string name;
+        // The number of calls per sample.
+        size_t iterations;
+        // Seconds per call, one per sample.
+        vector<double> samples;
+        double median, p95, mean, min;
+        // The work of a single call, 0 if unknown.
+        double flops, bytes;
+        // Heap allocations of a single call (see AllocationCounter.h).
+        double allocations, allocated_bytes;
+        // Hardware events of a single call, if options.perf_counters and the machine counts them.
+        PerfCounts counters;
+
+        inline double gflops() const { return median > 0 ? flops / median * 1e-9 : 0; }
+
+        inline double gbps() const { return median > 0 ? bytes / median * 1e-9 : 0; }
+    };
+
+    /**
+     * A minimal benchmark harness: every benchmark is warmed up, then timed repetitions times,
+     * and reported by its median and 95th percentile, with GFLOP/s and GB/s when the work of a
+     * call is given, and the number of heap allocations of a call. With perf_counters, the IPC and
+     * the cache / branch miss rates of a call are reported too. The results are printed as a table,
+     * and optionally written as CSV / JSON.
+     */
+    class BenchmarkRunner {
+    public:
+        explicit BenchmarkRunner(BenchmarkOptions options = {});
+
+        /**
+         * Parses --warmup=N --reps=N --min-time=SECONDS --filter=S --csv=PATH --json=PATH --baseline=PATH
+         * --update-baseline --threshold=X --alpha=X --perf, and --<name>=VALUE for the parameters in defaults.
+         * Throws invalid_argument on an unknown argument.
+         */
+        static BenchmarkOptions parse_args(int argc, char **argv, BenchmarkOptions defaults = {});
+
+        // Runs the benchmark (unless it's filtered out). flops and bytes are the work of one call.
+        void run(const string& name, const std::function<void()>& function, double flops = 0, double bytes = 0);
+
+        inline const vector<BenchmarkResult>& results() const { return benchmark_results; }
+
+        void write_csv(ostream& os) const;
+
+        void write_json(ostream& os) const;
+
+        // Writes the CSV / JSON files of the options, and compares to the baseline.
+        // Returns the exit code of the benchmark executable: 1 if there are regressions.
+        int finish() const;
+
+        inline const BenchmarkOptions& get_options() const { return options; }
+
+        // A numeric parameter of the options.
+        size_t parameter(const string& name) const;
+
+    private:
+        BenchmarkOptions options;
+        vector<BenchmarkResult> benchmark_results;
+        // Opened if options.perf_counters, null if the machine doesn't count any event.
+        std::unique_ptr<PerfCounters> perf_counters;
+    };
+
+    // The median, mean, min and 95th percentile of the samples of result.
+    void compute_statistics(BenchmarkResult& result);
+}
+
+#endif //TARGETPRACTICE_BENCHMARK_H
@@ -0,0 +1,136 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "PerfCounters.h"
+#include <cstring>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstdint>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+    const char *perf_event_name(PerfEvent event) {
+        switch (event) {
+            case PerfEvent::Cycles: return "cycles";
+            case PerfEvent::Instructions: return "instructions";
+            case PerfEvent::CacheReferences: return "cache_references";
+            case PerfEvent::CacheMisses: return "cache_misses";
+            case PerfEvent::Branches: return "branches";
+            case PerfEvent::BranchMisses: return "branch_misses";
+        }
+        return "unknown";
+    }
+
+    static double ratio(double numerator, double denominator) {
+        return numerator >= 0 && denominator > 0 ? numerator / denominator : 0;
+    }
+
+    double PerfCounts::ipc() const {
+        return ratio((*this)[PerfEvent::Instructions], (*this)[PerfEvent::Cycles]);
+    }
+
+    double PerfCounts::cache_miss_rate() const {
+        return ratio((*this)[PerfEvent::CacheMisses], (*this)[PerfEvent::CacheReferences]);
+    }
+
+    double PerfCounts::branch_miss_rate() const {
+        return ratio((*this)[PerfEvent::BranchMisses], (*this)[PerfEvent::Branches]);
+    }
+
+    PerfCounts PerfCounts::operator/(double divisor) const {
+        PerfCounts result;
+        for (size_t i = 0; i < num_perf_events; ++i)
+            result.counts[i] = counts[i] < 0 ? counts[i] : counts[i] / divisor;
+        return result;
+    }
+
+#ifdef __linux__
+
+    static uint64_t perf_config(PerfEvent event) {
+        switch (event) {
+            case PerfEvent::Cycles: return PERF_COUNT_HW_CPU_CYCLES;
+            case PerfEvent::Instructions: return PERF_COUNT_HW_INSTRUCTIONS;
+            case PerfEvent::CacheReferences: return PERF_COUNT_HW_CACHE_REFERENCES;
+            case PerfEvent::CacheMisses: return PERF_COUNT_HW_CACHE_MISSES;
+            case PerfEvent::Branches: return PERF_COUNT_HW_BRANCH_INSTRUCTIONS;
+            case PerfEvent::BranchMisses: return PERF_COUNT_HW_BRANCH_MISSES;
+        }
+        return 0;
+    }
+
+    PerfCounters::PerfCounters() {
+        for (size_t i = 0; i < num_perf_events; ++i) {
+            auto event = PerfEvent(i);
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = perf_config(event);
+            attr.disabled = fds.empty();
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int group_fd = fds.empty() ? -1 : fds[0];
+            int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+            if (fd < 0) {
+                if (error_message.empty())
+                    error_message = std::string("perf_event_open(") + perf_event_name(event) + "): " + std::strerror(errno);
+                continue;
+            }
+            fds.push_back(fd);
+            events.push_back(event);
+        }
+        if (!fds.empty())
+            error_message.clear();
+    }
+
+    PerfCounters::~PerfCounters() {
+        for (int fd: fds)
+            close(fd);
+    }
+
+    void PerfCounters::start() {
+        if (fds.empty())
+            return;
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    PerfCounts PerfCounters::stop() {
+        PerfCounts result;
+        if (fds.empty())
+            return result;
+        ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        // {nr, time_enabled, time_running, values[nr]}
+        std::vector<uint64_t> buffer(3 + fds.size());
+        ssize_t expected = ssize_t(buffer.size() * sizeof(uint64_t));
+        if (read(fds[0], buffer.data(), expected) != expected || buffer[2] == 0)
+            return result;
+        // The group was only scheduled for a part of the time - extrapolate.
+        double scale = double(buffer[1]) / double(buffer[2]);
+        for (size_t i = 0; i < events.size(); ++i)
+            result.counts[size_t(events[i])] = double(buffer[3 + i]) * scale;
+        return result;
+    }
+
+#else
+
+    PerfCounters::PerfCounters() : error_message("perf_event_open is only available on Linux") {}
+
+    PerfCounters::~PerfCounters() = default;
+
+    void PerfCounters::start() {}
+
+    PerfCounts PerfCounters::stop() {
+        return {};
+    }
+
+#endif
+}
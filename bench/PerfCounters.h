@@ -0,0 +1,75 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_PERFCOUNTERS_H
+#define TARGETPRACTICE_PERFCOUNTERS_H
+
+#include <string>
+#include <vector>
+
+namespace bench {
+
+    // Hardware events counted by PerfCounters.
+    enum class PerfEvent { Cycles, Instructions, CacheReferences, CacheMisses, Branches, BranchMisses };
+
+    constexpr size_t num_perf_events = 6;
+
+    const char *perf_event_name(PerfEvent event);
+
+    // The counts of a measured region, per event. An event the machine doesn't count is negative.
+    struct PerfCounts {
+        double counts[num_perf_events] = {-1, -1, -1, -1, -1, -1};
+
+        inline double operator[](PerfEvent event) const { return counts[size_t(event)]; }
+
+        inline bool has(PerfEvent event) const { return (*this)[event] >= 0; }
+
+        // Instructions per cycle, 0 if not counted.
+        double ipc() const;
+
+        // Cache misses per cache reference (last level cache), 0 if not counted.
+        double cache_miss_rate() const;
+
+        // Mispredicted branches per branch, 0 if not counted.
+        double branch_miss_rate() const;
+
+        // Divides every count, e.g. by the number of calls in the region.
+        PerfCounts operator/(double divisor) const;
+    };
+
+    /**
+     * Hardware performance counters of the calling thread, read with Linux perf_event_open.
+     * The events are opened as one group, so they are counted over the same intervals, and scaled
+     * up if the kernel multiplexed them. Only user space is counted, so it works with the default
+     * perf_event_paranoid = 2. Events the machine doesn't support are skipped; when none can be
+     * opened (no permission, a VM without a PMU, not Linux) is_available() is false, the reason is
+     * in error(), and the counts are all negative.
+     */
+    class PerfCounters {
+    public:
+        PerfCounters();
+        ~PerfCounters();
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        inline bool is_available() const { return !fds.empty(); }
+
+        inline const std::string& error() const { return error_message; }
+
+        // Resets and starts the counters.
+        void start();
+
+        // Stops the counters and returns the counts since start().
+        PerfCounts stop();
+
+    private:
+        // The group leader is fds[0].
+        std::vector<int> fds;
+        std::vector<PerfEvent> events;
+        std::string error_message;
+    };
+}
+
+#endif //TARGETPRACTICE_PERFCOUNTERS_H
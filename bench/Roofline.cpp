@@ -0,0 +1,113 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Roofline.h"
+#include "Benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+
+namespace bench {
+
+    using clock_type = std::chrono::steady_clock;
+
+    // Runs probe (which returns the work it did) until min_time passes, returns the best work per second.
+    template<typename F>
+    static double best_rate(F&& probe, double min_time) {
+        double best = 0, total = 0;
+        while (total < min_time) {
+            auto start = clock_type::now();
+            double work = probe();
+            double elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+            total += elapsed;
+            best = std::max(best, work / elapsed);
+        }
+        return best;
+    }
+
+    static double probe_flops(double min_time) {
+        // Small enough for L1, wide enough for every vector lane and enough independent chains
+        // to hide the latency of the multiply-add.
+        constexpr size_t width = 64, repetitions = 1 << 14;
+        alignas(64) double x[width];
+        for (size_t i = 0; i < width; ++i)
+            x[i] = 1. + i * 1e-3;
+        const double multiplier = 0.999999, addend = 1e-6;
+        double flops = best_rate([&]() {
+            for (size_t r = 0; r < repetitions; ++r) {
+                for (size_t i = 0; i < width; ++i)
+                    x[i] = x[i] * multiplier + addend;
+                do_not_optimize(x);
+            }
+            return 2. * width * repetitions;
+        }, min_time);
+        do_not_optimize(x[0]);
+        return flops;
+    }
+
+    static double probe_bandwidth(size_t stream_bytes, double min_time) {
+        size_t n = std::max(stream_bytes / (3 * sizeof(double)), size_t(1));
+        std::unique_ptr<double[]> a(new double[n]), b(new double[n]), c(new double[n]);
+        for (size_t i = 0; i < n; ++i) {
+            a[i] = 0;
+            b[i] = 1;
+            c[i] = 2;
+        }
+        const double scalar = 3;
+        double bandwidth = best_rate([&]() {
+            for (size_t i = 0; i < n; ++i)
+                a[i] = b[i] + scalar * c[i];
+            do_not_optimize(a[n / 2]);
+            // Two loads and a store per element, as counted by STREAM.
+            return 3. * n * sizeof(double);
+        }, min_time);
+        return bandwidth;
+    }
+
+    MachinePeaks measure_peaks(size_t stream_bytes, double min_time) {
+        return {probe_flops(min_time), probe_bandwidth(stream_bytes, min_time)};
+    }
+
+    const char *bound_name(Bound bound) {
+        return bound == Bound::Memory ? "memory" : "compute";
+    }
+
+    RooflinePoint roofline(const RooflineKernel& kernel, const MachinePeaks& peaks) {
+        RooflinePoint point{kernel, 0, 0, 0, 0, Bound::Memory, 0};
+        point.intensity = kernel.bytes > 0 ? kernel.flops / kernel.bytes : 0;
+        if (kernel.seconds > 0) {
+            point.achieved_flops = kernel.flops / kernel.seconds;
+            point.achieved_bandwidth = kernel.bytes / kernel.seconds;
+        }
+        point.attainable_flops = std::min(peaks.flops, point.intensity * peaks.bandwidth);
+        // A kernel that moves no data (all in registers) can only be compute-bound.
+        point.bound = kernel.bytes > 0 && point.intensity < peaks.ridge() ? Bound::Memory : Bound::Compute;
+        point.fraction = point.bound == Bound::Memory ? point.achieved_bandwidth / peaks.bandwidth
+                                                      : point.achieved_flops / peaks.flops;
+        return point;
+    }
+
+    void print_roofline(ostream& os, const vector<RooflineKernel>& kernels, const MachinePeaks& peaks) {
+        os << fixed << setprecision(2) << "Peak " << peaks.flops * 1e-9 << " GFLOP/s, stream bandwidth "
+           << peaks.bandwidth * 1e-9 << " GB/s, ridge at " << peaks.ridge() << " FLOP/byte" << endl;
+        vector<RooflinePoint> points;
+        for (const auto& kernel: kernels)
+            points.push_back(roofline(kernel, peaks));
+        std::sort(points.begin(), points.end(), [](const RooflinePoint& p1, const RooflinePoint& p2) {
+            return p1.kernel.seconds * p1.kernel.calls > p2.kernel.seconds * p2.kernel.calls;
+        });
+        os << left << setw(52) << "kernel" << right << setw(10) << "calls" << setw(12) << "total ms"
+           << setw(10) << "FLOP/B" << setw(10) << "GFLOP/s" << setw(10) << "GB/s" << setw(10) << "bound"
+           << setw(10) << "% roof" << endl;
+        for (const auto& p: points) {
+            string name = p.kernel.name.size() > 50 ? p.kernel.name.substr(0, 47) + "..." : p.kernel.name;
+            os << left << setw(52) << name << right << setw(10) << p.kernel.calls
+               << setw(12) << p.kernel.seconds * p.kernel.calls * 1e3 << setw(10) << p.intensity
+               << setw(10) << p.achieved_flops * 1e-9 << setw(10) << p.achieved_bandwidth * 1e-9
+               << setw(10) << bound_name(p.bound) << setw(9) << p.fraction * 100 << "%" << endl;
+        }
+        os << defaultfloat;
+    }
+}
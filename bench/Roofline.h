@@ -0,0 +1,70 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_ROOFLINE_H
+#define TARGETPRACTICE_ROOFLINE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace bench {
+
+    // The roofs of a single thread, measured by the probes of measure_peaks.
+    struct MachinePeaks {
+        // FLOP/s of multiply-adds in registers / L1.
+        double flops;
+        // Bytes/s of a STREAM-like triad over buffers larger than the caches.
+        double bandwidth;
+
+        // The arithmetic intensity (FLOP/byte) above which a kernel can be compute-bound.
+        inline double ridge() const { return flops / bandwidth; }
+    };
+
+    /**
+     * Measures the peaks with small built-in probes: a multiply-add loop over an L1-resident array,
+     * and a triad a = b + s * c over stream_bytes of buffers. Each probe is repeated for min_time
+     * seconds and the best run is kept. The probes are compiled with the flags of the library, so
+     * the roofs are those the kernels could reach as compiled.
+     */
+    MachinePeaks measure_peaks(size_t stream_bytes = size_t(96) << 20, double min_time = 0.2);
+
+    enum class Bound { Memory, Compute };
+
+    const char *bound_name(Bound bound);
+
+    // A kernel measured over some calls: the average work and time of a call.
+    struct RooflineKernel {
+        string name;
+        size_t calls;
+        double flops, bytes, seconds;
+    };
+
+    struct RooflinePoint {
+        RooflineKernel kernel;
+        // FLOP/byte, 0 for kernels that only move data.
+        double intensity;
+        // The achieved FLOP/s and bytes/s.
+        double achieved_flops, achieved_bandwidth;
+        // The roofline at the intensity of the kernel: min(peak FLOP/s, intensity * bandwidth).
+        double attainable_flops;
+        Bound bound;
+        // The achieved performance over the roofline: FLOP/s over the peak for compute-bound
+        // kernels, bytes/s over the bandwidth for memory-bound kernels.
+        double fraction;
+    };
+
+    RooflinePoint roofline(const RooflineKernel& kernel, const MachinePeaks& peaks);
+
+    /**
+     * Prints the peaks, and the roofline of every kernel by total time, so that the kernels
+     * with the most time to gain come first. The data of a kernel that fits in the caches can
+     * move faster than the stream bandwidth, over 100% of the memory roof.
+     */
+    void print_roofline(ostream& os, const vector<RooflineKernel>& kernels, const MachinePeaks& peaks);
+}
+
+#endif //TARGETPRACTICE_ROOFLINE_H
@@ -0,0 +1,110 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Benchmark.h"
+#include "../autograd/autograd.h"
+using namespace autograd;
+using namespace blas;
+using namespace bench;
+
+struct TrainingGraph {
+    Variable<double> loss;
+    vector<Variable<double>> params;
+};
+
+// An MLP regression (as in test_multi_layer_perceptron): batch x 1 -> depth hidden layers of width -> 1.
+TrainingGraph build_mlp(size_t batch, size_t width, size_t depth) {
+    auto x = linspace<double>(-1, 1, batch).reshape({long(batch), 1});
+    auto input = InputBuffer<double>::make("x", x);
+    auto y_true = InputBuffer<double>::make("y_true", x * x);
+    vector<Variable<double>> params;
+    Variable<double> h = input;
+    size_t in_features = 1;
+    for (size_t i = 0; i <= depth; ++i) {
+        size_t out_features = i == depth ? 1 : width;
+        auto w = Parameter<double>::make("w" + std::to_string(i), uniform(-1., 1., {in_features, out_features}));
+        auto b = Parameter<double>::make("b" + std::to_string(i), ones<double>({out_features}));
+        params.push_back(w);
+        params.push_back(b);
+        h = matmul(h, w) + b;
+        if (i < depth)
+            h = relu(h);
+        in_features = out_features;
+    }
+    MSELoss<double> criterion(h.shape());
+    return {criterion(h, y_true), params};
+}
+
+// A deep chain of element-wise ops over vectors of size elements, sharing two parameters.
+TrainingGraph build_chain(size_t size, size_t depth) {
+    auto input = InputBuffer<double>::make("x", uniform(-1., 1., {size}));
+    auto a = Parameter<double>::make("a", uniform(-1., 1., {size})),
+         b = Parameter<double>::make("b", uniform(-1., 1., {size}));
+    Variable<double> h = input;
+    for (size_t i = 0; i < depth; ++i)
+        h = tanh(h * a + b);
+    return {sum(h), {a, b}};
+}
+
+// A wide graph: the input fans out to branches independent branches, that fan back in by a tree of sums.
+TrainingGraph build_fan(size_t size, size_t branches) {
+    auto input = InputBuffer<double>::make("x", uniform(-1., 1., {size}));
+    vector<Variable<double>> params, level;
+    for (size_t i = 0; i < branches; ++i) {
+        auto w = Parameter<double>::make("w" + std::to_string(i), uniform(-1., 1., {size}));
+        params.push_back(w);
+        level.push_back(sigmoid(input * w));
+    }
+    while (level.size() > 1) {
+        vector<Variable<double>> next;
+        for (size_t i = 0; i + 1 < level.size(); i += 2)
+            next.push_back(level[i] + level[i + 1]);
+        if (level.size() % 2 == 1)
+            next.push_back(level.back());
+        level = std::move(next);
+    }
+    return {sum(level.front()), params};
+}
+
+/**
+ * Times every phase of a training step of a graph separately: building the graph, forward_recursive,
+ * zero_grad, backward and the parameter update, and then the whole step.
+ */
+void bench_training(BenchmarkRunner& runner, const string& name, const std::function<TrainingGraph()>& build) {
+    runner.run(name + "/build", [&]() { do_not_optimize(build()); });
+    TrainingGraph graph = build();
+    const Variable<double>& loss = graph.loss;
+    runner.run(name + "/forward", [&]() { loss->forward_recursive(); });
+    loss->forward_recursive();
+    runner.run(name + "/zero_grad", [&]() { loss->zero_grad(true); });
+    runner.run(name + "/backward", [&]() { loss->backward(); });
+    // The gradients accumulated by the backward benchmark are reset, so the updates stay small.
+    loss->zero_grad(true);
+    loss->backward();
+    const double alpha = 1e-6;
+    auto update = [&]() {
+        for (const auto& p: graph.params)
+            p.data() -= alpha * p.grad();
+    };
+    runner.run(name + "/update", update);
+    runner.run(name + "/step", [&]() {
+        loss->forward_recursive();
+        loss->zero_grad(true);
+        loss->backward();
+        update();
+    });
+}
+
+int main(int argc, char **argv) {
+    BenchmarkOptions defaults;
+    defaults.parameters = {{"batch", "256"}, {"width", "64"}, {"depth", "4"},
+                           {"size", "4096"}, {"chain", "64"}, {"branches", "32"}};
+    BenchmarkRunner runner(BenchmarkRunner::parse_args(argc, argv, defaults));
+    size_t batch = runner.parameter("batch"), width = runner.parameter("width"), depth = runner.parameter("depth"),
+           size = runner.parameter("size"), chain = runner.parameter("chain"), branches = runner.parameter("branches");
+    bench_training(runner, "mlp", [&]() { return build_mlp(batch, width, depth); });
+    bench_training(runner, "chain", [&]() { return build_chain(size, chain); });
+    bench_training(runner, "fan", [&]() { return build_fan(size, branches); });
+    return runner.finish();
+}
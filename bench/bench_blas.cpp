@@ -0,0 +1,114 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Benchmark.h"
+#include "../blas/blas.h"
+using namespace blas;
+using namespace bench;
+
+template<typename T>
+void bench_matmul(BenchmarkRunner& runner, const string& type_name, size_t m, size_t k, size_t n) {
+    auto a = uniform<T>(-1, 1, {m, k}), b = uniform<T>(-1, 1, {k, n});
+    Tensor<T> out({m, n});
+    string name = "matmul<" + type_name + "> " + std::to_string(m) + "x" + std::to_string(k) + "x" + std::to_string(n);
+    runner.run(name, [&]() { do_not_optimize(matmul(a, b, out)); },
+               2. * m * k * n, double(m * k + k * n + m * n) * sizeof(T));
+}
+
+void bench_bmm(BenchmarkRunner& runner, size_t batch, size_t n) {
+    auto a = uniform<double>(-1, 1, {batch, n, n}), b = uniform<double>(-1, 1, {batch, n, n});
+    Tensor<double> out({batch, n, n});
+    runner.run("bmm<double> " + std::to_string(batch) + "x" + std::to_string(n) + "^3",
+               [&]() { do_not_optimize(bmm(a, b, out)); },
+               2. * batch * n * n * n, 3. * batch * n * n * sizeof(double));
+}
+
+// Element-wise ops over every kind of tensor of n x n elements (the sliced and transposed
+// tensors are taken from 2n x n and n x n tensors).
+void bench_elemwise(BenchmarkRunner& runner, size_t n) {
+    const double elems = double(n) * n, bytes_in = elems * sizeof(double);
+    auto a = uniform<double>(-1, 1, {n, n}), b = uniform<double>(-1, 1, {n, n});
+    auto tall = uniform<double>(-1, 1, {2 * n, n});
+    Tensor<double> out({n, n});
+    string suffix = " " + std::to_string(n) + "x" + std::to_string(n);
+
+    runner.run("add Tensor" + suffix, [&]() { do_not_optimize(Tensor<double>(a + b)); }, elems, 3 * bytes_in);
+    runner.run("add_ Tensor" + suffix, [&]() { do_not_optimize(out += a); }, elems, 3 * bytes_in);
+    runner.run("mul scalar Tensor" + suffix, [&]() { do_not_optimize(Tensor<double>(a * 2.)); }, elems, 2 * bytes_in);
+    runner.run("exp Tensor" + suffix, [&]() { exp(a, out); }, elems, 2 * bytes_in);
+    runner.run("sigmoid Tensor" + suffix, [&]() { do_not_optimize(sigmoid(a)); }, elems, 2 * bytes_in);
+
+    // Fused into a single loop by the expression templates, and evaluated into the buffer of out.
+    auto c = uniform<double>(-1, 1, {n, n}), d = uniform<double>(-1, 1, {n, n}), e = uniform<double>(-1, 1, {n, n});
+    runner.run("a * b + c * d - e Tensor" + suffix, [&]() { do_not_optimize(out = a * b + c * d - e); },
+               4 * elems, 6 * bytes_in);
+
+    auto view_a = a.const_view({long(n * n)}), view_b = b.const_view({long(n * n)});
+    runner.run("add TensorView" + suffix, [&]() { do_not_optimize(Tensor<double>(view_a + view_b)); },
+               elems, 3 * bytes_in);
+
+    auto sliced_a = tall(Slice(0, 2 * n, 2)), sliced_b = tall(Slice(1, 2 * n, 2));
+    runner.run("add TensorSliced" + suffix, [&]() { do_not_optimize(Tensor<double>(sliced_a + sliced_b)); },
+               elems, 3 * bytes_in);
+    runner.run("exp TensorSliced" + suffix, [&]() { do_not_optimize(exp(sliced_a)); }, elems, 2 * bytes_in);
+
+    auto transposed_a = a.transpose();
+    runner.run("exp TensorTransposed" + suffix, [&]() { do_not_optimize(transposed_a.exp()); }, elems, 2 * bytes_in);
+}
+
+void bench_broadcast(BenchmarkRunner& runner, size_t n) {
+    const double elems = double(n) * n, bytes = 2 * elems * sizeof(double);
+    auto a = uniform<double>(-1, 1, {n, n}), row = uniform<double>(-1, 1, {n});
+    auto column = uniform<double>(-1, 1, {n, 1}), row2d = uniform<double>(-1, 1, {1, n});
+    string suffix = " " + std::to_string(n) + "x" + std::to_string(n);
+    runner.run("broadcast add (n,n)+(n)" + suffix, [&]() { do_not_optimize(Tensor<double>(a + row)); }, elems, bytes);
+    runner.run("broadcast add (n,1)+(1,n)" + suffix, [&]() { do_not_optimize(Tensor<double>(column + row2d)); }, elems,
+               elems * sizeof(double));
+}
+
+void bench_reduce(BenchmarkRunner& runner, size_t n) {
+    const double elems = double(n) * n, bytes = elems * sizeof(double);
+    auto a = uniform<double>(-1, 1, {n, n});
+    string suffix = " " + std::to_string(n) + "x" + std::to_string(n);
+    runner.run("sum all" + suffix, [&]() { do_not_optimize(a.sum()); }, elems, bytes);
+    runner.run("sum dim 0" + suffix, [&]() { do_not_optimize(a.sum(0)); }, elems, bytes);
+    runner.run("sum dim 1" + suffix, [&]() { do_not_optimize(a.sum(1)); }, elems, bytes);
+}
+
+void bench_copy(BenchmarkRunner& runner, size_t n) {
+    const double bytes = 2. * n * n * sizeof(double);
+    auto a = uniform<double>(-1, 1, {n, n});
+    auto tall = uniform<double>(-1, 1, {2 * n, n});
+    auto sliced = tall(Slice(0, 2 * n, 2));
+    auto transposed = a.transpose();
+    string suffix = " " + std::to_string(n) + "x" + std::to_string(n);
+    runner.run("copy Tensor" + suffix, [&]() { do_not_optimize(Tensor<double>(a)); }, 0, bytes);
+    runner.run("contiguous TensorSliced" + suffix, [&]() { do_not_optimize(sliced.contiguous()); }, 0, bytes);
+    runner.run("contiguous TensorTransposed" + suffix, [&]() { do_not_optimize(transposed.contiguous()); }, 0, bytes);
+}
+
+void bench_random(BenchmarkRunner& runner, size_t n) {
+    const double bytes = double(n) * sizeof(double);
+    runner.run("uniform " + std::to_string(n), [&]() { do_not_optimize(uniform<double>(-1, 1, {n})); }, 0, bytes);
+    runner.run("randn " + std::to_string(n), [&]() { do_not_optimize(randn<double>({n})); }, 0, bytes);
+}
+
+int main(int argc, char **argv) {
+    BenchmarkRunner runner(BenchmarkRunner::parse_args(argc, argv));
+    for (size_t n: {16, 64, 128, 256})
+        bench_matmul<double>(runner, "double", n, n, n);
+    bench_matmul<float>(runner, "float", 256, 256, 256);
+    // GEMV-like, tall-skinny and inner-product-heavy shapes.
+    bench_matmul<double>(runner, "double", 1, 512, 512);
+    bench_matmul<double>(runner, "double", 1024, 64, 64);
+    bench_matmul<double>(runner, "double", 64, 1024, 64);
+    bench_bmm(runner, 32, 32);
+    bench_bmm(runner, 8, 128);
+    bench_elemwise(runner, 512);
+    bench_broadcast(runner, 512);
+    bench_reduce(runner, 512);
+    bench_copy(runner, 512);
+    bench_random(runner, 1 << 18);
+    return runner.finish();
+}
@@ -0,0 +1,79 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Benchmark.h"
+#include "Roofline.h"
+#include "../blas/blas.h"
+using namespace blas;
+using namespace bench;
+
+/*
+ * Places the blas kernels on the roofline of this machine (see Roofline.h), to tell which of the
+ * element-wise / broadcast / reduce paths are worth optimizing next.
+ * Built with -DINSTRUMENTATION=ON, every blas kernel called by the workloads is reported with the
+ * FLOP and byte counts of the instrumentation. Otherwise the workloads themselves are reported, with
+ * the work given below.
+ */
+
+void run_workloads(BenchmarkRunner& runner, size_t n) {
+    const double elems = double(n) * n, bytes = elems * sizeof(double);
+    auto a = uniform<double>(-1, 1, {n, n}), b = uniform<double>(-1, 1, {n, n});
+    auto row = uniform<double>(-1, 1, {n}), column = uniform<double>(-1, 1, {n, 1});
+    auto tall = uniform<double>(-1, 1, {2 * n, n});
+    auto sliced = tall(Slice(0, 2 * n, 2));
+    auto transposed = a.transpose();
+    Tensor<double> out({n, n});
+    size_t m = 256;
+    auto x = uniform<double>(-1, 1, {m, m}), y = uniform<double>(-1, 1, {m, m});
+    Tensor<double> xy({m, m});
+    string suffix = " " + std::to_string(n) + "x" + std::to_string(n);
+    // Only the kernels of the workloads, not of their inputs.
+    blas::instrumentation::reset();
+
+    runner.run("add" + suffix, [&]() { do_not_optimize(Tensor<double>(a + b)); }, elems, 3 * bytes);
+    runner.run("add_" + suffix, [&]() { do_not_optimize(out += a); }, elems, 3 * bytes);
+    runner.run("mul scalar" + suffix, [&]() { do_not_optimize(Tensor<double>(a * 2.)); }, elems, 2 * bytes);
+    runner.run("exp" + suffix, [&]() { exp(a, out); }, elems, 2 * bytes);
+    runner.run("add sliced" + suffix, [&]() { do_not_optimize(Tensor<double>(sliced + b)); }, elems, 3 * bytes);
+    runner.run("broadcast add (n,n)+(n)" + suffix, [&]() { do_not_optimize(Tensor<double>(a + row)); },
+               elems, 2 * bytes);
+    runner.run("broadcast add (n,n)+(n,1)" + suffix, [&]() { do_not_optimize(Tensor<double>(a + column)); },
+               elems, 2 * bytes);
+    runner.run("sum all" + suffix, [&]() { do_not_optimize(a.sum()); }, elems, bytes);
+    runner.run("sum dim 0" + suffix, [&]() { do_not_optimize(a.sum(0)); }, elems, bytes);
+    runner.run("sum dim 1" + suffix, [&]() { do_not_optimize(a.sum(1)); }, elems, bytes);
+    runner.run("copy" + suffix, [&]() { do_not_optimize(Tensor<double>(a)); }, 0, 2 * bytes);
+    runner.run("contiguous transposed" + suffix, [&]() { do_not_optimize(transposed.contiguous()); }, 0, 2 * bytes);
+
+    runner.run("matmul " + std::to_string(m) + "^3", [&]() { do_not_optimize(matmul(x, y, xy)); },
+               2. * m * m * m, 3. * m * m * sizeof(double));
+}
+
+int main(int argc, char **argv) {
+    BenchmarkOptions defaults;
+    defaults.repetitions = 5;
+    defaults.parameters = {{"size", "512"}, {"stream-mb", "96"}};
+    BenchmarkOptions options = BenchmarkRunner::parse_args(argc, argv, defaults);
+    size_t stream_bytes = std::stoul(options.parameters["stream-mb"]) << 20;
+
+    BenchmarkRunner runner(options);
+    namespace instr = blas::instrumentation;
+    run_workloads(runner, runner.parameter("size"));
+
+    vector<RooflineKernel> kernels;
+    if (instr::is_enabled()) {
+        for (const auto& s: instr::snapshot())
+            if (s.layer == instr::Layer::Blas && s.calls > 0)
+                kernels.push_back({s.op + " " + s.shape, s.calls, s.flops / s.calls, s.bytes / s.calls,
+                                   s.seconds / s.calls});
+    } else {
+        cout << endl << "Compiled without instrumentation (-DINSTRUMENTATION=ON reports every blas kernel), "
+             << "reporting the workloads." << endl;
+        for (const auto& r: runner.results())
+            kernels.push_back({r.name, r.iterations * r.samples.size(), r.flops, r.bytes, r.median});
+    }
+    cout << endl;
+    print_roofline(cout, kernels, measure_peaks(stream_bytes));
+    return runner.finish();
+}
@@ -0,0 +1,97 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Instrumentation.h"
+#include "../utils/Tracer.h"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+namespace blas::instrumentation {
+
+    namespace {
+        std::mutex registry_mutex;
+        std::map<std::tuple<Layer, string, string>, KernelStats> registry;
+        // The number of open kernels of every layer on this thread.
+        thread_local int depth[2] = {0, 0};
+    }
+
+    bool is_enabled() {
+#ifdef BLAS_INSTRUMENTATION
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    ScopedKernel::ScopedKernel(Layer layer) :
+            layer(layer), active(depth[int(layer)]++ == 0),
+            traced(active && layer == Layer::Blas && Tracer::is_tracing()) {
+        if (active)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ScopedKernel::~ScopedKernel() {
+        depth[int(layer)]--;
+        if (!active)
+            return;
+        auto end = std::chrono::steady_clock::now();
+        if (traced)
+            Tracer::global().record(op, "blas", start, end, {{"shape", shape}});
+        double seconds = std::chrono::duration<double>(end - start).count();
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        auto key = std::make_tuple(layer, std::move(op), std::move(shape));
+        auto it = registry.find(key);
+        if (it == registry.end())
+            it = registry.emplace(key, KernelStats{layer, std::get<1>(key), std::get<2>(key), 0, 0, 0, 0}).first;
+        KernelStats& stats = it->second;
+        stats.calls++;
+        stats.seconds += seconds;
+        stats.flops += flops;
+        stats.bytes += bytes;
+    }
+
+    vector<KernelStats> snapshot() {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        vector<KernelStats> stats;
+        stats.reserve(registry.size());
+        for (const auto& entry: registry)
+            stats.push_back(entry.second);
+        return stats;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.clear();
+    }
+
+    void print(std::ostream& os, const vector<KernelStats>& stats) {
+        using std::setw;
+        vector<KernelStats> sorted(stats);
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const KernelStats& a, const KernelStats& b) { return a.seconds > b.seconds; });
+        double layer_seconds[2] = {0, 0};
+        os << std::left << setw(28) << "op" << setw(28) << "shape" << std::right << setw(10) << "calls"
+           << setw(12) << "total ms" << setw(12) << "avg us" << setw(10) << "GFLOP/s" << setw(10) << "GB/s"
+           << std::endl;
+        for (const auto& s: sorted) {
+            layer_seconds[int(s.layer)] += s.seconds;
+            os << std::left << setw(28) << s.op << setw(28) << s.shape << std::right << setw(10) << s.calls
+               << std::fixed << std::setprecision(3) << setw(12) << s.seconds * 1e3 << setw(12)
+               << s.seconds / s.calls * 1e6 << std::setprecision(2) << setw(10) << s.gflops() << setw(10)
+               << s.gbps() << std::defaultfloat << std::endl;
+        }
+        os << "Total blas: " << layer_seconds[int(Layer::Blas)] * 1e3 << " ms, autograd: "
+           << layer_seconds[int(Layer::Autograd)] * 1e3 << " ms" << std::endl;
+    }
+
+    string shapes2str(const vector<shape_t>& shapes) {
+        string ret;
+        for (size_t i = 0; i < shapes.size(); ++i)
+            ret += (i ? " x " : "") + shape2str(shapes[i]);
+        return ret;
+    }
+}
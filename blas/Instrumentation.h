@@ -0,0 +1,96 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_INSTRUMENTATION_H
+#define TARGETPRACTICE_INSTRUMENTATION_H
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "common_blas.h"
+
+/*
+ * Per-kernel instrumentation, compiled in only with BLAS_INSTRUMENTATION defined (cmake -DINSTRUMENTATION=ON).
+ * The blas kernels (matmul, bmm, apply_*, reduce, copy_, contiguous, uniform / randn) and the forward and
+ * backward of the autograd functors record their calls, wall time, estimated FLOPs and bytes moved,
+ * aggregated per op and shape. Without the macro BLAS_INSTRUMENT / AUTOGRAD_INSTRUMENT expand to nothing,
+ * their arguments aren't even evaluated, so there is no overhead at all.
+ * Only the outermost kernel of every layer is recorded: a copy_ inside bmm, or the apply_ of every slice of
+ * a broadcast, is a part of the time of the kernel that called it.
+ */
+namespace blas::instrumentation {
+
+    enum class Layer { Blas, Autograd };
+
+    struct KernelStats {
+        Layer layer;
+        string op;
+        string shape;
+        size_t calls;
+        double seconds, flops, bytes;
+
+        inline double gflops() const { return seconds > 0 ? flops / seconds * 1e-9 : 0; }
+
+        inline double gbps() const { return seconds > 0 ? bytes / seconds * 1e-9 : 0; }
+    };
+
+    // Whether the instrumentation was compiled in.
+    bool is_enabled();
+
+    // The stats of every recorded (op, shape) since the start of the program or the last reset.
+    vector<KernelStats> snapshot();
+
+    void reset();
+
+    // Prints the stats of a snapshot as a table by total time, and the total time of every layer.
+    void print(std::ostream& os, const vector<KernelStats>& stats);
+
+    inline void print(std::ostream& os) { print(os, snapshot()); }
+
+    /**
+     * Times the kernel of its scope, if it isn't nested in another kernel of the same layer.
+     * The op, shape and work are only computed (by set) for the active ones.
+     * The active blas kernels are also traced while the Tracer is on.
+     */
+    class ScopedKernel {
+    public:
+        explicit ScopedKernel(Layer layer);
+        ~ScopedKernel();
+
+        inline bool is_active() const { return active; }
+
+        inline void set(string op, string shape, double flops, double bytes) {
+            this->op = std::move(op);
+            this->shape = std::move(shape);
+            this->flops = flops;
+            this->bytes = bytes;
+        }
+
+    private:
+        Layer layer;
+        bool active, traced;
+        string op, shape;
+        double flops = 0, bytes = 0;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // "(2, 3) x (3, 4)" - a key of a kernel with several operands.
+    string shapes2str(const vector<shape_t>& shapes);
+}
+
+#ifdef BLAS_INSTRUMENTATION
+#define INSTRUMENT_LAYER(layer, op, shape, flops, bytes)                                   \
+    ::blas::instrumentation::ScopedKernel _scoped_kernel(layer);                           \
+    if (_scoped_kernel.is_active()) _scoped_kernel.set(op, shape, flops, bytes)
+#else
+#define INSTRUMENT_LAYER(layer, op, shape, flops, bytes) ((void) 0)
+#endif
+
+#define BLAS_INSTRUMENT(op, shape, flops, bytes) \
+    INSTRUMENT_LAYER(::blas::instrumentation::Layer::Blas, op, shape, flops, bytes)
+#define AUTOGRAD_INSTRUMENT(op, shape, flops, bytes) \
+    INSTRUMENT_LAYER(::blas::instrumentation::Layer::Autograd, op, shape, flops, bytes)
+
+#endif //TARGETPRACTICE_INSTRUMENTATION_H
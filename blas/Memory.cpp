@@ -0,0 +1,165 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Memory.h"
+#include <atomic>
+#include <cstddef>
+#include <iomanip>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+namespace blas::memory {
+
+    namespace {
+        constexpr size_t max_tags = 256;
+
+        struct Counters {
+            std::atomic<long> live_count{0};
+            std::atomic<long> live_bytes{0};
+            std::atomic<long> peak_bytes{0};
+            std::atomic<long> allocations{0};
+
+            void add(long bytes) {
+                live_count.fetch_add(1, std::memory_order_relaxed);
+                allocations.fetch_add(1, std::memory_order_relaxed);
+                long live = live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+                long peak = peak_bytes.load(std::memory_order_relaxed);
+                while (live > peak && !peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+            }
+
+            void remove(long bytes) {
+                live_count.fetch_sub(1, std::memory_order_relaxed);
+                live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+            }
+
+            MemoryUsage load() const {
+                return {live_count.load(std::memory_order_relaxed), live_bytes.load(std::memory_order_relaxed),
+                        peak_bytes.load(std::memory_order_relaxed), allocations.load(std::memory_order_relaxed)};
+            }
+        };
+
+        // Keeps the buffer after it aligned as new[] would.
+        struct alignas(alignof(std::max_align_t)) Header {
+            size_t bytes;
+            size_t tag;
+        };
+
+        Counters total;
+        Counters per_tag[max_tags];
+
+        std::mutex tags_mutex;
+        // Tag names by id, id 0 is untagged. Only appended to, under tags_mutex.
+        std::vector<string>& tag_names() {
+            static std::vector<string> names{untagged};
+            return names;
+        }
+
+        thread_local size_t current = 0;
+    }
+
+    size_t register_tag(const string& name) {
+        std::lock_guard<std::mutex> lock(tags_mutex);
+        auto& names = tag_names();
+        for (size_t id = 0; id < names.size(); ++id)
+            if (names[id] == name)
+                return id;
+        if (names.size() == max_tags)
+            throw std::length_error("Too many memory tags (" + std::to_string(max_tags) + ").");
+        names.push_back(name);
+        return names.size() - 1;
+    }
+
+    MemoryTag::MemoryTag(size_t id) : previous(current) {
+        current = id;
+    }
+
+    MemoryTag::~MemoryTag() {
+        current = previous;
+    }
+
+    string current_tag() {
+        std::lock_guard<std::mutex> lock(tags_mutex);
+        return tag_names()[current];
+    }
+
+    void *allocate(size_t bytes) {
+        auto header = static_cast<Header *>(::operator new(sizeof(Header) + bytes));
+        header->bytes = bytes;
+        header->tag = current;
+        total.add(bytes);
+        per_tag[current].add(bytes);
+        return header + 1;
+    }
+
+    void deallocate(void *ptr) {
+        if (ptr == nullptr)
+            return;
+        auto header = static_cast<Header *>(ptr) - 1;
+        total.remove(header->bytes);
+        per_tag[header->tag].remove(header->bytes);
+        ::operator delete(header);
+    }
+
+    MemorySnapshot snapshot() {
+        MemorySnapshot result;
+        result.total = total.load();
+        std::lock_guard<std::mutex> lock(tags_mutex);
+        const auto& names = tag_names();
+        for (size_t id = 0; id < names.size(); ++id) {
+            MemoryUsage tag_usage = per_tag[id].load();
+            if (tag_usage.allocations > 0)
+                result.by_tag[names[id]] = tag_usage;
+        }
+        return result;
+    }
+
+    MemoryUsage usage() {
+        return total.load();
+    }
+
+    MemoryUsage usage(const string& tag) {
+        return per_tag[register_tag(tag)].load();
+    }
+
+    void reset_peak() {
+        total.peak_bytes.store(total.live_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        for (auto& counters: per_tag)
+            counters.peak_bytes.store(counters.live_bytes.load(std::memory_order_relaxed),
+                                      std::memory_order_relaxed);
+    }
+
+    static MemoryUsage subtract(const MemoryUsage& later, const MemoryUsage& earlier) {
+        return {later.live_count - earlier.live_count, later.live_bytes - earlier.live_bytes,
+                later.peak_bytes, later.allocations - earlier.allocations};
+    }
+
+    MemorySnapshot MemorySnapshot::operator-(const MemorySnapshot& earlier) const {
+        MemorySnapshot result;
+        result.total = subtract(total, earlier.total);
+        for (const auto&[tag, tag_usage]: by_tag) {
+            auto it = earlier.by_tag.find(tag);
+            result.by_tag[tag] = it == earlier.by_tag.end() ? tag_usage : subtract(tag_usage, it->second);
+        }
+        return result;
+    }
+
+    ostream& MemorySnapshot::print(ostream& os) const {
+        auto print_row = [&os](const string& name, const MemoryUsage& row) {
+            os << std::left << std::setw(20) << name << std::right
+               << std::setw(10) << row.live_count
+               << std::setw(16) << row.live_bytes
+               << std::setw(16) << row.peak_bytes
+               << std::setw(14) << row.allocations << std::endl;
+        };
+        os << std::left << std::setw(20) << "tag" << std::right
+           << std::setw(10) << "live" << std::setw(16) << "live bytes"
+           << std::setw(16) << "peak bytes" << std::setw(14) << "allocations" << std::endl;
+        for (const auto&[tag, tag_usage]: by_tag)
+            print_row(tag, tag_usage);
+        print_row("total", total);
+        return os;
+    }
+}
@@ -0,0 +1,81 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_MEMORY_H
+#define TARGETPRACTICE_MEMORY_H
+
+#include <iostream>
+#include <map>
+#include <string>
+#include "common_blas.h"
+
+/*
+ * Accounting of the memory owned by tensors.
+ * Every buffer a Tensor allocates goes through allocate / deallocate, which keep global counters of the live
+ * buffers, their bytes and the peak, and attribute each buffer to the tag that was active on the allocating
+ * thread (see MemoryTag). The tag is stored in a small header in front of the buffer, so the release is
+ * attributed to the same tag even if the tensor was moved to another owner in the meantime.
+ * Wrapped buffers (Tensor::wrap, views) aren't owned by the tensor and aren't counted.
+ */
+namespace blas::memory {
+
+    // Counters are signed, so that the difference of two snapshots is meaningful.
+    struct MemoryUsage {
+        long live_count = 0;
+        long live_bytes = 0;
+        // The highest live_bytes since the last reset_peak().
+        long peak_bytes = 0;
+        // The number of buffers allocated so far.
+        long allocations = 0;
+    };
+
+    struct MemorySnapshot {
+        MemoryUsage total;
+        std::map<string, MemoryUsage> by_tag;
+
+        // The change from an earlier snapshot: live and allocation counts are subtracted, the peaks are
+        // the peaks of this snapshot.
+        MemorySnapshot operator-(const MemorySnapshot& earlier) const;
+
+        ostream& print(ostream& os) const;
+    };
+
+    // The tag of the buffers allocated outside of any MemoryTag.
+    constexpr const char *untagged = "untagged";
+
+    // Registers a tag (or finds an existing one) and returns its id, for MemoryTag on hot paths.
+    size_t register_tag(const string& name);
+
+    /**
+     * Attributes the tensors allocated on this thread during its lifetime to a tag, e.g. a variable name,
+     * "grad", "activation" or "optimizer". Tags nest, the innermost one wins.
+     */
+    class MemoryTag {
+    public:
+        explicit MemoryTag(const string& name) : MemoryTag(register_tag(name)) {}
+        explicit MemoryTag(size_t id);
+        ~MemoryTag();
+
+        MemoryTag(const MemoryTag&) = delete;
+        MemoryTag& operator=(const MemoryTag&) = delete;
+
+    private:
+        size_t previous;
+    };
+
+    // The name of the tag currently active on this thread.
+    string current_tag();
+
+    void *allocate(size_t bytes);
+    void deallocate(void *ptr);
+
+    MemorySnapshot snapshot();
+    MemoryUsage usage();
+    MemoryUsage usage(const string& tag);
+
+    // Restarts the peaks (global and per tag) from the current live bytes.
+    void reset_peak();
+}
+
+#endif //TARGETPRACTICE_MEMORY_H
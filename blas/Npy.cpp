@@ -0,0 +1,467 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Npy.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace blas {
+
+    static const char npy_magic[6] = {'\x93', 'N', 'U', 'M', 'P', 'Y'};
+    static const size_t npy_alignment = 64;
+
+    static inline bool host_is_little_endian() {
+        const uint16_t one = 1;
+        return *reinterpret_cast<const uint8_t *>(&one) == 1;
+    }
+
+    template<typename U>
+    static inline U read_le(const char *ptr) {
+        U value = 0;
+        for (size_t i = 0; i < sizeof(U); ++i)
+            value |= U(uint8_t(ptr[i])) << (8 * i);
+        return value;
+    }
+
+    template<typename U>
+    static inline void write_le(std::ostream& os, U value) {
+        char bytes[sizeof(U)];
+        for (size_t i = 0; i < sizeof(U); ++i)
+            bytes[i] = char((value >> (8 * i)) & 0xFF);
+        os.write(bytes, sizeof(U));
+    }
+
+    static DType descr2dtype(const string& descr, bool& little_endian, const string& source) {
+        if (descr.size() == 3) {
+            char order = descr[0];
+            string kind = descr.substr(1);
+            if (order == '<' || order == '>' || order == '=') {
+                little_endian = order == '<' || (order == '=' && host_is_little_endian());
+                if (kind == "f4")
+                    return DType::Float32;
+                if (kind == "f8")
+                    return DType::Float64;
+                if (kind == "i8")
+                    return DType::Int64;
+            }
+        }
+        throw std::runtime_error("Unsupported dtype '" + descr + "' in '" + source + "'.");
+    }
+
+    static string dtype2descr(DType dtype) {
+        switch (dtype) {
+            case DType::Float32:
+                return "<f4";
+            case DType::Float64:
+                return "<f8";
+            case DType::Int64:
+                return "<i8";
+        }
+        throw std::invalid_argument("Unknown dtype " + std::to_string(int(dtype)));
+    }
+
+    // Finds the value of key in the header dict, i.e. the text after "'key':".
+    static size_t find_header_value(const string& header, const string& key, const string& source) {
+        size_t pos = header.find("'" + key + "'");
+        if (pos == string::npos)
+            throw std::runtime_error("The .npy header of '" + source + "' has no '" + key + "'.");
+        pos = header.find(':', pos);
+        if (pos == string::npos)
+            throw std::runtime_error("Malformed .npy header in '" + source + "': " + header);
+        return header.find_first_not_of(' ', pos + 1);
+    }
+
+    NpyHeader parse_npy_header(const char *data, size_t size, const string& source) {
+        if (size < 10 || std::memcmp(data, npy_magic, sizeof(npy_magic)) != 0)
+            throw std::runtime_error("'" + source + "' isn't a .npy file.");
+        uint8_t major = data[6];
+        size_t header_start, header_length;
+        if (major == 1) {
+            header_start = 10;
+            header_length = read_le<uint16_t>(data + 8);
+        } else if (major == 2 || major == 3) {
+            if (size < 12)
+                throw std::runtime_error("'" + source + "' is truncated.");
+            header_start = 12;
+            header_length = read_le<uint32_t>(data + 8);
+        } else {
+            throw std::runtime_error("Unsupported .npy version " + std::to_string(major) + " in '" + source + "'.");
+        }
+        if (header_length > size - header_start)
+            throw std::runtime_error("'" + source + "' is truncated.");
+        string header(data + header_start, header_length);
+
+        NpyHeader result;
+        result.data_offset = header_start + header_length;
+
+        size_t pos = find_header_value(header, "descr", source);
+        size_t end = pos == string::npos ? string::npos : header.find(header[pos], pos + 1);
+        if (end == string::npos || (header[pos] != '\'' && header[pos] != '"'))
+            throw std::runtime_error("Malformed 'descr' in the .npy header of '" + source + "': " + header);
+        result.descr = header.substr(pos + 1, end - pos - 1);
+        result.dtype = descr2dtype(result.descr, result.little_endian, source);
+
+        pos = find_header_value(header, "fortran_order", source);
+        if (header.compare(pos, 4, "True") == 0)
+            result.fortran_order = true;
+        else if (header.compare(pos, 5, "False") == 0)
+            result.fortran_order = false;
+        else
+            throw std::runtime_error("Malformed 'fortran_order' in the .npy header of '" + source + "': " + header);
+
+        pos = find_header_value(header, "shape", source);
+        end = pos == string::npos ? string::npos : header.find(')', pos);
+        if (end == string::npos || header[pos] != '(')
+            throw std::runtime_error("Malformed 'shape' in the .npy header of '" + source + "': " + header);
+        for (++pos; pos < end;) {
+            pos = header.find_first_not_of(", ", pos);
+            if (pos >= end)
+                break;
+            size_t digits_end = header.find_first_not_of("0123456789", pos);
+            if (digits_end == pos)
+                throw std::runtime_error("Malformed 'shape' in the .npy header of '" + source + "': " + header);
+            result.shape.push_back(std::stoul(header.substr(pos, digits_end - pos)));
+            pos = digits_end;
+        }
+
+        if (result.nbytes() > size - result.data_offset)
+            throw std::runtime_error("'" + source + "' is truncated, expected " + std::to_string(result.nbytes()) +
+                                     " bytes of data.");
+        return result;
+    }
+
+    // The .npy header of a C ordered array, padded so the data is 64 bytes aligned.
+    static string make_npy_header(DType dtype, const shape_t& shape) {
+        string dict = "{'descr': '" + dtype2descr(dtype) + "', 'fortran_order': False, 'shape': (";
+        for (size_t dim: shape)
+            dict += std::to_string(dim) + ", ";
+        if (shape.size() > 1)
+            dict.resize(dict.size() - 2); // (2, 3) but (2,)
+        else if (shape.size() == 1)
+            dict.pop_back();
+        dict += "), }";
+        // Version 1.0 holds headers up to 65535 bytes, which covers any reasonable shape.
+        size_t total = sizeof(npy_magic) + 4 + dict.size() + 1;
+        size_t padded = (total + npy_alignment - 1) / npy_alignment * npy_alignment;
+        dict.append(padded - total, ' ');
+        dict += '\n';
+        string header(npy_magic, sizeof(npy_magic));
+        header += char(1);
+        header += char(0);
+        header += char(dict.size() & 0xFF);
+        header += char(dict.size() >> 8);
+        return header + dict;
+    }
+
+    // The data of a tensor in C order - a contiguous copy is kept in holder if one is needed.
+    template<typename T>
+    static const char *contiguous_data(const Tensor<T>& tensor, std::unique_ptr<Tensor<T>>& holder) {
+        if (tensor.is_sliced || dynamic_cast<const TensorTransposed<T> *>(&tensor) != nullptr) {
+            holder.reset(new Tensor<T>(tensor.contiguous()));
+            return reinterpret_cast<const char *>(holder->get_data_ptr());
+        }
+        return reinterpret_cast<const char *>(tensor.get_data_ptr());
+    }
+
+    template<typename T>
+    void save_npy(const string& path, const Tensor<T>& tensor) {
+        if (!host_is_little_endian())
+            throw std::runtime_error("Writing .npy files is only supported on little endian machines.");
+        std::unique_ptr<Tensor<T>> holder;
+        const char *data = contiguous_data(tensor, holder);
+        string header = make_npy_header(dtype_of<T>(), tensor.shape);
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        if (!os)
+            throw std::runtime_error("Cannot open '" + path + "' for writing.");
+        os.write(header.data(), header.size());
+        os.write(data, tensor.size * sizeof(T));
+        if (!os)
+            throw std::runtime_error("Failed writing '" + path + "'.");
+    }
+
+    NpyArray::NpyArray(shared_ptr<MappedFile> file, size_t offset, size_t size, const string& source)
+            : file(std::move(file)), source(source) {
+        npy_header = parse_npy_header(this->file->data() + offset, size, source);
+        data = this->file->data() + offset + npy_header.data_offset;
+    }
+
+    NpyArray NpyArray::open(const string& path) {
+        auto file = std::make_shared<MappedFile>(path);
+        size_t size = file->size();
+        return NpyArray(std::move(file), 0, size, path);
+    }
+
+    template<typename T>
+    bool NpyArray::is_viewable() const {
+        return npy_header.dtype == dtype_of<T>() && npy_header.little_endian == host_is_little_endian() &&
+               reinterpret_cast<uintptr_t>(data) % alignof(T) == 0;
+    }
+
+    template<typename T>
+    void NpyArray::check_viewable() const {
+        if (npy_header.dtype != dtype_of<T>())
+            throw std::invalid_argument("'" + source + "' is of dtype " + dtype2str(npy_header.dtype) +
+                                        ", not " + dtype2str(dtype_of<T>()) + ", use load to convert it.");
+        if (!is_viewable<T>())
+            throw std::invalid_argument("'" + source + "' can't be viewed (foreign byte order or unaligned data), "
+                                        "use load to copy it.");
+    }
+
+    template<typename T>
+    Tensor<T> NpyArray::get() const {
+        check_viewable<T>();
+        if (npy_header.fortran_order && npy_header.shape.size() > 1)
+            throw std::invalid_argument("'" + source + "' is in Fortran order, use get_fortran to view it.");
+        return Tensor<T>::wrap(reinterpret_cast<T *>(const_cast<char *>(data)), npy_header.shape);
+    }
+
+    template<typename T>
+    TensorTransposed<T> NpyArray::get_fortran() const {
+        check_viewable<T>();
+        if (!npy_header.fortran_order && npy_header.shape.size() > 1)
+            throw std::invalid_argument("'" + source + "' is in C order, use get to view it.");
+        // Fortran order is the C order of the reversed shape, so the view reverses the dimensions back.
+        size_t ndim = npy_header.shape.size();
+        shape_t reversed(npy_header.shape.rbegin(), npy_header.shape.rend());
+        shape_t permutation(ndim);
+        for (size_t i = 0; i < ndim; ++i)
+            permutation[i] = ndim - 1 - i;
+        Tensor<T> storage = Tensor<T>::wrap(reinterpret_cast<T *>(const_cast<char *>(data)), reversed);
+        return TensorTransposed<T>(storage, permutation);
+    }
+
+    template<typename S, typename T>
+    static void convert_elements(const char *src, bool swap_bytes, T *dst, size_t count,
+                                 const shape_t& fortran_shape) {
+        // Fortran ordered elements are scattered to their C position, the first dimension is the fastest.
+        shape_t c_strides = shape2strides(fortran_shape);
+        shape_t index(fortran_shape.size(), 0);
+        size_t dst_pos = 0;
+        for (size_t i = 0; i < count; ++i) {
+            char bytes[sizeof(S)];
+            std::memcpy(bytes, src + i * sizeof(S), sizeof(S));
+            if (swap_bytes)
+                std::reverse(bytes, bytes + sizeof(S));
+            S value;
+            std::memcpy(&value, bytes, sizeof(S));
+            if (fortran_shape.empty()) {
+                dst[i] = T(value);
+                continue;
+            }
+            dst[dst_pos] = T(value);
+            for (size_t d = 0; d < index.size(); ++d) {
+                dst_pos += c_strides[d];
+                if (++index[d] < fortran_shape[d])
+                    break;
+                dst_pos -= c_strides[d] * fortran_shape[d];
+                index[d] = 0;
+            }
+        }
+    }
+
+    template<typename T>
+    Tensor<T> NpyArray::load() const {
+        if (!npy_header.fortran_order && is_viewable<T>())
+            return get<T>().contiguous();
+        Tensor<T> result(npy_header.shape);
+        bool swap_bytes = npy_header.little_endian != host_is_little_endian();
+        const shape_t& fortran_shape = npy_header.fortran_order && npy_header.shape.size() > 1
+                                       ? npy_header.shape : shape_t{};
+        size_t count = shape2size(npy_header.shape);
+        T *dst = result.get_data_ptr();
+        switch (npy_header.dtype) {
+            case DType::Float32:
+                convert_elements<float>(data, swap_bytes, dst, count, fortran_shape);
+                break;
+            case DType::Float64:
+                convert_elements<double>(data, swap_bytes, dst, count, fortran_shape);
+                break;
+            case DType::Int64:
+                convert_elements<int64_t>(data, swap_bytes, dst, count, fortran_shape);
+                break;
+        }
+        return result;
+    }
+
+    // CRC-32 (the zip polynomial, 0xEDB88320 reflected).
+    static uint32_t crc32_update(uint32_t crc, const char *data, size_t size) {
+        static const auto table = [] {
+            std::array<uint32_t, 256> t{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+            crc = table[(crc ^ uint8_t(data[i])) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    static const uint32_t zip_local_header_signature = 0x04034b50;
+    static const uint32_t zip_central_header_signature = 0x02014b50;
+    static const uint32_t zip_end_signature = 0x06054b50;
+    static const size_t zip_local_header_size = 30;
+    static const size_t zip_central_header_size = 46;
+    static const size_t zip_end_size = 22;
+    // 1980-01-01, the earliest date of the zip format.
+    static const uint16_t zip_dos_date = (0 << 9) | (1 << 5) | 1;
+
+    template<typename T>
+    void save_npz(const string& path, const vector<std::pair<string, const Tensor<T> *>>& tensors) {
+        if (!host_is_little_endian())
+            throw std::runtime_error("Writing .npz files is only supported on little endian machines.");
+        struct Entry {
+            string name;
+            string header;
+            const char *data;
+            size_t nbytes;
+            uint32_t crc;
+            size_t offset;
+        };
+        vector<Entry> entries;
+        vector<std::unique_ptr<Tensor<T>>> holders(tensors.size());
+        for (size_t i = 0; i < tensors.size(); ++i) {
+            const Tensor<T>& tensor = *tensors[i].second;
+            Entry entry{tensors[i].first + ".npy", make_npy_header(dtype_of<T>(), tensor.shape),
+                        contiguous_data(tensor, holders[i]), tensor.size * sizeof(T), 0, 0};
+            if (entry.header.size() + entry.nbytes >= 0xFFFFFFFFu)
+                throw std::invalid_argument("Tensor '" + tensors[i].first + "' is too big for a .npz without zip64.");
+            entry.crc = crc32_update(crc32_update(0, entry.header.data(), entry.header.size()),
+                                     entry.data, entry.nbytes);
+            entries.push_back(std::move(entry));
+        }
+
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        if (!os)
+            throw std::runtime_error("Cannot open '" + path + "' for writing.");
+        size_t position = 0;
+        for (Entry& entry: entries) {
+            auto entry_size = uint32_t(entry.header.size() + entry.nbytes);
+            entry.offset = position;
+            write_le<uint32_t>(os, zip_local_header_signature);
+            write_le<uint16_t>(os, 20);  // version needed to extract
+            write_le<uint16_t>(os, 0);   // flags
+            write_le<uint16_t>(os, 0);   // method: stored
+            write_le<uint16_t>(os, 0);   // time
+            write_le<uint16_t>(os, zip_dos_date);
+            write_le<uint32_t>(os, entry.crc);
+            write_le<uint32_t>(os, entry_size); // compressed
+            write_le<uint32_t>(os, entry_size); // uncompressed
+            write_le<uint16_t>(os, entry.name.size());
+            write_le<uint16_t>(os, 0);   // extra field length
+            os.write(entry.name.data(), entry.name.size());
+            os.write(entry.header.data(), entry.header.size());
+            os.write(entry.data, entry.nbytes);
+            position += zip_local_header_size + entry.name.size() + entry_size;
+        }
+        size_t central_offset = position;
+        for (const Entry& entry: entries) {
+            auto entry_size = uint32_t(entry.header.size() + entry.nbytes);
+            write_le<uint32_t>(os, zip_central_header_signature);
+            write_le<uint16_t>(os, 20);  // version made by
+            write_le<uint16_t>(os, 20);  // version needed to extract
+            write_le<uint16_t>(os, 0);   // flags
+            write_le<uint16_t>(os, 0);   // method: stored
+            write_le<uint16_t>(os, 0);   // time
+            write_le<uint16_t>(os, zip_dos_date);
+            write_le<uint32_t>(os, entry.crc);
+            write_le<uint32_t>(os, entry_size);
+            write_le<uint32_t>(os, entry_size);
+            write_le<uint16_t>(os, entry.name.size());
+            write_le<uint16_t>(os, 0);   // extra field length
+            write_le<uint16_t>(os, 0);   // comment length
+            write_le<uint16_t>(os, 0);   // disk number
+            write_le<uint16_t>(os, 0);   // internal attributes
+            write_le<uint32_t>(os, 0);   // external attributes
+            write_le<uint32_t>(os, entry.offset);
+            os.write(entry.name.data(), entry.name.size());
+            position += zip_central_header_size + entry.name.size();
+        }
+        if (position >= 0xFFFFFFFFu || entries.size() >= 0xFFFF)
+            throw std::invalid_argument("'" + path + "' is too big for a .npz without zip64.");
+        write_le<uint32_t>(os, zip_end_signature);
+        write_le<uint16_t>(os, 0);       // disk number
+        write_le<uint16_t>(os, 0);       // disk of the central directory
+        write_le<uint16_t>(os, entries.size());
+        write_le<uint16_t>(os, entries.size());
+        write_le<uint32_t>(os, position - central_offset);
+        write_le<uint32_t>(os, central_offset);
+        write_le<uint16_t>(os, 0);       // comment length
+        if (!os)
+            throw std::runtime_error("Failed writing '" + path + "'.");
+    }
+
+    NpzArchive::NpzArchive(const string& path) : file(std::make_shared<MappedFile>(path)) {
+        const char *data = file->data();
+        size_t size = file->size();
+        auto corrupt = [&path](const string& reason) {
+            return std::runtime_error("'" + path + "' isn't a supported .npz: " + reason + ".");
+        };
+        // The end of central directory record is followed by a comment of up to 64KB.
+        if (size < zip_end_size)
+            throw corrupt("too small");
+        size_t end_pos = size - zip_end_size;
+        size_t min_end_pos = size > zip_end_size + 0xFFFF ? size - zip_end_size - 0xFFFF : 0;
+        while (read_le<uint32_t>(data + end_pos) != zip_end_signature) {
+            if (end_pos == min_end_pos)
+                throw corrupt("no end of central directory");
+            --end_pos;
+        }
+        size_t count = read_le<uint16_t>(data + end_pos + 10);
+        size_t pos = read_le<uint32_t>(data + end_pos + 16);
+        if (count == 0xFFFF || pos == 0xFFFFFFFFu)
+            throw corrupt("zip64 archives aren't supported");
+        for (size_t i = 0; i < count; ++i) {
+            if (pos + zip_central_header_size > end_pos || read_le<uint32_t>(data + pos) != zip_central_header_signature)
+                throw corrupt("bad central directory");
+            auto method = read_le<uint16_t>(data + pos + 10);
+            size_t compressed = read_le<uint32_t>(data + pos + 20);
+            size_t name_length = read_le<uint16_t>(data + pos + 28);
+            size_t extra_length = read_le<uint16_t>(data + pos + 30);
+            size_t comment_length = read_le<uint16_t>(data + pos + 32);
+            size_t local_offset = read_le<uint32_t>(data + pos + 42);
+            string name(data + pos + zip_central_header_size, name_length);
+            pos += zip_central_header_size + name_length + extra_length + comment_length;
+            if (method != 0)
+                throw corrupt("'" + name + "' is compressed, only stored entries are supported (numpy.savez)");
+            if (local_offset + zip_local_header_size > size ||
+                read_le<uint32_t>(data + local_offset) != zip_local_header_signature)
+                throw corrupt("bad local header of '" + name + "'");
+            size_t data_offset = local_offset + zip_local_header_size + read_le<uint16_t>(data + local_offset + 26) +
+                                 read_le<uint16_t>(data + local_offset + 28);
+            if (data_offset > size || compressed > size - data_offset)
+                throw corrupt("'" + name + "' exceeds the file");
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".npy") == 0)
+                name.resize(name.size() - 4);
+            arrays.emplace(name, NpyArray(file, data_offset, compressed, path + ":" + name));
+            array_names.push_back(name);
+        }
+    }
+
+    const NpyArray& NpzArchive::operator[](const string& name) const {
+        auto it = arrays.find(name);
+        if (it == arrays.end())
+            throw std::out_of_range("No array named '" + name + "' in '" + file->get_path() + "'.");
+        return it->second;
+    }
+
+#define INSTANTIATE_NPY(dtype)                                                                         \
+    template bool NpyArray::is_viewable<dtype>() const;                                                \
+    template Tensor<dtype> NpyArray::get<dtype>() const;                                               \
+    template TensorTransposed<dtype> NpyArray::get_fortran<dtype>() const;                             \
+    template Tensor<dtype> NpyArray::load<dtype>() const;                                              \
+    template void save_npy<dtype>(const string&, const Tensor<dtype>&);                                \
+    template void save_npz<dtype>(const string&, const vector<std::pair<string, const Tensor<dtype> *>>&);
+
+    INSTANTIATE_NPY(double)
+    INSTANTIATE_NPY(float)
+    INSTANTIATE_NPY(long)
+}
@@ -0,0 +1,116 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_NPY_H
+#define TARGETPRACTICE_NPY_H
+
+#include <memory>
+#include <unordered_map>
+#include "TensorIO.h"
+
+namespace blas {
+
+    /*
+     * NumPy's .npy format:
+     *   "\x93NUMPY" | u8 major | u8 minor | u16 (v1) or u32 (v2, v3) header length, little endian
+     *   | header, a python dict literal: {'descr': '<f8', 'fortran_order': False, 'shape': (2, 3), }
+     *     padded with spaces and a newline so the data starts 64 bytes aligned
+     *   | the data, in C (row major) or Fortran (column major) order.
+     * A .npz is a zip of .npy files named "<name>.npy", only stored (uncompressed) entries are
+     * supported, as written by numpy.savez.
+     */
+    struct NpyHeader {
+        string descr;
+        DType dtype;
+        bool little_endian;
+        bool fortran_order;
+        shape_t shape;
+        // The offset of the data from the start of the .npy.
+        size_t data_offset;
+
+        inline size_t nbytes() const { return shape2size(shape) * dtype_size(dtype); }
+    };
+
+    // Parses the header of the .npy at data (of the given size), source is used in error messages.
+    NpyHeader parse_npy_header(const char *data, size_t size, const string& source);
+
+    /**
+     * An array in a mapped .npy (or a stored entry of a mapped .npz).
+     * Viewing the array doesn't copy it, the views share the mapped (copy-on-write) pages.
+     * @note The views don't keep the mapping alive, the NpyArray (or a copy of it) must outlive them.
+     */
+    class NpyArray {
+    public:
+        NpyArray(shared_ptr<MappedFile> file, size_t offset, size_t size, const string& source);
+
+        // Maps a .npy file.
+        static NpyArray open(const string& path);
+
+        inline const NpyHeader& header() const { return npy_header; }
+
+        inline const shape_t& shape() const { return npy_header.shape; }
+
+        inline bool is_fortran_order() const { return npy_header.fortran_order; }
+
+        // Whether get (or get_fortran) can view the data, i.e. the dtype is T in the byte order of
+        // this machine, and the data is aligned for T.
+        template<typename T>
+        bool is_viewable() const;
+
+        // A view of a C ordered array.
+        template<typename T>
+        Tensor<T> get() const;
+
+        // A strided view of a Fortran ordered array, with the array's shape.
+        template<typename T>
+        TensorTransposed<T> get_fortran() const;
+
+        // A C ordered copy, that doesn't depend on the mapping, of an array in any order and byte order.
+        template<typename T>
+        Tensor<T> load() const;
+
+    private:
+        shared_ptr<MappedFile> file;
+        const char *data;
+        string source;
+        NpyHeader npy_header;
+
+        template<typename T>
+        void check_viewable() const;
+    };
+
+    // A mapped .npz archive.
+    class NpzArchive {
+    public:
+        explicit NpzArchive(const string& path);
+
+        // The names of the arrays (without the ".npy" suffix), in the order of the archive.
+        inline const vector<string>& names() const { return array_names; }
+
+        inline bool contains(const string& name) const { return arrays.count(name) > 0; }
+
+        const NpyArray& operator[](const string& name) const;
+
+    private:
+        shared_ptr<MappedFile> file;
+        vector<string> array_names;
+        std::unordered_map<string, NpyArray> arrays;
+    };
+
+    // Writes a tensor as a C ordered, little endian .npy.
+    template<typename T>
+    void save_npy(const string& path, const Tensor<T>& tensor);
+
+    // Reads a .npy into a C ordered tensor.
+    template<typename T>
+    inline Tensor<T> load_npy(const string& path) {
+        return NpyArray::open(path).load<T>();
+    }
+
+    // Writes tensors as the stored (uncompressed) entries of a .npz, readable by numpy.load.
+    template<typename T>
+    void save_npz(const string& path, const vector<std::pair<string, const Tensor<T> *>>& tensors);
+}
+
+#endif //TARGETPRACTICE_NPY_H
@@ -11,6 +11,7 @@
 #include <type_traits>
 #include <vector>
 
+#include "Memory.h"
 #include "Slice.h"
 #include "common_blas.h"
 
@@ -34,6 +35,12 @@ class TensorSliced;
 template <typename T>
 class TensorTransposed;
 
+template <typename T, class E>
+class TensorExpr;
+
+template <typename T>
+class TensorOperand;
+
 /**
  * Fill a tensor with a single value inplace, generically.
  * @tparam Tens destination tensor type
@@ -56,6 +63,16 @@ Tens<T>& fill_(Tens<T>& dst, T scalar);
 template <class Tensor1, class Tensor2>
 Tensor1& copy_(Tensor1& dst, const Tensor2& src);
 
+/**
+ * Evaluate an expression inplace into a destination tensor of the same shape.
+ * @tparam Tensor1 destination tensor type.
+ * @param dst destination tensor.
+ * @param expr expression of tensors (see TensorExpression.h).
+ * @return destination after the expression has been evaluated into it.
+ */
+template <class Tensor1, typename T, class E>
+Tensor1& assign_(Tensor1& dst, const TensorExpr<T, E>& expr);
+
 #define DECL_INTERACTIVE_ACTION_TENSOR_UNIQUE_BASE(TensorT1)                   \
     virtual TensorT1& apply_(T scalar, const binary_op<T>& op);                \
     virtual TensorT1& apply_(const unary_op<T>&);                              \
@@ -145,18 +162,26 @@ Tensor1& copy_(Tensor1& dst, const Tensor2& src);
         return *this;                                      \
     }
 
-#define DEF_COPY_FILL_TEMPLATES(Tensor1, T)      \
-    template <typename scalar_t>                 \
-    inline Tensor1& fill_(scalar_t scalar) {     \
-        return blas::fill_(*this, scalar);       \
-    }                                            \
-    template <typename scalar_t>                 \
-    inline Tensor1& operator=(scalar_t scalar) { \
-        this->fill_(scalar);                     \
-        return *this;                            \
-    }                                            \
+#define DEF_COPY_FILL_TEMPLATES(Tensor1, T)                                 \
+    template <typename scalar_t>                                            \
+    inline Tensor1& fill_(scalar_t scalar) {                                \
+        return blas::fill_(*this, scalar);                                  \
+    }                                                                       \
+    template <typename scalar_t,                                            \
+              typename = std::enable_if_t<std::is_arithmetic_v<scalar_t>>> \
+    inline Tensor1& operator=(scalar_t scalar) {                            \
+        this->fill_(scalar);                                                \
+        return *this;                                                       \
+    }                                                                       \
     MACRO_INTERACTABLE_TENSORTYPES(DEF_ASSIGNMENT_TEMPLATE, Tensor1, T)
 
+// Evaluates an expression (see TensorExpression.h) into the tensor in place.
+#define DEF_EXPRESSION_ASSIGNMENT(Tensor1, T)                 \
+    template <class E>                                        \
+    inline Tensor1& operator=(const TensorExpr<T, E>& expr) { \
+        return blas::assign_(*this, expr);                    \
+    }
+
 template <typename T>
 class Tensor {
    public:
@@ -172,7 +197,14 @@ class Tensor {
     Tensor(T* data, const shape_t& shape);
     Tensor(const Tensor& other);
     Tensor(Tensor&& other) noexcept;
+    // Evaluates an expression of tensors (see TensorExpression.h).
+    template <class E>
+    Tensor(const TensorExpr<T, E>& expr);
     virtual ~Tensor();
+
+    // Wraps an existing buffer without copying it - the returned tensor
+    // doesn't own the buffer, which must outlive it.
+    static Tensor wrap(T* data, const shape_t& shape);
     inline T item() const { return data[0]; }
 
     friend void swap(Tensor<T>& t1, Tensor<T>& t2) {
@@ -189,6 +221,11 @@ class Tensor {
 
     Tensor& operator=(Tensor&& other) noexcept;
 
+    // Evaluates the expression into the buffer of this tensor (owned or not)
+    // if it has the same shape, otherwise into a new one.
+    template <class E>
+    Tensor& operator=(const TensorExpr<T, E>& expr);
+
     inline Tensor& operator=(T scalar) {
         fill_(scalar);
         return *this;
@@ -477,6 +514,11 @@ class Tensor {
     T* data;
     bool requires_deletion = true;
 
+    // An owned buffer of n elements, accounted for by blas::memory and released by the destructor.
+    static inline T* allocate(size_t n) {
+        return static_cast<T*>(memory::allocate(n * sizeof(T)));
+    }
+
     shape_t slice2shape(const Slice& slice) const;
 
     Slice normalize_slice(const Slice& slice, long max_size = -1) const;
@@ -2,6 +2,7 @@
 // Created by LevZ on 9/12/2020.
 //
 #include "TensorCreation.h"
+#include "Instrumentation.h"
 #include <random>
 
 namespace blas {
@@ -47,6 +48,7 @@ namespace blas {
 
     template<typename T>
     Tensor<T> uniform(T lower, T upper, const shape_t& shape) {
+        BLAS_INSTRUMENT("uniform", shape2str(shape), 0, double(shape2size(shape)) * sizeof(T));
         Tensor<T> ret(shape);
         uniform_driver_type<T> driver{lower, upper};
         auto& gen = RandomState::get_engine();
@@ -58,6 +60,7 @@ namespace blas {
 
     template<typename T>
     Tensor<T> randn(T mu, T sigma, const shape_t& shape) {
+        BLAS_INSTRUMENT("randn", shape2str(shape), 0, double(shape2size(shape)) * sizeof(T));
         Tensor<T> ret(shape);
         normal_driver_type<T> driver{mu, sigma};
         auto& gen = RandomState::get_engine();
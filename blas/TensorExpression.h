@@ -0,0 +1,367 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_TENSOREXPRESSION_H
+#define TARGETPRACTICE_TENSOREXPRESSION_H
+
+#include <cstdint>
+#include <memory>
+#include "all_tensors.h"
+#include "Instrumentation.h"
+
+/*
+ * Expression templates for the element-wise arithmetic of tensors.
+ * a * b + c * d - e doesn't compute anything, it builds a tree of the operands, which is evaluated
+ * in a single fused loop (with broadcasting) when it is assigned to a tensor or converted to one -
+ * no temporaries, and one pass over the memory instead of five.
+ * An expression refers to its tensors, and reads them when it is evaluated, so it must be evaluated
+ * before they change or die. Temporary operands (e.g. a.transpose() or uniform(...)) are moved into it.
+ */
+namespace blas {
+
+    template<typename T>
+    class TensorOperand;
+
+    /**
+     * The base of every expression node (CRTP). The nodes only hold references to the tensors (or share
+     * the temporaries), scalars and the operators, so they are cheap to copy into their parents.
+     * @tparam T the data type.
+     * @tparam E the derived node type, which provides:
+     *           num_ops - the number of operations per element.
+     *           shape() - the (broadcast) shape of the result.
+     *           at<unit_stride>(i) - the i-th element of the current row of the output.
+     *           collect(operands) - adds its tensor operands to operands.
+     */
+    template<typename T, class E>
+    class TensorExpr {
+    public:
+        inline const E& derived() const { return static_cast<const E&>(*this); }
+
+        inline shape_t shape() const { return derived().shape(); }
+
+        inline Tensor<T> eval() const { return Tensor<T>(*this); }
+
+        // The math functions and reductions of the result, for chaining - e.g. (a - b).absl().sum().
+#define DEF_EXPR_MATH_FUNC(func)          \
+        inline Tensor<T> func() const {   \
+            Tensor<T> result = eval();    \
+            result.func##_();             \
+            return result;                \
+        }
+
+        MACRO_MATH_FUNCTIONS(DEF_EXPR_MATH_FUNC)
+
+        inline Tensor<T> reduce(const binary_op<T>& op) const { return eval().reduce(op); }
+
+        inline Tensor<T> reduce(const binary_op<T>& op, int dim) const { return eval().reduce(op, dim); }
+
+        inline Tensor<T> sum() const { return eval().sum(); }
+
+        inline Tensor<T> sum(int dim) const { return eval().sum(dim); }
+
+        inline friend ostream& operator<<(ostream& os, const TensorExpr& expr) {
+            return os << expr.eval();
+        }
+    };
+
+    // A tensor of any kind in an expression.
+    template<typename T>
+    class TensorOperand : public TensorExpr<T, TensorOperand<T>> {
+    public:
+        static constexpr size_t num_ops = 0;
+
+        explicit TensorOperand(const Tensor<T>& tensor) : tensor(tensor) {}
+
+        // A temporary is moved into the operand, and shared by its copies.
+        template<template<typename> class TensorType>
+        explicit TensorOperand(TensorType<T>&& temporary) :
+                owned(std::make_shared<TensorType<T>>(std::move(temporary))), tensor(*owned) {}
+
+        TensorOperand(const TensorOperand& other) : owned(other.owned), tensor(other.tensor) {}
+
+        inline const shape_t& shape() const { return tensor.shape; }
+
+        template<bool unit_stride>
+        inline T at(size_t i) const {
+            return unit_stride ? cursor[i] : cursor[long(i) * cursor_stride];
+        }
+
+        inline void collect(vector<const TensorOperand *>& operands) const { operands.push_back(this); }
+
+        /**
+         * The memory layout of the tensor: returns the address of its first element, and writes the
+         * stride (in elements) of every dimension to strides. A slice whose shape doesn't match its
+         * slice group isn't strided, and is copied first.
+         */
+        const T *layout(long *strides) const;
+
+        // Whether the last layout was of a copy of the tensor.
+        inline bool is_materialized() const { return materialized.get_data_ptr() != nullptr; }
+
+        // The start and the stride of the current row, set by the evaluation.
+        mutable const T *cursor = nullptr;
+        mutable long cursor_stride = 1;
+
+    private:
+        std::shared_ptr<const Tensor<T>> owned;
+        const Tensor<T>& tensor;
+        mutable Tensor<T> materialized;
+    };
+
+    template<typename T>
+    class TensorScalar : public TensorExpr<T, TensorScalar<T>> {
+    public:
+        static constexpr size_t num_ops = 0;
+
+        explicit TensorScalar(T value) : value(value) {}
+
+        // Broadcast to any shape.
+        inline shape_t shape() const { return {}; }
+
+        template<bool unit_stride>
+        inline T at(size_t) const { return value; }
+
+        inline void collect(vector<const TensorOperand<T> *>&) const {}
+
+    private:
+        T value;
+    };
+
+    template<typename T, class Op, class Lhs, class Rhs>
+    class TensorBinaryExpr : public TensorExpr<T, TensorBinaryExpr<T, Op, Lhs, Rhs>> {
+    public:
+        static constexpr size_t num_ops = Lhs::num_ops + Rhs::num_ops + 1;
+
+        // Checks that the shapes broadcast as soon as the expression is built, like the eager operators.
+        TensorBinaryExpr(Op op, const Lhs& lhs, const Rhs& rhs) : op(op), lhs(lhs), rhs(rhs) {
+            broadcast_shapes(lhs.shape(), rhs.shape());
+        }
+
+        inline shape_t shape() const { return broadcast_shapes(lhs.shape(), rhs.shape()); }
+
+        template<bool unit_stride>
+        inline T at(size_t i) const {
+            return op(lhs.template at<unit_stride>(i), rhs.template at<unit_stride>(i));
+        }
+
+        inline void collect(vector<const TensorOperand<T> *>& operands) const {
+            lhs.collect(operands);
+            rhs.collect(operands);
+        }
+
+    private:
+        Op op;
+        Lhs lhs;
+        Rhs rhs;
+    };
+
+    template<typename T, class Op, class Lhs, class Rhs>
+    inline TensorBinaryExpr<T, Op, Lhs, Rhs> make_binary_expr(Op op, const Lhs& lhs, const Rhs& rhs) {
+        return TensorBinaryExpr<T, Op, Lhs, Rhs>(op, lhs, rhs);
+    }
+
+    // Writes the strides of a contiguous tensor of the given shape.
+    inline void contiguous_strides(const shape_t& shape, long *strides) {
+        long stride = 1;
+        for (size_t d = shape.size(); d-- > 0; stride *= long(shape[d]))
+            strides[d] = stride;
+    }
+
+    template<typename T>
+    const T *TensorOperand<T>::layout(long *strides) const {
+        std::fill(strides, strides + tensor.dim(), 0);
+        if (auto sliced = dynamic_cast<const TensorSliced<T> *>(&tensor)) {
+            const T *data = sliced->get_data_ptr();
+            shape_t underlying_strides = shape2strides(sliced->underlying_tensor_shape);
+            // The size and the stride of every dimension the slice group doesn't fix.
+            vector<std::pair<size_t, long>> free_dims;
+            for (size_t d = 0; d < sliced->slice_group.slices.size(); ++d) {
+                const Slice& slice = sliced->slice_group.slices[d];
+                data += slice.b * long(underlying_strides[d]);
+                if (slice.size() != 1)
+                    free_dims.emplace_back(slice.size(), slice.stride * long(underlying_strides[d]));
+            }
+            // The shape of the slice may have dimensions of size 1 squeezed or unsqueezed.
+            size_t next = 0;
+            bool strided = true;
+            for (size_t d = 0; d < tensor.dim() && strided; ++d) {
+                if (tensor.shape[d] == 1)
+                    continue;
+                strided = next < free_dims.size() && free_dims[next].first == tensor.shape[d];
+                if (strided)
+                    strides[d] = free_dims[next++].second;
+            }
+            if (strided && next == free_dims.size())
+                return data;
+            materialized = tensor.contiguous();
+            contiguous_strides(materialized.shape, strides);
+            return materialized.get_data_ptr();
+        }
+        if (dynamic_cast<const TensorTransposed<T> *>(&tensor))
+            std::copy(tensor.strides.begin(), tensor.strides.end(), strides);
+        else
+            contiguous_strides(tensor.shape, strides);
+        return tensor.get_data_ptr();
+    }
+
+    /**
+     * Evaluates an expression of the given shape into out, whose elements are laid out by out_strides
+     * (one per dimension). All the tensors of the expression are read in the same loop: the dimensions
+     * that are contiguous in all of them are merged, and the innermost one is a plain loop, which is
+     * vectorized when every tensor has a unit stride in it.
+     * An operand that overlaps out in a different layout (e.g. a = a.transpose() + b) would read elements
+     * already written, so the expression is evaluated into a temporary first.
+     */
+    template<typename T, class E>
+    void evaluate(const TensorExpr<T, E>& expr, const shape_t& shape, T *out, const long *out_strides) {
+        const E& root = expr.derived();
+        const size_t size = shape2size(shape), dims = shape.size();
+        vector<const TensorOperand<T> *> operands;
+        operands.reserve(8);
+        root.collect(operands);
+        const size_t n = operands.size(), tensors = n + 1;
+        BLAS_INSTRUMENT("expression", shape2str(shape), double(E::num_ops) * size, double(tensors) * size * sizeof(T));
+        if (size == 0)
+            return;
+
+        // The strides of every operand, and of out last, aligned to the dimensions of the output -
+        // a broadcast dimension has a stride of 0. strides[k * dims + d] is of tensor k in dimension d.
+        vector<long> strides(tensors * dims, 0);
+        vector<const T *> bases(n);
+        for (size_t k = 0; k < n; ++k) {
+            const shape_t& operand_shape = operands[k]->shape();
+            long *operand_strides = strides.data() + k * dims + dims - operand_shape.size();
+            bases[k] = operands[k]->layout(operand_strides);
+            for (size_t d = 0; d < operand_shape.size(); ++d)
+                if (operand_shape[d] == 1)
+                    operand_strides[d] = 0;
+        }
+        std::copy(out_strides, out_strides + dims, strides.data() + n * dims);
+
+        // Drops the dimensions of size 1, and merges every dimension into the previous one if it is
+        // contiguous with it in all the tensors. merged[k * width + m] is of tensor k in merged dimension m.
+        const size_t width = std::max<size_t>(dims, 1);
+        shape_t merged_shape;
+        merged_shape.reserve(width);
+        vector<long> merged(tensors * width, 1);
+        for (size_t d = 0; d < dims; ++d) {
+            if (shape[d] == 1)
+                continue;
+            size_t m = merged_shape.size();
+            bool contiguous = m > 0;
+            for (size_t k = 0; k < tensors && contiguous; ++k)
+                contiguous = merged[k * width + m - 1] == strides[k * dims + d] * long(shape[d]);
+            if (contiguous)
+                merged_shape[--m] *= shape[d];
+            else
+                merged_shape.push_back(shape[d]);
+            for (size_t k = 0; k < tensors; ++k)
+                merged[k * width + m] = strides[k * dims + d];
+        }
+        // A single element - one dimension of size 1 (its strides are left at 1).
+        if (merged_shape.empty())
+            merged_shape.push_back(1);
+        const size_t merged_dims = merged_shape.size();
+        auto merged_stride = [&](size_t k, size_t m) { return merged[k * width + m]; };
+
+        // The address range of every tensor, to find the operands that alias out.
+        auto extent = [&](const T *base, size_t k) {
+            auto low = reinterpret_cast<std::uintptr_t>(base), high = low;
+            for (size_t m = 0; m < merged_dims; ++m) {
+                long span = merged_stride(k, m) * long(merged_shape[m] - 1) * long(sizeof(T));
+                (span < 0 ? low : high) += span;
+            }
+            return std::make_pair(low, high + sizeof(T));
+        };
+        auto out_extent = extent(out, n);
+        for (size_t k = 0; k < n; ++k) {
+            auto operand_extent = extent(bases[k], k);
+            if (operand_extent.first >= out_extent.second || out_extent.first >= operand_extent.second)
+                continue;
+            bool same_layout = bases[k] == out;
+            for (size_t m = 0; m < merged_dims && same_layout; ++m)
+                same_layout = merged_stride(k, m) == merged_stride(n, m);
+            if (!same_layout) {
+                Tensor<T> temporary(expr);
+                evaluate(TensorOperand<T>(temporary), shape, out, out_strides);
+                return;
+            }
+        }
+
+        const size_t inner = merged_shape.back(), outer_dims = merged_dims - 1;
+        bool unit_stride = true;
+        for (size_t k = 0; k < tensors; ++k)
+            unit_stride = unit_stride && merged_stride(k, outer_dims) == 1;
+        for (size_t k = 0; k < n; ++k)
+            operands[k]->cursor_stride = merged_stride(k, outer_dims);
+        const long out_stride = merged_stride(n, outer_dims);
+
+        vector<long> offsets(tensors, 0);
+        shape_t counter(outer_dims, 0);
+        for (size_t row = 0, rows = size / inner; row < rows; ++row) {
+            for (size_t k = 0; k < n; ++k)
+                operands[k]->cursor = bases[k] + offsets[k];
+            T *out_row = out + offsets[n];
+            if (unit_stride)
+                for (size_t i = 0; i < inner; ++i)
+                    out_row[i] = root.template at<true>(i);
+            else
+                for (size_t i = 0; i < inner; ++i)
+                    out_row[long(i) * out_stride] = root.template at<false>(i);
+            // The next row - an odometer over the outer dimensions.
+            for (size_t m = outer_dims; m-- > 0;) {
+                for (size_t k = 0; k < tensors; ++k)
+                    offsets[k] += merged_stride(k, m);
+                if (++counter[m] < merged_shape[m])
+                    break;
+                counter[m] = 0;
+                for (size_t k = 0; k < tensors; ++k)
+                    offsets[k] -= merged_stride(k, m) * long(merged_shape[m]);
+            }
+        }
+    }
+
+    /**
+     * Evaluates an expression into an existing tensor of any kind (in place, through its layout).
+     * Unlike assigning to a Tensor<T>, the tensor isn't reallocated, so the shapes must be equal.
+     */
+    template<class Tensor1, typename T, class E>
+    Tensor1& assign_(Tensor1& dst, const TensorExpr<T, E>& expr) {
+        shape_t shape = expr.shape();
+        if (dst.shape != shape)
+            throw std::invalid_argument("Can't assign an expression of shape " + shape2str(shape) +
+                                        " to a tensor of shape " + shape2str(dst.shape) + ".");
+        TensorOperand<T> dst_operand(dst);
+        vector<long> dst_strides(shape.size());
+        const T *dst_data = dst_operand.layout(dst_strides.data());
+        if (dst_operand.is_materialized()) {
+            Tensor<T> evaluated(expr);
+            return blas::copy_(dst, evaluated);
+        }
+        evaluate(expr, shape, const_cast<T *>(dst_data), dst_strides.data());
+        return dst;
+    }
+
+    template<typename T>
+    template<class E>
+    Tensor<T>::Tensor(const TensorExpr<T, E>& expr) : Tensor(expr.shape()) {
+        vector<long> out_strides(shape.size());
+        contiguous_strides(shape, out_strides.data());
+        evaluate(expr, shape, data, out_strides.data());
+    }
+
+    template<typename T>
+    template<class E>
+    Tensor<T>& Tensor<T>::operator=(const TensorExpr<T, E>& expr) {
+        // A buffer of the same shape is written in place, even if it isn't owned (e.g. a parameter in
+        // the flat buffer of its module), a buffer of another shape is replaced, as by a new tensor.
+        if (data != nullptr && shape == expr.shape())
+            return assign_(*this, expr);
+        Tensor<T> evaluated(expr);
+        swap(*this, evaluated);
+        return *this;
+    }
+}
+
+#endif //TARGETPRACTICE_TENSOREXPRESSION_H
@@ -0,0 +1,210 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "TensorIO.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace blas {
+
+    static const char archive_magic[8] = {'T', 'P', 'T', 'E', 'N', 'S', 'O', 'R'};
+    static const uint32_t archive_version = 1;
+    static const uint32_t byte_order_mark = 0x01020304;
+    static const size_t payload_alignment = 64;
+
+    template<>
+    DType dtype_of<float>() { return DType::Float32; }
+
+    template<>
+    DType dtype_of<double>() { return DType::Float64; }
+
+    template<>
+    DType dtype_of<long>() { return DType::Int64; }
+
+    size_t dtype_size(DType dtype) {
+        switch (dtype) {
+            case DType::Float32:
+                return 4;
+            case DType::Float64:
+            case DType::Int64:
+                return 8;
+        }
+        throw std::invalid_argument("Unknown dtype " + std::to_string(int(dtype)));
+    }
+
+    string dtype2str(DType dtype) {
+        switch (dtype) {
+            case DType::Float32:
+                return "float32";
+            case DType::Float64:
+                return "float64";
+            case DType::Int64:
+                return "int64";
+        }
+        return "unknown(" + std::to_string(int(dtype)) + ")";
+    }
+
+    static inline size_t align_up(size_t offset) {
+        return (offset + payload_alignment - 1) / payload_alignment * payload_alignment;
+    }
+
+    template<typename T>
+    TensorArchiveWriter& TensorArchiveWriter::add(const string& name, const Tensor<T>& tensor) {
+        for (const auto& entry: entries)
+            if (entry.name == name)
+                throw std::invalid_argument("A tensor named '" + name + "' was already added to the archive.");
+        Entry entry{name, dtype_of<T>(), tensor.shape, nullptr, tensor.size * sizeof(T), nullptr};
+        if (tensor.is_sliced || dynamic_cast<const TensorTransposed<T> *>(&tensor) != nullptr) {
+            auto copy = std::make_shared<Tensor<T>>(tensor.contiguous());
+            entry.data = reinterpret_cast<const char *>(copy->get_data_ptr());
+            entry.owned = copy;
+        } else {
+            entry.data = reinterpret_cast<const char *>(tensor.get_data_ptr());
+        }
+        entries.push_back(std::move(entry));
+        return *this;
+    }
+
+    template<typename U>
+    static inline void write_pod(std::ostream& os, U value) {
+        os.write(reinterpret_cast<const char *>(&value), sizeof(U));
+    }
+
+    void TensorArchiveWriter::save(const string& path) const {
+        // The header is written first, so the offsets of the payloads must be known in advance.
+        size_t header_size = sizeof(archive_magic) + 2 * sizeof(uint32_t) + sizeof(uint64_t);
+        for (const auto& entry: entries)
+            header_size += sizeof(uint32_t) + entry.name.size() + sizeof(uint8_t) + sizeof(uint32_t) +
+                           2 * entry.shape.size() * sizeof(uint64_t) + 2 * sizeof(uint64_t);
+        vector<size_t> offsets(entries.size());
+        size_t offset = header_size;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            offsets[i] = align_up(offset);
+            offset = offsets[i] + entries[i].nbytes;
+        }
+
+        string tmp_path = path + ".tmp";
+        {
+            std::ofstream os(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!os)
+                throw std::runtime_error("Cannot open '" + tmp_path + "' for writing.");
+            os.write(archive_magic, sizeof(archive_magic));
+            write_pod<uint32_t>(os, archive_version);
+            write_pod<uint32_t>(os, byte_order_mark);
+            write_pod<uint64_t>(os, entries.size());
+            for (size_t i = 0; i < entries.size(); ++i) {
+                const Entry& entry = entries[i];
+                write_pod<uint32_t>(os, entry.name.size());
+                os.write(entry.name.data(), entry.name.size());
+                write_pod<uint8_t>(os, uint8_t(entry.dtype));
+                write_pod<uint32_t>(os, entry.shape.size());
+                for (size_t dim: entry.shape)
+                    write_pod<uint64_t>(os, dim);
+                for (size_t stride: shape2strides(entry.shape))
+                    write_pod<uint64_t>(os, stride);
+                write_pod<uint64_t>(os, offsets[i]);
+                write_pod<uint64_t>(os, entry.nbytes);
+            }
+            static const char padding[payload_alignment] = {};
+            size_t position = header_size;
+            for (size_t i = 0; i < entries.size(); ++i) {
+                os.write(padding, offsets[i] - position);
+                os.write(entries[i].data, entries[i].nbytes);
+                position = offsets[i] + entries[i].nbytes;
+            }
+            if (!os)
+                throw std::runtime_error("Failed writing '" + tmp_path + "'.");
+        }
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+            throw std::runtime_error("Cannot replace '" + path + "' with '" + tmp_path + "'.");
+    }
+
+    namespace {
+    // Reads the header of an archive, checking that it doesn't exceed the file.
+    class ArchiveReader {
+    public:
+        ArchiveReader(const MappedFile& file) : file(file) {}
+
+        template<typename U>
+        U read() {
+            U value;
+            std::memcpy(&value, take(sizeof(U)), sizeof(U));
+            return value;
+        }
+
+        const char *take(size_t n) {
+            if (n > file.size() - position)
+                throw std::runtime_error("'" + file.get_path() + "' is truncated or isn't a tensor archive.");
+            const char *ptr = file.data() + position;
+            position += n;
+            return ptr;
+        }
+
+    private:
+        const MappedFile& file;
+        size_t position = 0;
+    };
+    }
+
+    MappedTensorArchive::MappedTensorArchive(const string& path) : file(new MappedFile(path)) {
+        ArchiveReader reader(*file);
+        if (std::memcmp(reader.take(sizeof(archive_magic)), archive_magic, sizeof(archive_magic)) != 0)
+            throw std::runtime_error("'" + path + "' isn't a tensor archive.");
+        auto version = reader.read<uint32_t>();
+        if (version != archive_version)
+            throw std::runtime_error("Unsupported tensor archive version " + std::to_string(version) + ".");
+        if (reader.read<uint32_t>() != byte_order_mark)
+            throw std::runtime_error("'" + path + "' was written on a machine with a different byte order.");
+        auto count = reader.read<uint64_t>();
+        for (uint64_t i = 0; i < count; ++i) {
+            TensorRecord record;
+            auto name_size = reader.read<uint32_t>();
+            record.name.assign(reader.take(name_size), name_size);
+            record.dtype = DType(reader.read<uint8_t>());
+            size_t element_size = dtype_size(record.dtype);
+            auto ndim = reader.read<uint32_t>();
+            for (uint32_t d = 0; d < ndim; ++d)
+                record.shape.push_back(reader.read<uint64_t>());
+            for (uint32_t d = 0; d < ndim; ++d)
+                record.strides.push_back(reader.read<uint64_t>());
+            record.offset = reader.read<uint64_t>();
+            record.nbytes = reader.read<uint64_t>();
+            if (record.nbytes != shape2size(record.shape) * element_size ||
+                record.offset % payload_alignment != 0 || record.offset > file->size() ||
+                record.nbytes > file->size() - record.offset)
+                throw std::runtime_error("Corrupt record '" + record.name + "' in '" + path + "'.");
+            index[record.name] = tensor_records.size();
+            tensor_records.push_back(std::move(record));
+        }
+    }
+
+    const TensorRecord& MappedTensorArchive::record(const string& name) const {
+        auto it = index.find(name);
+        if (it == index.end())
+            throw std::out_of_range("No tensor named '" + name + "' in '" + file->get_path() + "'.");
+        return tensor_records[it->second];
+    }
+
+    template<typename T>
+    Tensor<T> MappedTensorArchive::get(const string& name) const {
+        const TensorRecord& rec = record(name);
+        if (rec.dtype != dtype_of<T>())
+            throw std::invalid_argument("Tensor '" + name + "' is of dtype " + dtype2str(rec.dtype) +
+                                        ", not " + dtype2str(dtype_of<T>()) + ".");
+        if (rec.strides != shape2strides(rec.shape))
+            throw std::invalid_argument("Tensor '" + name + "' isn't contiguous, strides " +
+                                        shape2str(rec.strides) + " for shape " + shape2str(rec.shape) + ".");
+        // The mapping is page aligned and the payloads are 64 bytes aligned.
+        return Tensor<T>::wrap(reinterpret_cast<T *>(file->data() + rec.offset), rec.shape);
+    }
+
+#define INSTANTIATE_TENSOR_IO(dtype)                                                                 \
+    template TensorArchiveWriter& TensorArchiveWriter::add<dtype>(const string&, const Tensor<dtype>&); \
+    template Tensor<dtype> MappedTensorArchive::get<dtype>(const string&) const;
+
+    INSTANTIATE_TENSOR_IO(double)
+    INSTANTIATE_TENSOR_IO(float)
+    INSTANTIATE_TENSOR_IO(long)
+}
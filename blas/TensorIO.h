@@ -0,0 +1,121 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_TENSORIO_H
+#define TARGETPRACTICE_TENSORIO_H
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include "all_tensors.h"
+#include "../utils/MappedFile.h"
+
+namespace blas {
+
+    enum class DType : uint8_t { Float32 = 1, Float64 = 2, Int64 = 3 };
+
+    template<typename T>
+    DType dtype_of();
+
+    template<>
+    DType dtype_of<float>();
+
+    template<>
+    DType dtype_of<double>();
+
+    template<>
+    DType dtype_of<long>();
+
+    size_t dtype_size(DType dtype);
+
+    string dtype2str(DType dtype);
+
+    /*
+     * The binary tensor archive format (all numbers in the byte order of the writer, which is
+     * checked by the reader):
+     *   "TPTENSOR" | u32 version | u32 byte order mark (0x01020304) | u64 number of tensors
+     *   For each tensor:
+     *     u32 name length | name | u8 dtype | u32 ndim | u64 shape[ndim] | u64 strides[ndim] (in elements)
+     *     | u64 payload offset (from the start of the file) | u64 payload bytes
+     *   The payloads, each aligned to 64 bytes.
+     */
+    struct TensorRecord {
+        string name;
+        DType dtype;
+        shape_t shape;
+        shape_t strides;
+        uint64_t offset;
+        uint64_t nbytes;
+    };
+
+    // Writes tensors (of any of the supported dtypes) into a single archive.
+    class TensorArchiveWriter {
+    public:
+        // The tensor is not copied, it must stay alive (and unchanged) until 'save'.
+        // Sliced and transposed tensors are copied into a contiguous tensor.
+        template<typename T>
+        TensorArchiveWriter& add(const string& name, const Tensor<T>& tensor);
+
+        // Writes the archive, through a temporary file that replaces path once it is complete.
+        void save(const string& path) const;
+
+        inline size_t size() const { return entries.size(); }
+
+    private:
+        struct Entry {
+            string name;
+            DType dtype;
+            shape_t shape;
+            const char *data;
+            size_t nbytes;
+            // Keeps a contiguous copy alive, if one was made.
+            shared_ptr<void> owned;
+        };
+        vector<Entry> entries;
+    };
+
+    /**
+     * An archive loaded by mapping its file into memory. Getting a tensor doesn't copy it - the
+     * returned tensor views the mapped pages (which are only read from disk when accessed, and
+     * shared between processes), and writing to it only changes the private pages of this mapping.
+     * @note The archive must outlive the tensors viewing it.
+     */
+    class MappedTensorArchive {
+    public:
+        explicit MappedTensorArchive(const string& path);
+
+        inline const vector<TensorRecord>& records() const { return tensor_records; }
+
+        inline bool contains(const string& name) const { return index.count(name) > 0; }
+
+        const TensorRecord& record(const string& name) const;
+
+        // A tensor viewing the mapped payload, the dtype must match T.
+        template<typename T>
+        Tensor<T> get(const string& name) const;
+
+        // A copy of the payload, that doesn't depend on the archive.
+        template<typename T>
+        inline Tensor<T> load(const string& name) const {
+            Tensor<T> view = get<T>(name);
+            return Tensor<T>(view);
+        }
+
+    private:
+        std::unique_ptr<MappedFile> file;
+        vector<TensorRecord> tensor_records;
+        std::unordered_map<string, size_t> index;
+    };
+
+    // Saves tensors of a single type into an archive.
+    template<typename T>
+    void save_tensors(const string& path, const vector<std::pair<string, const Tensor<T> *>>& tensors) {
+        TensorArchiveWriter writer;
+        for (const auto& named_tensor: tensors)
+            writer.add(named_tensor.first, *named_tensor.second);
+        writer.save(path);
+    }
+}
+
+#endif //TARGETPRACTICE_TENSORIO_H
@@ -3,6 +3,7 @@
 //
 
 #include "TensorMath.h"
+#include "Instrumentation.h"
 
 namespace blas {
 
@@ -200,6 +201,9 @@ namespace blas {
             int squeeze_at = t1.dim() == 1 ? -2 : -1;
             out_shape.erase(out_shape.end() + squeeze_at);
         }
+        BLAS_INSTRUMENT("bmm", instrumentation::shapes2str({in1.shape, in2.shape}),
+                        2. * shape2size(out_shape_unsqueezed) * in1.shape.back(),
+                        (double(in1.size) + in2.size + shape2size(out_shape)) * sizeof(T));
         Tensor<T> out(out_shape);
         TensorView<T> out_view = out.view(to_long(out_shape_unsqueezed));
         _unchecked_bmm(in1, in2, out_view);
@@ -226,6 +230,8 @@ namespace blas {
         }
         if (out.shape != out_shape_squeezed)
             throw shape_mismatch(out.shape, out_shape_squeezed);
+        BLAS_INSTRUMENT("bmm", instrumentation::shapes2str({in1.shape, in2.shape}),
+                        2. * out.size * in1.shape.back(), (double(in1.size) + in2.size + out.size) * sizeof(T));
         TensorView<T> out_view = out.view(to_long(out_shape_unsqueezed));
         _unchecked_bmm(in1, in2, out_view);
         return out;
@@ -241,6 +247,9 @@ namespace blas {
         auto in1 = promote(t1, 0);
         auto in2 = promote(t2, 1);
         shape_t out_shape = check_matrix_matrix_mm(in1.shape, in2.shape);
+        BLAS_INSTRUMENT("matmul", instrumentation::shapes2str({in1.shape, in2.shape}),
+                        2. * in1.shape[0] * in1.shape[1] * in2.shape[1],
+                        (double(in1.size) + in2.size + shape2size(out_shape)) * sizeof(T));
         Tensor<T> out(out_shape);
         bool should_squeeze_result = std::min(t1.dim(), t2.dim()) == 1;
         _unchecked_matmul(in1, in2, out);
@@ -269,6 +278,9 @@ namespace blas {
         }
         if (out.shape != out_shape_squeezed)
             throw shape_mismatch(out.shape, out_shape_squeezed);
+        BLAS_INSTRUMENT("matmul", instrumentation::shapes2str({in1.shape, in2.shape}),
+                        2. * in1.shape[0] * in1.shape[1] * in2.shape[1],
+                        (double(in1.size) + in2.size + out.size) * sizeof(T));
         TensorView<T> out_view = out.view(to_long(out_shape_unsqueezed));
         _unchecked_matmul(in1, in2, out_view);
         return out;
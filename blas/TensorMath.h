@@ -6,17 +6,28 @@
 #define TARGETPRACTICE_TENSORMATH_H
 
 #include "all_tensors.h"
+#include "TensorExpression.h"
 
 namespace blas
 {
 
-#define DEF_TENSOR_TENSOR_OP(Tensor1, Tensor2, op)                           \
-    template <typename T>                                                    \
-    inline Tensor<T> operator op(const Tensor1<T> &t1, const Tensor2<T> &t2) \
-    {                                                                        \
-        return t1.apply_tensors(t2, [](T x, T y) -> T { return x op y; });   \
+// The arithmetic operators build lazy expressions (see TensorExpression.h), evaluated in one fused loop.
+// Every tensor operand is either a const & (referred to) or a && (a temporary, moved into the expression).
+#define DEF_TENSOR_TENSOR_OP_REFS(Tensor1, Ref1, Tensor2, Ref2, op)                       \
+    template <typename T>                                                                 \
+    inline auto operator op(Tensor1<T> Ref1 t1, Tensor2<T> Ref2 t2)                       \
+    {                                                                                     \
+        return make_binary_expr<T>([](T x, T y) -> T { return x op y; },                  \
+                                   TensorOperand<T>(static_cast<Tensor1<T> Ref1>(t1)),    \
+                                   TensorOperand<T>(static_cast<Tensor2<T> Ref2>(t2)));   \
     }
 
+#define DEF_TENSOR_TENSOR_OP(Tensor1, Tensor2, op)                                        \
+    DEF_TENSOR_TENSOR_OP_REFS(Tensor1, const &, Tensor2, const &, op)                     \
+    DEF_TENSOR_TENSOR_OP_REFS(Tensor1, const &, Tensor2, &&, op)                          \
+    DEF_TENSOR_TENSOR_OP_REFS(Tensor1, &&, Tensor2, const &, op)                          \
+    DEF_TENSOR_TENSOR_OP_REFS(Tensor1, &&, Tensor2, &&, op)
+
 #define DEF_TENSOR_TENSOR_OP_INPLACE(Tensor1, Tensor2, op)                  \
     template <typename T>                                                   \
     inline Tensor1<T> &operator op(Tensor1<T> &t1, const Tensor2<T> &t2)    \
@@ -24,16 +35,17 @@ namespace blas
         return t1.apply_tensors_(t2, [](T x, T y) -> T { return x op y; }); \
     }
 
+#define DEF_TENSOR_TENSOR_OPS_WITH(Tensor1, op)        \
+    DEF_TENSOR_TENSOR_OP(Tensor1, Tensor, op)          \
+    DEF_TENSOR_TENSOR_OP(Tensor1, TensorView, op)      \
+    DEF_TENSOR_TENSOR_OP(Tensor1, TensorSliced, op)    \
+    DEF_TENSOR_TENSOR_OP(Tensor1, TensorTransposed, op)
+
 #define DEF_TENSOR_TENSOR_INTERACTIVE_OPS(op)          \
-    DEF_TENSOR_TENSOR_OP(Tensor, Tensor, op)           \
-    DEF_TENSOR_TENSOR_OP(Tensor, TensorView, op)       \
-    DEF_TENSOR_TENSOR_OP(Tensor, TensorSliced, op)     \
-    DEF_TENSOR_TENSOR_OP(TensorView, Tensor, op)       \
-    DEF_TENSOR_TENSOR_OP(TensorView, TensorView, op)   \
-    DEF_TENSOR_TENSOR_OP(TensorView, TensorSliced, op) \
-    DEF_TENSOR_TENSOR_OP(TensorSliced, Tensor, op)     \
-    DEF_TENSOR_TENSOR_OP(TensorSliced, TensorView, op) \
-    DEF_TENSOR_TENSOR_OP(TensorSliced, TensorSliced, op)
+    DEF_TENSOR_TENSOR_OPS_WITH(Tensor, op)             \
+    DEF_TENSOR_TENSOR_OPS_WITH(TensorView, op)         \
+    DEF_TENSOR_TENSOR_OPS_WITH(TensorSliced, op)       \
+    DEF_TENSOR_TENSOR_OPS_WITH(TensorTransposed, op)
 
 #define DEF_TENSOR_TENSOR_INTERACTIVE_OPS_INPLACE(op)          \
     DEF_TENSOR_TENSOR_OP_INPLACE(Tensor, Tensor, op)           \
@@ -49,18 +61,26 @@ namespace blas
     MACRO_BASIC_ARITHMETIC_OPERATORS(DEF_TENSOR_TENSOR_INTERACTIVE_OPS)
     MACRO_BASIC_ARITHMETIC_INPLACE_OPERATORS(DEF_TENSOR_TENSOR_INTERACTIVE_OPS_INPLACE)
 
-#define DEF_TENSOR_SCALAR_OP(Tnsr, op)                            \
-    template <typename T>                                         \
-    inline Tensor<T> operator op(const Tnsr<T> &t1, T x)          \
-    {                                                             \
-        return t1.apply(x, [](T x, T y) -> T { return x op y; }); \
-    }                                                             \
-    template <typename T>                                         \
-    inline Tensor<T> operator op(T x, const Tnsr<T> &t1)          \
-    {                                                             \
-        return t1.apply(x, [](T x, T y) -> T { return y op x; }); \
+#define DEF_TENSOR_SCALAR_OP_REF(Tnsr, Ref, op)                                     \
+    template <typename T>                                                           \
+    inline auto operator op(Tnsr<T> Ref t1, T x)                                    \
+    {                                                                               \
+        return make_binary_expr<T>([](T x, T y) -> T { return x op y; },            \
+                                   TensorOperand<T>(static_cast<Tnsr<T> Ref>(t1)),  \
+                                   TensorScalar<T>(x));                             \
+    }                                                                               \
+    template <typename T>                                                           \
+    inline auto operator op(T x, Tnsr<T> Ref t1)                                    \
+    {                                                                               \
+        return make_binary_expr<T>([](T x, T y) -> T { return x op y; },            \
+                                   TensorScalar<T>(x),                              \
+                                   TensorOperand<T>(static_cast<Tnsr<T> Ref>(t1))); \
     }
 
+#define DEF_TENSOR_SCALAR_OP(Tnsr, op)          \
+    DEF_TENSOR_SCALAR_OP_REF(Tnsr, const &, op) \
+    DEF_TENSOR_SCALAR_OP_REF(Tnsr, &&, op)
+
 #define DEF_TENSOR_SCALAR_OP_INPLACE(Tnsr, op)                     \
     template <typename T>                                          \
     inline Tnsr<T> &operator op(Tnsr<T> &t1, T x)                  \
@@ -71,7 +91,8 @@ namespace blas
 #define DEF_TENSOR_SCALAR_INTERACTIVE_OPS(op) \
     DEF_TENSOR_SCALAR_OP(Tensor, op)          \
     DEF_TENSOR_SCALAR_OP(TensorView, op)      \
-    DEF_TENSOR_SCALAR_OP(TensorSliced, op)
+    DEF_TENSOR_SCALAR_OP(TensorSliced, op)    \
+    DEF_TENSOR_SCALAR_OP(TensorTransposed, op)
 
 #define DEF_TENSOR_SCALAR_INTERACTIVE_OPS_INPLACE(op) \
     DEF_TENSOR_SCALAR_OP_INPLACE(Tensor, op)          \
@@ -81,6 +102,69 @@ namespace blas
     MACRO_BASIC_ARITHMETIC_OPERATORS(DEF_TENSOR_SCALAR_INTERACTIVE_OPS)
     MACRO_BASIC_ARITHMETIC_INPLACE_OPERATORS(DEF_TENSOR_SCALAR_INTERACTIVE_OPS_INPLACE)
 
+    // Expressions with tensors, scalars and other expressions.
+#define DEF_EXPR_TENSOR_OP_REF(Tnsr, Ref, op)                                              \
+    template <typename T, class E>                                                        \
+    inline auto operator op(const TensorExpr<T, E> &e, Tnsr<T> Ref t)                     \
+    {                                                                                     \
+        return make_binary_expr<T>([](T x, T y) -> T { return x op y; },                  \
+                                   e.derived(),                                       \
+                                   TensorOperand<T>(static_cast<Tnsr<T> Ref>(t)));    \
+    }                                                                                     \
+    template <typename T, class E>                                                        \
+    inline auto operator op(Tnsr<T> Ref t, const TensorExpr<T, E> &e)                     \
+    {                                                                                     \
+        return make_binary_expr<T>([](T x, T y) -> T { return x op y; },                  \
+                                   TensorOperand<T>(static_cast<Tnsr<T> Ref>(t)),     \
+                                   e.derived());                                      \
+    }
+
+#define DEF_EXPR_TENSOR_OP(Tnsr, op)          \
+    DEF_EXPR_TENSOR_OP_REF(Tnsr, const &, op) \
+    DEF_EXPR_TENSOR_OP_REF(Tnsr, &&, op)
+
+#define DEF_EXPR_INTERACTIVE_OPS(op)                                                      \
+    DEF_EXPR_TENSOR_OP(Tensor, op)                                                        \
+    DEF_EXPR_TENSOR_OP(TensorView, op)                                                    \
+    DEF_EXPR_TENSOR_OP(TensorSliced, op)                                                  \
+    DEF_EXPR_TENSOR_OP(TensorTransposed, op)                                              \
+    template <typename T, class E1, class E2>                                             \
+    inline auto operator op(const TensorExpr<T, E1> &e1, const TensorExpr<T, E2> &e2)     \
+    {                                                                                     \
+        return make_binary_expr<T>([](T x, T y) -> T { return x op y; },                  \
+                                   e1.derived(), e2.derived());                           \
+    }                                                                                     \
+    template <typename T, class E>                                                        \
+    inline auto operator op(const TensorExpr<T, E> &e, T x)                               \
+    {                                                                                     \
+        return make_binary_expr<T>([](T x, T y) -> T { return x op y; },                  \
+                                   e.derived(), TensorScalar<T>(x));                      \
+    }                                                                                     \
+    template <typename T, class E>                                                        \
+    inline auto operator op(T x, const TensorExpr<T, E> &e)                               \
+    {                                                                                     \
+        return make_binary_expr<T>([](T x, T y) -> T { return x op y; },                  \
+                                   TensorScalar<T>(x), e.derived());                      \
+    }
+
+    // t op= expression is evaluated into t in the same fused loop.
+#define DEF_EXPR_OP_INPLACE(Tnsr, op)                                                     \
+    template <typename T, class E>                                                        \
+    inline Tnsr<T> &operator op##=(Tnsr<T> &t, const TensorExpr<T, E> &e)                 \
+    {                                                                                     \
+        return assign_(t, make_binary_expr<T>([](T x, T y) -> T { return x op y; },      \
+                                              TensorOperand<T>(t), e.derived()));         \
+    }
+
+#define DEF_EXPR_INTERACTIVE_OPS_INPLACE(op) \
+    DEF_EXPR_OP_INPLACE(Tensor, op)          \
+    DEF_EXPR_OP_INPLACE(TensorView, op)      \
+    DEF_EXPR_OP_INPLACE(TensorSliced, op)    \
+    DEF_EXPR_OP_INPLACE(TensorTransposed, op)
+
+    MACRO_BASIC_ARITHMETIC_OPERATORS(DEF_EXPR_INTERACTIVE_OPS)
+    MACRO_BASIC_ARITHMETIC_OPERATORS(DEF_EXPR_INTERACTIVE_OPS_INPLACE)
+
 #define MATH_FUNC_TENSOR_INLINE_INTERACTABLE(Tensor1, func)                    \
     template <typename T>                                                      \
     Tensor<T> func(const Tensor1<T> &t) { return t.func(); }                   \
@@ -98,6 +182,12 @@ namespace blas
 
     MACRO_MATH_FUNCTIONS(MATH_FUNC_TENSOR_INLINE)
 
+#define MATH_FUNC_EXPR_INLINE(func)                                            \
+    template <typename T, class E>                                             \
+    Tensor<T> func(const TensorExpr<T, E> &e) { return e.func(); }
+
+    MACRO_MATH_FUNCTIONS(MATH_FUNC_EXPR_INLINE)
+
     template <typename T>
     T mse(const Tensor<T> &in1, const Tensor<T> &in2, T norm_factor = -1)
     {
@@ -10,6 +10,7 @@ template <typename T>
 class TensorSliced : public Tensor<T> {
    private:
     friend class Tensor<T>;
+    friend class TensorOperand<T>;
     shape_t underlying_tensor_shape;
     const size_t underlying_tensor_size;
 
@@ -24,6 +25,7 @@ class TensorSliced : public Tensor<T> {
 
     DECL_INTERACTIVE_ACTION_TENSOR_UNIQUE_OVERRIDE(TensorSliced)
     DEF_COPY_FILL_TEMPLATES(TensorSliced, T)
+    DEF_EXPRESSION_ASSIGNMENT(TensorSliced, T)
 
     template <typename T_>
     struct eliterator {
@@ -12,23 +12,15 @@ class TensorTransposed : public Tensor<T> {
 
    public:
     ~TensorTransposed() override = default;  // doesn't delete data
+    TensorTransposed(const TensorTransposed& other) = default;
+    TensorTransposed(TensorTransposed&& other) noexcept = default;
+    // A view of t - the data isn't copied.
     TensorTransposed(const Tensor<T>& t, const shape_t& permute_indexes)
-        : Tensor<T>::Tensor(t.get_data_ptr(), t.shape), old_strides(t.strides) {
-        size_t new_shape(t.dim());
-        size_t new_strides(t.dim());
-        for (int i = 0; i < t.dim(); ++i) {
-            size_t new_i = permute_indexes[i];
-            this->strides[i] = old_strides[new_i];
-            this->shape[i] = t.shape[new_i];
-        }
-        this->requires_deletion = false;
-        sg_convenience = SliceGroup::cover_shape(this->shape);
-    }
-
-    TensorTransposed(Tensor<T>& t, const shape_t& permute_indexes)
-        : Tensor<T>::Tensor(t.get_data_ptr(), t.shape), old_strides(t.strides) {
-        size_t new_shape(t.dim());
-        size_t new_strides(t.dim());
+        : Tensor<T>::Tensor(), old_strides(t.strides) {
+        this->data = t.get_data_ptr();
+        this->size = t.size;
+        this->shape = t.shape;
+        this->strides = t.strides;
         for (int i = 0; i < t.dim(); ++i) {
             size_t new_i = permute_indexes[i];
             this->strides[i] = old_strides[new_i];
@@ -91,7 +83,7 @@ class TensorTransposed : public Tensor<T> {
                           tt.strides};
     }
     static inline ceiterator const_elem_end(const TensorTransposed& tt) {
-        return ceiterator{tt.data, tt.sg_convenience.begin(), tt.shape,
+        return ceiterator{tt.data, tt.sg_convenience.end(), tt.shape,
                           tt.strides};
     }
     static T& get(TensorTransposed<T>& t, size_t true_idx) {
@@ -114,6 +106,7 @@ class TensorTransposed : public Tensor<T> {
 
     DECL_INTERACTIVE_ACTION_TENSOR_UNIQUE_OVERRIDE(TensorTransposed)
     DEF_COPY_FILL_TEMPLATES(TensorTransposed, T)
+    DEF_EXPRESSION_ASSIGNMENT(TensorTransposed, T)
 
     Tensor<T> contiguous() const override;
     
@@ -18,6 +18,8 @@ class TensorView : public Tensor<T> {
 
    public:
     ~TensorView() override = default;  // Doesn't delete the data.
+    TensorView(const TensorView& other) = default;
+    TensorView(TensorView&& other) noexcept = default;
     using eiterator = T*;
     using ceiterator = const T*;
 
@@ -42,6 +44,7 @@ class TensorView : public Tensor<T> {
 
     DECL_INTERACTIVE_ACTION_TENSOR_UNIQUE_OVERRIDE(TensorView)
     DEF_COPY_FILL_TEMPLATES(TensorView, T)
+    DEF_EXPRESSION_ASSIGNMENT(TensorView, T)
 };
 }
 #endif // BLAS_TENSORVIEW_H_
\ No newline at end of file
@@ -8,6 +8,10 @@
 #include "all_tensors.h"
 #include "TensorMath.h"
 #include "TensorCreation.h"
+#include "TensorIO.h"
+#include "Npy.h"
+#include "Instrumentation.h"
+#include "Memory.h"
 
 #define PI M_PI
 
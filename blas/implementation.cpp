@@ -6,6 +6,8 @@
 #include "TensorView.h"
 #include "TensorSliced.h"
 #include "TensorTransposed.h"
+#include "Instrumentation.h"
+#include "Memory.h"
 
 #include <algorithm>
 #include <iomanip>
@@ -18,8 +20,9 @@
 using std::cout;
 using std::endl;
 
-inline size_t shape2size(const std::vector<size_t>& shape) {
-    return std::accumulate(shape.begin(), shape.end(), 1,
+// Declared in common_blas.h, so it can't be inline.
+size_t shape2size(const std::vector<size_t>& shape) {
+    return std::accumulate(shape.begin(), shape.end(), size_t(1),
                            std::multiplies<size_t>{});
 }
 std::string shape2str(const shape_t& shape) {
@@ -47,7 +50,9 @@ template <typename T>
 Tensor<T>::Tensor() : data(nullptr), size(0) {}
 
 template <typename T>
-Tensor<T>::Tensor(T scalar) : data(new T(scalar)), size(1) {}
+Tensor<T>::Tensor(T scalar) : data(allocate(1)), size(1) {
+    *data = scalar;
+}
 
 template <typename T>
 Tensor<T>::Tensor(std::vector<T> data, const std::vector<size_t>& shape)
@@ -55,7 +60,7 @@ Tensor<T>::Tensor(std::vector<T> data, const std::vector<size_t>& shape)
 
 template <typename T>
 Tensor<T>::Tensor(const Tensor& other)
-    : data(new T[other.size]),
+    : data(allocate(other.size)),
       shape(other.shape),
       size(other.size),
       strides(other.strides) {
@@ -68,9 +73,20 @@ Tensor<T>::Tensor(Tensor&& other) noexcept : Tensor() {
     swap(*this, other);
 }
 
+template <typename T>
+Tensor<T> Tensor<T>::wrap(T* data, const shape_t& shape) {
+    Tensor<T> t;
+    t.data = data;
+    t.shape = shape;
+    t.strides = shape2strides(shape);
+    t.size = shape2size(shape);
+    t.requires_deletion = false;
+    return t;
+}
+
 template <typename T>
 Tensor<T>::~Tensor() {
-    if (requires_deletion) delete[] data;
+    if (requires_deletion) memory::deallocate(data);
 }
 
 template <typename T>
@@ -104,7 +120,7 @@ shape_t shape2strides(const shape_t& shape) {
 template <typename T>
 Tensor<T>::Tensor(T* data, const std::vector<size_t>& shape)
     : size(shape2size(shape)),
-      data(new T[shape2size(shape)]),
+      data(allocate(shape2size(shape))),
       shape(shape),
       strides(shape2strides(shape)) {
     for (int i = 0; i < size; ++i) this->data[i] = data[i];
@@ -116,6 +132,7 @@ Tensor1& copy_(Tensor1& dst, const Tensor2& src) {
     using deiterator = typename Tensor1::eiterator;
     if (dst.shape != src.shape)
         throw shape_mismatch(dst.shape, src.shape, "copy_");
+    BLAS_INSTRUMENT("copy_", shape2str(dst.shape), 0, 2. * dst.size * sizeof(*Tensor1::elem_begin(dst)));
     sceiterator src_it = Tensor2::const_elem_begin(src);
     deiterator dst_it = Tensor1::elem_begin(dst),
                dst_it_end = Tensor1::elem_end(dst);
@@ -362,7 +379,7 @@ shape_t Tensor<T>::slice2shape(const Slice& slice) const {
 template <typename T>
 Tensor<T>::Tensor(const std::vector<size_t>& shape)
     : size(shape2size(shape)),
-      data(new T[shape2size(shape)]),
+      data(allocate(shape2size(shape))),
       shape(shape),
       strides(shape2strides(shape)) {}
 
@@ -614,6 +631,7 @@ T TensorSliced<T>::get(const TensorSliced<T>& ts, size_t true_idx) {
 
 template <typename T>
 Tensor<T> TensorSliced<T>::contiguous() const {
+    BLAS_INSTRUMENT("contiguous", shape2str(this->shape), 0, 2. * this->size * sizeof(T));
     Tensor<T> t(this->shape);
     t.copy_(*this);
     return t;
@@ -621,6 +639,7 @@ Tensor<T> TensorSliced<T>::contiguous() const {
 
 template <typename T>
 Tensor<T> TensorTransposed<T>::contiguous() const {
+    BLAS_INSTRUMENT("contiguous", shape2str(this->shape), 0, 2. * this->size * sizeof(T));
     Tensor<T> t(this->shape);
     t.copy_(*this);
     return t;
@@ -711,6 +730,12 @@ tuple<SliceGroup /*src2*/, SliceGroup /*dst*/> broadcast_index(
             dst_s = Slice(0, dst_d);
         }
     }
+    // Leading dims of src1 that src2 doesn't have - src2 is broadcast along them.
+    for (int i = valid_size; i < src1_shape.size(); ++i) {
+        int dsts_idx = dst_shape.size() - 1 - i;
+        long s1 = src1_idx[src1_shape.size() - 1 - i];
+        sg_dst.slices[dsts_idx] = Slice(s1, s1 + 1);
+    }
 
     size_t filler_size = dst_shape.size() - src1_shape.size();
     for (int i = 0; i < filler_size; ++i) {
@@ -1000,6 +1025,8 @@ template <template <typename> class Tensor1, template <typename> class Tensor2,
           typename T>
 Tensor1<T>& _apply_tensors_(Tensor1<T>& dst, const Tensor2<T>& src,
                             const binary_op<T>& op) {
+    BLAS_INSTRUMENT("apply_tensors_", instrumentation::shapes2str({dst.shape, src.shape}), dst.size,
+                    (2. * dst.size + src.size) * sizeof(T));
     if (dst.shape != src.shape)
         // Maybe broadcasting will work.
         return _apply_broadcast_(dst, src, op);
@@ -1060,6 +1087,8 @@ template <template <typename> class TnsrSrc1,
           typename T>
 void _apply_tensors(const TnsrSrc1<T>& src1, const TnsrSrc2<T>& src2,
                     const binary_op<T>& op, TnsrDst<T>& dst) {
+    BLAS_INSTRUMENT("apply_tensors", instrumentation::shapes2str({src1.shape, src2.shape}), dst.size,
+                    (double(src1.size) + src2.size + dst.size) * sizeof(T));
     if (src1.shape != src2.shape) {
         // Maybe broadcast will help.
         _apply_broadcast(src1, src2, op, dst);
@@ -1133,6 +1162,7 @@ void _apply_broadcast(const TnsrSrc1<T>& src1, const TnsrSrc2<T>& src2,
 
 template <template <typename> class Tnsr, typename T>
 Tnsr<T>& _apply_unary_(Tnsr<T>& dst, const unary_op<T>& op) {
+    BLAS_INSTRUMENT("apply_unary_", shape2str(dst.shape), dst.size, 2. * dst.size * sizeof(T));
     auto it = Tnsr<T>::elem_begin(dst), it_end = Tnsr<T>::elem_end(dst);
     for (; it != it_end; ++it) {
         auto& x = *it;
@@ -1143,6 +1173,7 @@ Tnsr<T>& _apply_unary_(Tnsr<T>& dst, const unary_op<T>& op) {
 
 template <template <typename> class Tnsr, typename T>
 Tnsr<T>& _apply_scalar_(Tnsr<T>& dst, T scalar, const binary_op<T>& op) {
+    BLAS_INSTRUMENT("apply_scalar_", shape2str(dst.shape), dst.size, 2. * dst.size * sizeof(T));
     auto it = Tnsr<T>::elem_begin(dst), it_end = Tnsr<T>::elem_end(dst);
     for (; it != it_end; ++it) {
         auto& x = *it;
@@ -1155,6 +1186,7 @@ template <template <typename> class TnsrSrc, template <typename> class TnsrDst,
           typename T>
 void _apply_unary(const TnsrSrc<T>& src, const unary_op<T>& op,
                   TnsrDst<T>& dst) {
+    BLAS_INSTRUMENT("apply_unary", shape2str(src.shape), src.size, 2. * src.size * sizeof(T));
     using src_it_t = typename TnsrSrc<T>::ceiterator;
     using dst_it_t = typename TnsrDst<T>::eiterator;
     src_it_t src_it = TnsrSrc<T>::const_elem_begin(src),
@@ -1171,6 +1203,7 @@ template <template <typename> class TnsrSrc, template <typename> class TnsrDst,
           typename T>
 void _apply_scalar(const TnsrSrc<T>& src, T scalar, const binary_op<T>& op,
                    TnsrDst<T>& dst) {
+    BLAS_INSTRUMENT("apply_scalar", shape2str(src.shape), src.size, 2. * src.size * sizeof(T));
     using src_it_t = typename TnsrSrc<T>::ceiterator;
     using dst_it_t = typename TnsrDst<T>::eiterator;
     src_it_t src_it = TnsrSrc<T>::const_elem_begin(src),
@@ -1378,6 +1411,8 @@ template <template <typename> class TensorIn,
           template <typename> class TensorOut, typename T>
 void _reduce(const binary_op<T>& op, const TensorIn<T>& input,
              TensorOut<T>& output) {
+    BLAS_INSTRUMENT("reduce", instrumentation::shapes2str({input.shape, output.shape}), input.size,
+                    (double(input.size) + output.size) * sizeof(T));
     T result = TensorIn<T>::get(input, 0);
     auto iter = TensorIn<T>::const_elem_begin(input);
     // Move to second place:
@@ -1398,6 +1433,8 @@ template <template <typename> class TensorIn,
           template <typename> class TensorOut, typename T>
 void _reduce(const binary_op<T>& op, vector<int> dims, const TensorIn<T>& input,
              TensorOut<T>& output) {
+    BLAS_INSTRUMENT("reduce", instrumentation::shapes2str({input.shape, output.shape}), input.size,
+                    (double(input.size) + output.size) * sizeof(T));
     SliceGroup index_sg =
         SliceGroup::cover_shape(input.shape);     // indexer for input_trick
     SliceGroup conjugate_sg(input.shape.size());  // indexer for index_sg
@@ -24,7 +24,7 @@ template<typename T>
 inline T dsigmoid(T x)
 {
     T sig = sigmoid(x);
-    return x * (1. - x);
+    return sig * (1. - sig);
 }
 
 template<typename T>
@@ -91,7 +91,7 @@ namespace common_math {
 
         MACRO_MATH_FUNCTIONS(DEF_STATIC_UNARY_FUNC)
 
-        static pair<unary_op<T>, unary_op<T>> get_function_data(std::string func_name) {
+        static const pair<unary_op<T>, unary_op<T>>& get_function_data(const std::string& func_name) {
             using namespace std;
             static const T ln2 = unary_func_data::log(2);
             static const T ln10 = unary_func_data::log(10);
@@ -147,7 +147,7 @@ namespace common_math {
 
         static inline T pow(T x, T y) { return ::pow(x, y); }
 
-        static tuple<binary_op<T>, jac_binary_op<T>, jac_binary_op<T>> get_function_data(const std::string& func_name) {
+        static const tuple<binary_op<T>, jac_binary_op<T>, jac_binary_op<T>>& get_function_data(const std::string& func_name) {
             using u = unary_func_data<T>;
             static const std::unordered_map<std::string,
                          tuple<binary_op<T>, jac_binary_op<T>, jac_binary_op<T>>>
@@ -0,0 +1,314 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Checkpointer.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <unordered_set>
+
+namespace nn {
+
+    static const string checkpoint_prefix = "checkpoint-";
+    static const string checkpoint_suffix = ".tpt";
+
+    // A fast 64 bit hash (FNV-1a over 8 byte words) - only used to tell whether a tensor changed.
+    static uint64_t hash_bytes(const char *data, size_t size) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, data + i, sizeof(uint64_t));
+            hash = (hash ^ word) * 0x100000001b3ull;
+            hash ^= hash >> 29;
+        }
+        for (; i < size; ++i)
+            hash = (hash ^ uint8_t(data[i])) * 0x100000001b3ull;
+        return hash;
+    }
+
+    template<typename T>
+    Checkpointer<T>::Checkpointer(Module<T>& module, Optimizer<T> *optimizer, const string& directory,
+                                  CheckpointerOptions options) :
+            module(module), optimizer(optimizer), directory(directory), options(options),
+            num_state_buffers(optimizer ? optimizer->num_state_buffers() : 0) {
+        if (options.full_every == 0)
+            throw std::invalid_argument("full_every must be positive.");
+        std::filesystem::create_directories(directory);
+        const T *flat_ptr = module.flat_parameters().get_data_ptr();
+        size_t snapshot_size = 0;
+        for (const auto& named_param: module.named_parameters()) {
+            const Tensor<T>& data = named_param.second.data();
+            size_t flat_offset = data.get_data_ptr() - flat_ptr;
+            entries.push_back({"param/" + named_param.first, data.shape, false, flat_offset, data.size, snapshot_size});
+            snapshot_size += data.size;
+        }
+        if (num_state_buffers > 0) {
+            size_t num_params = entries.size();
+            for (size_t i = 0; i < num_params; ++i) {
+                Entry state_entry = entries[i];
+                state_entry.name = "state/" + state_entry.name.substr(string("param/").size());
+                state_entry.shape.insert(state_entry.shape.begin(), num_state_buffers);
+                state_entry.is_state = true;
+                state_entry.snapshot_offset = snapshot_size;
+                snapshot_size += num_state_buffers * state_entry.size;
+                entries.push_back(std::move(state_entry));
+            }
+        }
+        for (Snapshot& snapshot: snapshots)
+            snapshot.values = Tensor<T>(shape_t{snapshot_size});
+    }
+
+    template<typename T>
+    Checkpointer<T>::~Checkpointer() {
+        try {
+            wait();
+        } catch (const std::exception& e) {
+            cerr << "A checkpoint write failed: " << e.what() << endl;
+        }
+    }
+
+    template<typename T>
+    string Checkpointer<T>::path_of(size_t id) const {
+        return directory + "/" + checkpoint_prefix + std::to_string(id) + checkpoint_suffix;
+    }
+
+    template<typename T>
+    void Checkpointer<T>::take_snapshot(Snapshot& snapshot, size_t id) {
+        snapshot.id = id;
+        const T *params = module.flat_parameters().get_data_ptr();
+        size_t num_params = module.num_parameters();
+        const T *state = nullptr;
+        if (optimizer) {
+            snapshot.steps = optimizer->num_steps();
+            // The state is allocated by the first step, before it the state is all zeros.
+            if (optimizer->get_state().shape == shape_t{num_state_buffers, num_params})
+                state = optimizer->get_state().get_data_ptr();
+        }
+        T *values = snapshot.values.get_data_ptr();
+        for (const Entry& entry: entries) {
+            T *dst = values + entry.snapshot_offset;
+            if (!entry.is_state) {
+                std::memcpy(dst, params + entry.flat_offset, entry.size * sizeof(T));
+                continue;
+            }
+            for (size_t b = 0; b < num_state_buffers; ++b, dst += entry.size) {
+                if (state)
+                    std::memcpy(dst, state + b * num_params + entry.flat_offset, entry.size * sizeof(T));
+                else
+                    std::fill(dst, dst + entry.size, T(0));
+            }
+        }
+    }
+
+    template<typename T>
+    void Checkpointer<T>::write_snapshot(const Snapshot& snapshot) {
+        try {
+            bool full = !options.incremental || last_saved_id < 0 || saves_since_full + 1 >= options.full_every ||
+                        std::find(chain_ids.begin(), chain_ids.end(), snapshot.id) != chain_ids.end();
+            blas::TensorArchiveWriter writer;
+            vector<Tensor<T>> views;
+            views.reserve(entries.size());
+            std::unordered_map<string, uint64_t> hashes;
+            T *values = snapshot.values.get_data_ptr();
+            for (const Entry& entry: entries) {
+                views.push_back(Tensor<T>::wrap(values + entry.snapshot_offset, entry.shape));
+                if (options.incremental) {
+                    uint64_t hash = hash_bytes(reinterpret_cast<const char *>(views.back().get_data_ptr()),
+                                               views.back().size * sizeof(T));
+                    hashes[entry.name] = hash;
+                    auto it = saved_hashes.find(entry.name);
+                    if (!full && it != saved_hashes.end() && it->second == hash)
+                        continue;
+                }
+                writer.add(entry.name, views.back());
+            }
+            Tensor<long> id(vector<long>{long(snapshot.id)}, {1});
+            Tensor<long> parent(vector<long>{full ? -1 : last_saved_id}, {1});
+            Tensor<long> steps(vector<long>{snapshot.steps}, {1});
+            writer.add("checkpoint/id", id).add("checkpoint/parent", parent).add("optimizer/steps", steps);
+            // The archives that continue the one being overwritten belong to another timeline now.
+            if (std::filesystem::exists(path_of(snapshot.id)))
+                remove_descendants(snapshot.id);
+            writer.save(path_of(snapshot.id));
+            saved_hashes = std::move(hashes);
+            last_saved_id = long(snapshot.id);
+            saves_since_full = full ? 0 : saves_since_full + 1;
+            if (full)
+                chain_ids.clear();
+            chain_ids.push_back(snapshot.id);
+        } catch (...) {
+            // The chain is broken, the next save is a full one.
+            saved_hashes.clear();
+            last_saved_id = -1;
+            chain_ids.clear();
+            throw;
+        }
+    }
+
+    template<typename T>
+    void Checkpointer<T>::save_async(size_t id) {
+        Snapshot& snapshot = snapshots[next_snapshot];
+        next_snapshot = 1 - next_snapshot;
+        // The snapshot buffer is still being written.
+        if (snapshot.write.valid()) {
+            auto write = std::move(snapshot.write);
+            snapshot.write = {};
+            write.get();
+        }
+        take_snapshot(snapshot, id);
+        snapshot.write = std::async(std::launch::async, [this, &snapshot, previous = last_write]() {
+            if (previous.valid())
+                previous.wait();
+            write_snapshot(snapshot);
+        }).share();
+        last_write = snapshot.write;
+    }
+
+    template<typename T>
+    void Checkpointer<T>::save(size_t id) {
+        save_async(id);
+        wait();
+    }
+
+    template<typename T>
+    void Checkpointer<T>::wait() {
+        std::exception_ptr error;
+        // The older write first, so the first error is the first one that happened.
+        for (size_t i = 0; i < 2; ++i) {
+            Snapshot& snapshot = snapshots[(next_snapshot + i) % 2];
+            if (!snapshot.write.valid())
+                continue;
+            auto write = std::move(snapshot.write);
+            snapshot.write = {};
+            try {
+                write.get();
+            } catch (...) {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        last_write = {};
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    template<typename T>
+    void Checkpointer<T>::restore(size_t id) {
+        wait();
+        // The chain of archives, from the newest - each tensor is read from the newest archive that has it.
+        vector<std::unique_ptr<blas::MappedTensorArchive>> chain;
+        chain.emplace_back(new blas::MappedTensorArchive(path_of(id)));
+        std::unordered_set<long> visited{long(id)};
+        long parent = chain.back()->get<long>("checkpoint/parent").item();
+        while (parent >= 0) {
+            if (!visited.insert(parent).second)
+                throw std::runtime_error("The chain of checkpoint " + std::to_string(id) +
+                                         " has a cycle at checkpoint " + std::to_string(parent) + ".");
+            chain.emplace_back(new blas::MappedTensorArchive(path_of(parent)));
+            parent = chain.back()->get<long>("checkpoint/parent").item();
+        }
+        auto find = [&](const string& name) -> const blas::MappedTensorArchive * {
+            for (const auto& archive: chain)
+                if (archive->contains(name))
+                    return archive.get();
+            return nullptr;
+        };
+
+        T *params = module.flat_parameters().get_data_ptr();
+        size_t num_params = module.num_parameters();
+        Tensor<T> state;
+        bool has_state = false;
+        for (const Entry& entry: entries) {
+            const blas::MappedTensorArchive *archive = find(entry.name);
+            if (archive == nullptr) {
+                if (entry.is_state)
+                    continue;
+                throw std::runtime_error("Checkpoint " + std::to_string(id) + " has no '" + entry.name + "'.");
+            }
+            Tensor<T> saved = archive->get<T>(entry.name);
+            if (saved.shape != entry.shape)
+                throw std::runtime_error("'" + entry.name + "' was saved with shape " + shape2str(saved.shape) +
+                                         ", expected " + shape2str(entry.shape) + ".");
+            if (!entry.is_state) {
+                std::memcpy(params + entry.flat_offset, saved.get_data_ptr(), entry.size * sizeof(T));
+                continue;
+            }
+            if (!has_state) {
+                state = blas::zeros<T>({num_state_buffers, num_params});
+                has_state = true;
+            }
+            for (size_t b = 0; b < num_state_buffers; ++b)
+                std::memcpy(state.get_data_ptr() + b * num_params + entry.flat_offset,
+                            saved.get_data_ptr() + b * entry.size, entry.size * sizeof(T));
+        }
+        if (optimizer) {
+            if (num_state_buffers > 0 && !has_state)
+                throw std::runtime_error("Checkpoint " + std::to_string(id) + " has no optimizer state.");
+            size_t steps = chain.front()->get<long>("optimizer/steps").item();
+            if (has_state)
+                optimizer->set_state(state, steps);
+            else
+                optimizer->set_state(Tensor<T>(shape_t{0, num_params}), steps);
+        }
+        // The next incremental save continues the chain of the restored checkpoint from scratch.
+        saved_hashes.clear();
+        last_saved_id = -1;
+        chain_ids.clear();
+    }
+
+    template<typename T>
+    std::optional<size_t> Checkpointer<T>::latest() const {
+        std::optional<size_t> result;
+        for (size_t id: archive_ids())
+            if (!result || id > *result)
+                result = id;
+        return result;
+    }
+
+    template<typename T>
+    vector<size_t> Checkpointer<T>::archive_ids() const {
+        vector<size_t> ids;
+        for (const auto& file: std::filesystem::directory_iterator(directory)) {
+            string name = file.path().filename().string();
+            if (name.size() <= checkpoint_prefix.size() + checkpoint_suffix.size() ||
+                name.compare(0, checkpoint_prefix.size(), checkpoint_prefix) != 0 ||
+                name.compare(name.size() - checkpoint_suffix.size(), checkpoint_suffix.size(), checkpoint_suffix) != 0)
+                continue;
+            string digits = name.substr(checkpoint_prefix.size(),
+                                        name.size() - checkpoint_prefix.size() - checkpoint_suffix.size());
+            if (digits.find_first_not_of("0123456789") != string::npos)
+                continue;
+            ids.push_back(std::stoul(digits));
+        }
+        return ids;
+    }
+
+    template<typename T>
+    void Checkpointer<T>::remove_descendants(size_t id) {
+        std::unordered_map<long, vector<size_t>> children;
+        for (size_t archive_id: archive_ids()) {
+            blas::MappedTensorArchive archive(path_of(archive_id));
+            if (archive.contains("checkpoint/parent"))
+                children[archive.get<long>("checkpoint/parent").item()].push_back(archive_id);
+        }
+        vector<size_t> pending{id};
+        std::unordered_set<size_t> removed{id};
+        while (!pending.empty()) {
+            size_t parent = pending.back();
+            pending.pop_back();
+            for (size_t child: children[long(parent)])
+                if (removed.insert(child).second) {
+                    std::filesystem::remove(path_of(child));
+                    pending.push_back(child);
+                }
+        }
+    }
+
+#define INSTANTIATE_CHECKPOINTER(dtype) \
+    template class Checkpointer<dtype>;
+
+    INSTANTIATE_CHECKPOINTER(double)
+    INSTANTIATE_CHECKPOINTER(float)
+}
@@ -0,0 +1,118 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_CHECKPOINTER_H
+#define TARGETPRACTICE_CHECKPOINTER_H
+
+#include <future>
+#include <optional>
+#include <unordered_map>
+#include "Optimizer.h"
+
+namespace nn {
+
+    struct CheckpointerOptions {
+        // Only the tensors that changed since the previous save are written, the others are
+        // read from the earlier checkpoints of the chain on restore.
+        bool incremental = false;
+        // With incremental saves, every full_every-th save is a full one, which bounds the
+        // number of files a restore reads.
+        size_t full_every = 8;
+    };
+
+    /**
+     * Saves and restores the parameters of a module and the state of its optimizer, as tensor
+     * archives named "checkpoint-<id>.tpt" in a directory.
+     * A save copies the flat buffers into one of two snapshot buffers on the calling thread, and
+     * the archive is written from the snapshot in the background, so training continues while it's
+     * written. Writes are done one at a time, in the order of the saves.
+     * An archive holds "param/<name>" for every named parameter, "state/<name>" (of shape
+     * (num_state_buffers, *shape)) if the optimizer has state, and the longs "checkpoint/id",
+     * "checkpoint/parent" (the previous checkpoint of an incremental chain, or -1) and "optimizer/steps".
+     * Overwriting a checkpoint deletes the archives that were saved on top of it (e.g. saving 2 again
+     * after restoring 1 deletes 3, if it was an increment of 2), so no chain mixes two timelines.
+     * @note The structure of the module must not change after the checkpointer is created.
+     */
+    template<typename T>
+    class Checkpointer {
+    public:
+        Checkpointer(Module<T>& module, Optimizer<T> *optimizer, const string& directory,
+                     CheckpointerOptions options = {});
+
+        Checkpointer(const Checkpointer&) = delete;
+
+        Checkpointer& operator=(const Checkpointer&) = delete;
+
+        // Waits for the pending writes.
+        ~Checkpointer();
+
+        // Snapshots the module and writes the checkpoint in the background. Only blocks if both
+        // snapshot buffers are still being written.
+        void save_async(size_t id);
+
+        // Snapshots the module and writes the checkpoint, returns once it's on disk.
+        void save(size_t id);
+
+        // Waits for the pending writes, rethrowing the first error any of them had.
+        void wait();
+
+        // Loads the parameters (and the optimizer state) of checkpoint id, following its chain.
+        void restore(size_t id);
+
+        // The newest checkpoint in the directory, if there is one.
+        std::optional<size_t> latest() const;
+
+        string path_of(size_t id) const;
+
+    private:
+        struct Entry {
+            string name;
+            shape_t shape;
+            bool is_state;
+            // The offset of the parameter in the flat buffers, and its size.
+            size_t flat_offset;
+            size_t size;
+            // The offset of the tensor in a snapshot.
+            size_t snapshot_offset;
+        };
+
+        struct Snapshot {
+            size_t id = 0;
+            long steps = 0;
+            // All the tensors of the entries, one after the other.
+            Tensor<T> values;
+            std::shared_future<void> write;
+        };
+
+        Module<T>& module;
+        Optimizer<T> *optimizer;
+        string directory;
+        CheckpointerOptions options;
+        size_t num_state_buffers;
+        vector<Entry> entries;
+        Snapshot snapshots[2];
+        size_t next_snapshot = 0;
+        std::shared_future<void> last_write;
+
+        // Only used by the writes (which are serialized) and by restore (after waiting for them).
+        std::unordered_map<string, uint64_t> saved_hashes;
+        long last_saved_id = -1;
+        size_t saves_since_full = 0;
+        // The ids of the archives of the current chain, from its full save - overwriting one of them
+        // would drop tensors the later archives of the chain rely on (or make the chain a cycle).
+        vector<size_t> chain_ids;
+
+        void take_snapshot(Snapshot& snapshot, size_t id);
+
+        void write_snapshot(const Snapshot& snapshot);
+
+        // The ids of all the archives in the directory.
+        vector<size_t> archive_ids() const;
+
+        // Deletes the archives whose chain goes through checkpoint id (not id itself).
+        void remove_descendants(size_t id);
+    };
+}
+
+#endif //TARGETPRACTICE_CHECKPOINTER_H
@@ -0,0 +1,248 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "DataLoader.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <random>
+
+namespace nn {
+
+    static inline shape_t sample_shape(const shape_t& shape) {
+        if (shape.empty())
+            throw std::invalid_argument("The samples of a tensor are along its first dimension, "
+                                        "it can't be a scalar.");
+        return shape_t(shape.begin() + 1, shape.end());
+    }
+
+    template<typename T>
+    TensorSource<T>::TensorSource(Tensor<T> inputs) :
+            DataSource<T>(sample_shape(inputs.shape), std::nullopt), inputs(std::move(inputs)) {}
+
+    template<typename T>
+    TensorSource<T>::TensorSource(Tensor<T> inputs, Tensor<T> targets) :
+            DataSource<T>(sample_shape(inputs.shape), sample_shape(targets.shape)),
+            inputs(std::move(inputs)), targets(std::move(targets)) {
+        if (this->inputs.shape[0] != this->targets.shape[0])
+            throw std::invalid_argument("The inputs and the targets must have the same number of samples, got " +
+                                        shape2str(this->inputs.shape) + " and " + shape2str(this->targets.shape));
+    }
+
+    template<typename T>
+    void TensorSource<T>::get(size_t index, T *input, T *target) const {
+        size_t input_size = inputs.size / inputs.shape[0];
+        const T *input_ptr = inputs.get_data_ptr() + index * input_size;
+        std::copy(input_ptr, input_ptr + input_size, input);
+        if (this->has_targets()) {
+            size_t target_size = targets.size / targets.shape[0];
+            const T *target_ptr = targets.get_data_ptr() + index * target_size;
+            std::copy(target_ptr, target_ptr + target_size, target);
+        }
+    }
+
+    template<typename T>
+    MappedFileSource<T>::MappedFileSource(const string& path, const shape_t& input_shape,
+                                          const std::optional<shape_t>& target_shape, size_t offset) :
+            DataSource<T>(input_shape, target_shape), file(path), input_size(shape2size(input_shape)),
+            target_size(target_shape ? shape2size(*target_shape) : 0), offset(offset) {
+        size_t record_bytes = (input_size + target_size) * sizeof(T);
+        if (offset > file.size() || (file.size() - offset) % record_bytes != 0)
+            throw std::invalid_argument("'" + path + "' isn't a whole number of records of " +
+                                        to_string(record_bytes) + " bytes after offset " + to_string(offset) + ".");
+        num_samples = (file.size() - offset) / record_bytes;
+    }
+
+    template<typename T>
+    void MappedFileSource<T>::get(size_t index, T *input, T *target) const {
+        // The offset may not be aligned to T, so the records are copied bytewise.
+        const char *record = file.data() + offset + index * (input_size + target_size) * sizeof(T);
+        std::memcpy(input, record, input_size * sizeof(T));
+        if (this->has_targets())
+            std::memcpy(target, record + input_size * sizeof(T), target_size * sizeof(T));
+    }
+
+    template<typename T>
+    DataLoader<T>::DataLoader(shared_ptr<DataSource<T>> source, DataLoaderOptions options) :
+            source(std::move(source)), options(options),
+            input_size(shape2size(this->source->input_shape())),
+            target_size(this->source->has_targets() ? shape2size(this->source->target_shape()) : 0),
+            slots(options.prefetch + 1) {
+        if (options.batch_size == 0)
+            throw std::invalid_argument("The batch size must be positive.");
+        order.resize(this->source->size());
+        std::iota(order.begin(), order.end(), 0);
+        for (size_t i = 0; i < options.num_workers; ++i)
+            workers.emplace_back(&DataLoader::worker_loop, this);
+    }
+
+    template<typename T>
+    DataLoader<T>::~DataLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        worker_cv.notify_all();
+        for (auto& worker: workers)
+            worker.join();
+    }
+
+    template<typename T>
+    size_t DataLoader<T>::num_batches() const {
+        size_t num_samples = source->size();
+        return options.drop_last ? num_samples / options.batch_size
+                                 : (num_samples + options.batch_size - 1) / options.batch_size;
+    }
+
+    template<typename T>
+    void DataLoader<T>::start_epoch() {
+        std::unique_lock<std::mutex> lock(mutex);
+        // Stop handing out batches of the current epoch, and wait for the ones in progress.
+        end_of_epoch = 0;
+        consumer_cv.wait(lock, [&] { return busy_workers == 0; });
+        if (options.shuffle) {
+            std::mt19937 generator(options.seed + epoch);
+            std::shuffle(order.begin(), order.end(), generator);
+        }
+        for (auto& slot: slots)
+            slot.ready = false;
+        next_to_fill = next_to_consume = 0;
+        end_of_epoch = num_batches();
+        epoch++;
+        started = true;
+        lock.unlock();
+        worker_cv.notify_all();
+    }
+
+    template<typename T>
+    void DataLoader<T>::collate(size_t index, Batch& batch) const {
+        size_t begin = index * options.batch_size;
+        size_t rows = std::min(options.batch_size, order.size() - begin);
+        shape_t inputs_shape{rows}, targets_shape{rows};
+        inputs_shape.insert(inputs_shape.end(), source->input_shape().begin(), source->input_shape().end());
+        targets_shape.insert(targets_shape.end(), source->target_shape().begin(), source->target_shape().end());
+        // The buffers are reused, only the first batches (and a smaller last batch) allocate.
+        if (batch.inputs.shape != inputs_shape)
+            batch.inputs = Tensor<T>(inputs_shape);
+        if (source->has_targets() && batch.targets.shape != targets_shape)
+            batch.targets = Tensor<T>(targets_shape);
+        T *inputs_ptr = batch.inputs.get_data_ptr();
+        T *targets_ptr = source->has_targets() ? batch.targets.get_data_ptr() : nullptr;
+        for (size_t i = 0; i < rows; ++i)
+            source->get(order[begin + i], inputs_ptr + i * input_size,
+                        targets_ptr ? targets_ptr + i * target_size : nullptr);
+    }
+
+    template<typename T>
+    void DataLoader<T>::worker_loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            // A slot is free once the batch that used it before was consumed.
+            worker_cv.wait(lock, [&] {
+                return stopping || (next_to_fill < end_of_epoch && next_to_fill < next_to_consume + slots.size());
+            });
+            if (stopping)
+                return;
+            size_t index = next_to_fill++;
+            Slot& slot = slots[index % slots.size()];
+            busy_workers++;
+            lock.unlock();
+            collate(index, slot.batch);
+            lock.lock();
+            busy_workers--;
+            slot.index = index;
+            slot.ready = true;
+            consumer_cv.notify_all();
+        }
+    }
+
+    template<typename T>
+    typename DataLoader<T>::Slot *DataLoader<T>::take() {
+        if (!started)
+            throw std::logic_error("DataLoader::start_epoch() must be called before taking batches.");
+        std::unique_lock<std::mutex> lock(mutex);
+        if (next_to_consume >= end_of_epoch)
+            return nullptr;
+        Slot& slot = slots[next_to_consume % slots.size()];
+        if (workers.empty()) {
+            // Without workers - collate on the calling thread.
+            collate(next_to_consume, slot.batch);
+            return &slot;
+        }
+        consumer_cv.wait(lock, [&] { return slot.ready && slot.index == next_to_consume; });
+        return &slot;
+    }
+
+    template<typename T>
+    void DataLoader<T>::release(Slot *slot) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot->ready = false;
+            next_to_consume++;
+        }
+        worker_cv.notify_all();
+    }
+
+    template<typename T>
+    bool DataLoader<T>::next(Batch& batch) {
+        Slot *slot = take();
+        if (!slot)
+            return false;
+        swap(batch.inputs, slot->batch.inputs);
+        swap(batch.targets, slot->batch.targets);
+        release(slot);
+        return true;
+    }
+
+    template<typename T>
+    void DataLoader<T>::swap_into(const Variable<T>& buffer, Tensor<T>& data) const {
+        auto input_buffer = dynamic_cast<autograd::InputBuffer<T> *>(buffer.get());
+        if (input_buffer == nullptr)
+            throw std::invalid_argument("Batches can only be swapped into input buffers, '" +
+                                        buffer->get_name() + "' isn't one.");
+        input_buffer->swap_data(data);
+    }
+
+    template<typename T>
+    bool DataLoader<T>::next(const Variable<T>& inputs, const Variable<T>& targets) {
+        if (!source->has_targets())
+            throw std::logic_error("The source of the data loader has no targets.");
+        Slot *slot = take();
+        if (!slot)
+            return false;
+        // Release the slot even if the shapes don't match.
+        try {
+            swap_into(inputs, slot->batch.inputs);
+            swap_into(targets, slot->batch.targets);
+        } catch (...) {
+            release(slot);
+            throw;
+        }
+        release(slot);
+        return true;
+    }
+
+    template<typename T>
+    bool DataLoader<T>::next(const Variable<T>& inputs) {
+        Slot *slot = take();
+        if (!slot)
+            return false;
+        try {
+            swap_into(inputs, slot->batch.inputs);
+        } catch (...) {
+            release(slot);
+            throw;
+        }
+        release(slot);
+        return true;
+    }
+
+#define INSTANTIATE_DATA_LOADER(dtype)      \
+    template class TensorSource<dtype>;     \
+    template class MappedFileSource<dtype>; \
+    template class DataLoader<dtype>;
+
+    INSTANTIATE_DATA_LOADER(double)
+    INSTANTIATE_DATA_LOADER(float)
+}
@@ -0,0 +1,201 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_DATALOADER_H
+#define TARGETPRACTICE_DATALOADER_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include "../autograd/autograd.h"
+#include "utils/MappedFile.h"
+
+namespace nn {
+    using autograd::Variable;
+
+    /**
+     * A dataset of samples, each one an input and an optional target.
+     * @note get() is called concurrently from the workers of a DataLoader.
+     */
+    template<typename T>
+    class DataSource {
+    public:
+        DataSource(shape_t input_shape, std::optional<shape_t> target_shape) :
+                sample_input_shape(std::move(input_shape)), with_targets(target_shape.has_value()),
+                sample_target_shape(target_shape.value_or(shape_t{})) {}
+
+        virtual ~DataSource() = default;
+
+        // The number of samples.
+        virtual size_t size() const = 0;
+
+        // Copies sample 'index' into input and target (unused without targets).
+        virtual void get(size_t index, T *input, T *target) const = 0;
+
+        // The shape of a single input.
+        inline const shape_t& input_shape() const { return sample_input_shape; }
+
+        // The shape of a single target.
+        inline const shape_t& target_shape() const { return sample_target_shape; }
+
+        inline bool has_targets() const { return with_targets; }
+
+    private:
+        shape_t sample_input_shape;
+        bool with_targets;
+        shape_t sample_target_shape;
+    };
+
+    // Samples are the rows (along the first dimension) of tensors in memory.
+    template<typename T>
+    class TensorSource : public DataSource<T> {
+    public:
+        explicit TensorSource(Tensor<T> inputs);
+
+        TensorSource(Tensor<T> inputs, Tensor<T> targets);
+
+        inline size_t size() const override { return inputs.shape[0]; }
+
+        void get(size_t index, T *input, T *target) const override;
+
+    private:
+        Tensor<T> inputs, targets;
+    };
+
+    /**
+     * Samples stored in a raw binary file of records, each record an input followed by its target,
+     * starting at a byte offset. The file is memory mapped, so only the pages of the samples
+     * that were read are loaded.
+     */
+    template<typename T>
+    class MappedFileSource : public DataSource<T> {
+    public:
+        MappedFileSource(const string& path, const shape_t& input_shape,
+                         const std::optional<shape_t>& target_shape = std::nullopt, size_t offset = 0);
+
+        inline size_t size() const override { return num_samples; }
+
+        void get(size_t index, T *input, T *target) const override;
+
+    private:
+        MappedFile file;
+        size_t input_size, target_size, offset, num_samples;
+    };
+
+    // Samples generated on demand by a (thread safe) function.
+    template<typename T>
+    class GeneratorSource : public DataSource<T> {
+    public:
+        using generator_t = std::function<void(size_t index, T *input, T *target)>;
+
+        GeneratorSource(size_t num_samples, const shape_t& input_shape, const std::optional<shape_t>& target_shape,
+                        generator_t generator) :
+                DataSource<T>(input_shape, target_shape), num_samples(num_samples), generator(std::move(generator)) {}
+
+        inline size_t size() const override { return num_samples; }
+
+        inline void get(size_t index, T *input, T *target) const override { generator(index, input, target); }
+
+    private:
+        size_t num_samples;
+        generator_t generator;
+    };
+
+    struct DataLoaderOptions {
+        size_t batch_size = 32;
+        bool shuffle = true;
+        // Drops the last batch of an epoch if it is smaller than batch_size.
+        bool drop_last = false;
+        // Background threads that collate batches, 0 collates on the calling thread.
+        size_t num_workers = 1;
+        // The number of batches collated ahead of the one being consumed.
+        size_t prefetch = 2;
+        unsigned seed = 0;
+    };
+
+    /**
+     * Collates the samples of a source into batches (shuffled every epoch), on background workers.
+     * Batches are collated into a ring of prefetch + 1 buffers. Taking a batch swaps its buffer with
+     * the tensor of the consumer (e.g. the data of an InputBuffer), so nothing is copied, and the
+     * previous tensor of the consumer is reused to collate a later batch.
+     * @tparam T the data type.
+     */
+    template<typename T>
+    class DataLoader {
+    public:
+        struct Batch {
+            Tensor<T> inputs, targets;
+        };
+
+        DataLoader(shared_ptr<DataSource<T>> source, DataLoaderOptions options = {});
+
+        DataLoader(const DataLoader&) = delete;
+
+        DataLoader& operator=(const DataLoader&) = delete;
+
+        ~DataLoader();
+
+        // The number of batches in an epoch.
+        size_t num_batches() const;
+
+        // Starts a new epoch (reshuffled), dropping the batches left of the current one.
+        void start_epoch();
+
+        /**
+         * Swaps the next batch of the epoch into batch.
+         * @return false at the end of the epoch.
+         */
+        bool next(Batch& batch);
+
+        /**
+         * Swaps the next batch of the epoch into the data of input buffers, whose shapes must
+         * match the batch (so a smaller last batch requires drop_last).
+         * @return false at the end of the epoch.
+         */
+        bool next(const Variable<T>& inputs, const Variable<T>& targets);
+
+        // Same, for a source without targets.
+        bool next(const Variable<T>& inputs);
+
+    private:
+        struct Slot {
+            Batch batch;
+            // The index in the epoch of the batch in this slot.
+            size_t index = 0;
+            bool ready = false;
+        };
+
+        shared_ptr<DataSource<T>> source;
+        DataLoaderOptions options;
+        size_t input_size, target_size;
+        size_t epoch = 0;
+        bool started = false;
+        vector<size_t> order;
+        vector<Slot> slots;
+        vector<std::thread> workers;
+
+        std::mutex mutex;
+        std::condition_variable worker_cv, consumer_cv;
+        bool stopping = false;
+        // Batches [next_to_consume, next_to_fill) are being collated or ready.
+        size_t next_to_fill = 0, next_to_consume = 0, end_of_epoch = 0;
+        size_t busy_workers = 0;
+
+        void worker_loop();
+
+        void collate(size_t index, Batch& batch) const;
+
+        // Waits for the next batch and returns its slot (nullptr at the end of the epoch).
+        Slot *take();
+
+        // Returns the slot to the workers.
+        void release(Slot *slot);
+
+        void swap_into(const Variable<T>& buffer, Tensor<T>& data) const;
+    };
+}
+
+#endif //TARGETPRACTICE_DATALOADER_H
@@ -0,0 +1,116 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "DataParallel.h"
+#include <algorithm>
+
+namespace nn {
+
+    // The rows [begin, end) of a (contiguous) tensor.
+    template<typename T>
+    static void copy_rows(const Tensor<T>& src, size_t begin, size_t end, Tensor<T>& dst) {
+        size_t row_size = src.size / src.shape[0];
+        const T *src_ptr = src.get_data_ptr() + begin * row_size;
+        std::copy(src_ptr, src_ptr + (end - begin) * row_size, dst.get_data_ptr());
+    }
+
+    static shape_t shard_shape(const shape_t& shape, size_t rows) {
+        shape_t ret(shape);
+        ret[0] = rows;
+        return ret;
+    }
+
+    template<typename T>
+    DataParallel<T>::DataParallel(Module<T>& module, const replica_factory_t& make_replica,
+                                  loss_builder_t build_loss, size_t num_replicas, ThreadPool& pool) :
+            module(module), build_loss(std::move(build_loss)), pool(pool), replicas(std::max<size_t>(1, num_replicas)) {
+        for (auto& replica: replicas)
+            replica.module = make_replica();
+    }
+
+    template<typename T>
+    void DataParallel<T>::run_replica(Replica& replica, const Tensor<T>& inputs, const Tensor<T>& targets) {
+        size_t rows = replica.end - replica.begin;
+        if (rows == 0) {
+            replica.loss_value = 0;
+            replica.module->zero_grad();
+            return;
+        }
+        shape_t inputs_shape = shard_shape(inputs.shape, rows);
+        shape_t targets_shape = shard_shape(targets.shape, rows);
+        if (!replica.loss || replica.inputs->shape() != inputs_shape || replica.targets->shape() != targets_shape) {
+            replica.inputs = autograd::InputBuffer<T>::make("inputs", Tensor<T>(inputs_shape));
+            replica.targets = autograd::InputBuffer<T>::make("targets", Tensor<T>(targets_shape));
+            replica.loss = build_loss(*replica.module, *replica.inputs, *replica.targets);
+        }
+        copy_rows(inputs, replica.begin, replica.end, replica.inputs->data());
+        copy_rows(targets, replica.begin, replica.end, replica.targets->data());
+        const Variable<T>& loss = *replica.loss;
+        replica.loss_value = loss->forward_recursive().item();
+        loss->zero_grad(true);
+        loss->backward();
+    }
+
+    template<typename T>
+    void DataParallel<T>::reduce_gradients(size_t batch_size) {
+        size_t num = replicas.size();
+        vector<const T *> grads(num);
+        vector<T> weights(num);
+        for (size_t r = 0; r < num; ++r) {
+            grads[r] = replicas[r].module->flat_gradients().get_data_ptr();
+            weights[r] = T(replicas[r].end - replicas[r].begin) / batch_size;
+        }
+        Tensor<T> out = module.flat_gradients();
+        T *out_ptr = out.get_data_ptr();
+        pool.parallel_for(out.size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                T total = 0;
+                for (size_t r = 0; r < num; ++r)
+                    total += weights[r] * grads[r][i];
+                out_ptr[i] = total;
+            }
+        }, 1 << 14);
+    }
+
+    template<typename T>
+    T DataParallel<T>::forward_backward(const Tensor<T>& inputs, const Tensor<T>& targets) {
+        if (inputs.dim() == 0 || targets.dim() == 0 || inputs.shape[0] != targets.shape[0])
+            throw std::invalid_argument("The inputs and the targets must have the same (non-zero) batch size, got " +
+                                        shape2str(inputs.shape) + " and " + shape2str(targets.shape));
+        // Share the current buffers of the module (they change if it was flattened again).
+        const T *data = module.flat_parameters().get_data_ptr();
+        if (data != shared_data) {
+            for (auto& replica: replicas)
+                replica.module->share_parameters_from(module);
+            shared_data = data;
+        }
+        size_t batch_size = inputs.shape[0], num = replicas.size();
+        for (size_t r = 0; r < num; ++r) {
+            replicas[r].begin = batch_size * r / num;
+            replicas[r].end = batch_size * (r + 1) / num;
+        }
+        pool.parallel_for(num, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r)
+                run_replica(replicas[r], inputs, targets);
+        });
+        reduce_gradients(batch_size);
+        T loss = 0;
+        for (const auto& replica: replicas)
+            loss += replica.loss_value * (replica.end - replica.begin) / batch_size;
+        return loss;
+    }
+
+    template<typename T>
+    T DataParallel<T>::step(const Tensor<T>& inputs, const Tensor<T>& targets, Optimizer<T>& optimizer) {
+        T loss = forward_backward(inputs, targets);
+        optimizer.step();
+        return loss;
+    }
+
+#define INSTANTIATE_DATA_PARALLEL(dtype) \
+    template class DataParallel<dtype>;
+
+    INSTANTIATE_DATA_PARALLEL(double)
+    INSTANTIATE_DATA_PARALLEL(float)
+}
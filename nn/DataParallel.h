@@ -0,0 +1,73 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_DATAPARALLEL_H
+#define TARGETPRACTICE_DATAPARALLEL_H
+
+#include <functional>
+#include <optional>
+#include "Module.h"
+#include "Optimizer.h"
+
+namespace nn {
+
+    /**
+     * Data parallel training of a module on the threads of a pool.
+     * Every replica of the module reads the parameters of the module itself (its parameters
+     * are views into the flat data buffer of the module), but has its own graph and its own
+     * gradients. A batch is split along its first dimension between the replicas, which run
+     * forward and backward concurrently, and then the gradients of the replicas are reduced
+     * into the flat gradient buffer of the module.
+     * The reduction is split by elements between the threads, and every element sums the
+     * replicas in a fixed order, so the result doesn't depend on the number of threads.
+     * @tparam T the data type.
+     */
+    template<typename T>
+    class DataParallel {
+    public:
+        // Creates a module with the same structure as the trained one (its values are ignored).
+        using replica_factory_t = std::function<shared_ptr<Module<T>>()>;
+        // Builds the graph of the (mean) loss of a replica over a shard of the batch.
+        using loss_builder_t = std::function<Variable<T>(Module<T>& replica, const Variable<T>& inputs,
+                                                         const Variable<T>& targets)>;
+
+        DataParallel(Module<T>& module, const replica_factory_t& make_replica, loss_builder_t build_loss,
+                     size_t num_replicas = ThreadPool::global().num_threads(),
+                     ThreadPool& pool = ThreadPool::global());
+
+        /**
+         * Runs forward and backward over the batch, and overwrites the gradients of the module
+         * with the gradient of the mean loss over the batch.
+         * @return the mean loss over the batch.
+         */
+        T forward_backward(const Tensor<T>& inputs, const Tensor<T>& targets);
+
+        // forward_backward, then a step of the optimizer (of the module).
+        T step(const Tensor<T>& inputs, const Tensor<T>& targets, Optimizer<T>& optimizer);
+
+        inline size_t num_replicas() const { return replicas.size(); }
+
+    private:
+        struct Replica {
+            shared_ptr<Module<T>> module;
+            // The graph is rebuilt only when the shape of the shard changes.
+            std::optional<Variable<T>> inputs, targets, loss;
+            size_t begin = 0, end = 0;
+            T loss_value = 0;
+        };
+
+        Module<T>& module;
+        loss_builder_t build_loss;
+        ThreadPool& pool;
+        vector<Replica> replicas;
+        // The flat data buffer of the module that the replicas currently share.
+        const T *shared_data = nullptr;
+
+        void run_replica(Replica& replica, const Tensor<T>& inputs, const Tensor<T>& targets);
+
+        void reduce_gradients(size_t batch_size);
+    };
+}
+
+#endif //TARGETPRACTICE_DATAPARALLEL_H
@@ -0,0 +1,56 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Linear.h"
+#include <cmath>
+
+namespace nn {
+
+    template<typename T>
+    Linear<T>::Linear(size_t in_features, size_t out_features, bool has_bias, const string& activation) :
+            in_features(in_features), out_features(out_features), activation(activation),
+            weight(this->register_parameter("weight", blas::uniform<T>(-1 / std::sqrt(T(in_features)),
+                                                                        1 / std::sqrt(T(in_features)),
+                                                                        {in_features, out_features}))) {
+        if (has_bias)
+            bias = this->register_parameter("bias", blas::uniform<T>(-1 / std::sqrt(T(in_features)),
+                                                                      1 / std::sqrt(T(in_features)),
+                                                                      {out_features}));
+    }
+
+    template<typename T>
+    Variable<T> Linear<T>::forward(const Variable<T>& x) {
+        if (bias)
+            return autograd::linear(x, weight, *bias, activation);
+        return autograd::linear(x, weight, activation);
+    }
+
+    template<typename T>
+    MLP<T>::MLP(const vector<size_t>& sizes, const string& activation, const string& output_activation) {
+        if (sizes.size() < 2)
+            throw std::invalid_argument("An MLP requires the sizes of at least an input and an output.");
+        for (size_t i = 0; i + 1 < sizes.size(); ++i) {
+            bool is_last = i + 2 == sizes.size();
+            layers.push_back(this->register_module(
+                    "layer" + to_string(i),
+                    std::make_shared<Linear<T>>(sizes[i], sizes[i + 1], true,
+                                                is_last ? output_activation : activation)));
+        }
+    }
+
+    template<typename T>
+    Variable<T> MLP<T>::forward(const Variable<T>& x) {
+        Variable<T> out = x;
+        for (const auto& layer: layers)
+            out = layer->forward(out);
+        return out;
+    }
+
+#define INSTANTIATE_LINEAR(dtype) \
+    template class Linear<dtype>; \
+    template class MLP<dtype>;
+
+    INSTANTIATE_LINEAR(double)
+    INSTANTIATE_LINEAR(float)
+}
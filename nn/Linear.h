@@ -0,0 +1,54 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_LINEAR_H
+#define TARGETPRACTICE_LINEAR_H
+
+#include <optional>
+#include "Module.h"
+
+namespace nn {
+
+    /**
+     * A fully connected layer: activation(x @ weight + bias), computed by a single fused
+     * LinearFunctor. The weight (and bias) are initialized uniformly in +-1/sqrt(in_features).
+     * @tparam T the data type.
+     */
+    template<typename T>
+    class Linear : public Module<T> {
+    public:
+        const size_t in_features, out_features;
+        const string activation;
+        Variable<T> weight;
+        // Empty if the layer has no bias.
+        std::optional<Variable<T>> bias;
+
+        Linear(size_t in_features, size_t out_features, bool has_bias = true, const string& activation = "");
+
+        // x must be of shape (batch, in_features).
+        Variable<T> forward(const Variable<T>& x) override;
+    };
+
+    /**
+     * A multi layer perceptron - a stack of Linear layers, named "layer<i>".
+     * @tparam T the data type.
+     */
+    template<typename T>
+    class MLP : public Module<T> {
+    public:
+        vector<shared_ptr<Linear<T>>> layers;
+
+        /**
+         * @param sizes The number of features of the input, of every hidden layer, and of the output.
+         * @param activation The activation of the hidden layers.
+         * @param output_activation The activation of the last layer.
+         */
+        explicit MLP(const vector<size_t>& sizes, const string& activation = "relu",
+                     const string& output_activation = "");
+
+        Variable<T> forward(const Variable<T>& x) override;
+    };
+}
+
+#endif //TARGETPRACTICE_LINEAR_H
@@ -3,3 +3,222 @@
 //
 
 #include "Module.h"
+#include <algorithm>
+#include <cmath>
+
+namespace nn {
+
+    template<typename T>
+    void Module<T>::check_name(const string& name) const {
+        if (name.empty() || name.find('.') != string::npos)
+            throw std::invalid_argument("Invalid name '" + name + "', names must be non-empty and without dots.");
+        for (const auto& param: params)
+            if (param.first == name)
+                throw std::invalid_argument("A parameter named '" + name + "' is already registered.");
+        for (const auto& module: modules)
+            if (module.first == name)
+                throw std::invalid_argument("A submodule named '" + name + "' is already registered.");
+    }
+
+    template<typename T>
+    Variable<T> Module<T>::register_parameter(const string& name, const Variable<T>& param) {
+        check_name(name);
+        if (dynamic_cast<Parameter<T> *>(param.get()) == nullptr)
+            throw std::invalid_argument("'" + param->get_name() + "' is not a parameter, only parameters "
+                                        "can be registered in a module.");
+        params.emplace_back(name, param);
+        Parameter<T>::invalidate_layouts();
+        return param;
+    }
+
+    template<typename T>
+    void Module<T>::add_module(const string& name, shared_ptr<Module<T>> module) {
+        check_name(name);
+        if (!module)
+            throw std::invalid_argument("Cannot register a null submodule '" + name + "'.");
+        modules.emplace_back(name, std::move(module));
+        Parameter<T>::invalidate_layouts();
+    }
+
+    template<typename T>
+    void Module<T>::gather_parameters(const string& prefix, vector<pair<string, Variable<T>>>& out,
+                                      unordered_set<VariableBase<T> *>& visited) const {
+        for (const auto& param: params)
+            if (visited.insert(param.second.get()).second)
+                out.emplace_back(prefix + param.first, param.second);
+        for (const auto& module: modules)
+            module.second->gather_parameters(prefix + module.first + ".", out, visited);
+    }
+
+    template<typename T>
+    vector<pair<string, Variable<T>>> Module<T>::named_parameters() const {
+        vector<pair<string, Variable<T>>> result;
+        unordered_set<VariableBase<T> *> visited;
+        gather_parameters("", result, visited);
+        return result;
+    }
+
+    template<typename T>
+    vector<Variable<T>> Module<T>::parameters() const {
+        vector<Variable<T>> result;
+        for (auto& named_param: named_parameters())
+            result.push_back(std::move(named_param.second));
+        return result;
+    }
+
+    template<typename T>
+    size_t Module<T>::num_parameters() const {
+        size_t total = 0;
+        for (const auto& param: parameters())
+            total += param.data().size;
+        return total;
+    }
+
+    template<typename T>
+    size_t Module<T>::assign_flat_range(const shared_ptr<FlatBuffers>& buffers, size_t offset,
+                                        unordered_set<VariableBase<T> *>& visited) {
+        size_t size = 0;
+        flat_params.clear();
+        for (const auto& param: params)
+            if (visited.insert(param.second.get()).second) {
+                flat_params.emplace_back(param.second.get(), size);
+                size += param.second.data().size;
+            }
+        for (const auto& module: modules) {
+            size_t module_size = module.second->assign_flat_range(buffers, offset + size, visited);
+            for (const auto& module_param: module.second->flat_params)
+                flat_params.emplace_back(module_param.first, size + module_param.second);
+            size += module_size;
+        }
+        flat = buffers;
+        flat_offset = offset;
+        flat_size = size;
+        return size;
+    }
+
+    template<typename T>
+    void Module<T>::flatten() {
+        auto all_params = parameters();
+        size_t total = 0;
+        for (const auto& param: all_params)
+            total += param.data().size;
+        auto buffers = std::make_shared<FlatBuffers>();
+        buffers->data = Tensor<T>(shape_t{total});
+        buffers->grad = Tensor<T>(shape_t{total});
+        T *data_ptr = buffers->data.get_data_ptr(), *grad_ptr = buffers->grad.get_data_ptr();
+        // The old buffers are kept alive (by the modules) until all the parameters are copied out of them.
+        for (const auto& param: all_params) {
+            size_t size = param.data().size;
+            static_cast<Parameter<T> *>(param.get())->bind_storage(data_ptr, grad_ptr);
+            data_ptr += size;
+            grad_ptr += size;
+        }
+        unordered_set<VariableBase<T> *> visited;
+        assign_flat_range(buffers, 0, visited);
+    }
+
+    template<typename T>
+    void Module<T>::share_parameters_from(Module<T>& source) {
+        auto all_params = parameters();
+        auto source_params = source.parameters();
+        if (all_params.size() != source_params.size())
+            throw std::invalid_argument("Cannot share the parameters of a module with a different structure.");
+        for (size_t i = 0; i < all_params.size(); ++i)
+            if (all_params[i].shape() != source_params[i].shape())
+                throw std::invalid_argument("Cannot share parameter '" + source_params[i]->get_name() +
+                                            "' of shape " + shape2str(source_params[i].shape()) +
+                                            " with a parameter of shape " + shape2str(all_params[i].shape()));
+        Tensor<T> source_data = source.flat_parameters();
+        auto buffers = std::make_shared<FlatBuffers>();
+        buffers->data = Tensor<T>::wrap(source_data.get_data_ptr(), source_data.shape);
+        buffers->grad = blas::zeros<T>(source_data.shape);
+        T *data_ptr = buffers->data.get_data_ptr(), *grad_ptr = buffers->grad.get_data_ptr();
+        for (const auto& param: all_params) {
+            size_t size = param.data().size;
+            static_cast<Parameter<T> *>(param.get())->bind_storage(data_ptr, grad_ptr, false);
+            data_ptr += size;
+            grad_ptr += size;
+        }
+        unordered_set<VariableBase<T> *> visited;
+        assign_flat_range(buffers, 0, visited);
+    }
+
+    template<typename T>
+    bool Module<T>::is_flat() const {
+        if (!flat)
+            return false;
+        const T *data_ptr = flat->data.get_data_ptr() + flat_offset;
+        const T *grad_ptr = flat->grad.get_data_ptr() + flat_offset;
+        size_t generation = Parameter<T>::layout_generation();
+        if (flat_generation.load(std::memory_order_relaxed) == generation + 1) {
+            // No parameter was registered or bound since, but the data of one may have been replaced.
+            for (const auto& param: flat_params)
+                if (param.first->data().get_data_ptr() != data_ptr + param.second || !param.first->has_grad_buffer() ||
+                    param.first->grad().get_data_ptr() != grad_ptr + param.second)
+                    return false;
+            return true;
+        }
+        size_t offset = 0;
+        for (const auto& param: parameters()) {
+            if (param.data().get_data_ptr() != data_ptr + offset || !param->has_grad_buffer() ||
+                param.grad().get_data_ptr() != grad_ptr + offset)
+                return false;
+            offset += param.data().size;
+        }
+        if (offset != flat_size)
+            return false;
+        flat_generation.store(generation + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    template<typename T>
+    typename Module<T>::FlatRange Module<T>::flat_range() {
+        ensure_flat();
+        return {flat->data.get_data_ptr() + flat_offset, flat->grad.get_data_ptr() + flat_offset, flat_size};
+    }
+
+    template<typename T>
+    Tensor<T> Module<T>::flat_parameters() {
+        FlatRange range = flat_range();
+        return Tensor<T>::wrap(range.data, {range.size});
+    }
+
+    template<typename T>
+    Tensor<T> Module<T>::flat_gradients() {
+        FlatRange range = flat_range();
+        return Tensor<T>::wrap(range.grad, {range.size});
+    }
+
+    template<typename T>
+    void Module<T>::zero_grad() {
+        FlatRange range = flat_range();
+        std::fill(range.grad, range.grad + range.size, T(0));
+    }
+
+    template<typename T>
+    T Module<T>::grad_norm() {
+        FlatRange range = flat_range();
+        T total = 0;
+        for (size_t i = 0; i < range.size; ++i)
+            total += range.grad[i] * range.grad[i];
+        return std::sqrt(total);
+    }
+
+    template<typename T>
+    T Module<T>::clip_grad_norm_(T max_norm) {
+        T norm = grad_norm();
+        if (norm > max_norm) {
+            FlatRange range = flat_range();
+            T scale = max_norm / (norm + T(1e-6));
+            for (size_t i = 0; i < range.size; ++i)
+                range.grad[i] *= scale;
+        }
+        return norm;
+    }
+
+#define INSTANTIATE_MODULE(dtype) \
+    template class Module<dtype>;
+
+    INSTANTIATE_MODULE(double)
+    INSTANTIATE_MODULE(float)
+}
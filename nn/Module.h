@@ -7,9 +7,139 @@
 
 #include "../autograd/autograd.h"
 
-class Module {
+namespace nn {
+    using autograd::Variable;
+    using autograd::VariableBase;
+    using autograd::Parameter;
 
-};
+    /**
+     * A base for neural network modules - a registry of parameters and submodules.
+     * All the parameters of a module (including those of its submodules) are backed
+     * by one contiguous buffer of data and one of gradients, laid out in registration
+     * order, depth first. Every parameter's data and gradient are views into these
+     * buffers, so whole-model operations (zeroing gradients, optimizer steps, clipping,
+     * saving) are single passes over one array.
+     * The buffers are (re)built lazily, the first time they are needed after a parameter
+     * or a submodule was registered.
+     * @tparam T the data type.
+     * @note A parameter must belong to a single module tree - if it is registered in two
+     *       unrelated modules, they keep stealing it from each other's buffers.
+     */
+    template<typename T>
+    class Module {
+    public:
+        Module() = default;
+        Module(const Module&) = delete;
+        Module& operator=(const Module&) = delete;
+        virtual ~Module() = default;
 
+        // Builds the graph of the module on top of the input.
+        virtual Variable<T> forward(const Variable<T>& input) NOT_IMPLEMENTED
+
+        inline Variable<T> operator()(const Variable<T>& input) { return forward(input); }
+
+        // Registers a parameter variable under this module, and returns it.
+        Variable<T> register_parameter(const string& name, const Variable<T>& param);
+
+        // Creates a parameter initialized to the given data, and registers it.
+        inline Variable<T> register_parameter(const string& name, Tensor<T> data, bool requires_grad = true) {
+            return register_parameter(name, Parameter<T>::make(name, std::move(data), requires_grad));
+        }
+
+        // Registers a submodule under this module, and returns it.
+        template<class M>
+        inline shared_ptr<M> register_module(const string& name, shared_ptr<M> module) {
+            add_module(name, module);
+            return module;
+        }
+
+        // All the (distinct) parameters of the module and its submodules, in the order of the flat buffers.
+        vector<Variable<T>> parameters() const;
+
+        // Same as 'parameters()', named "<submodule>.<parameter>".
+        vector<pair<string, Variable<T>>> named_parameters() const;
+
+        // The total number of elements of all the parameters.
+        size_t num_parameters() const;
+
+        // Binds all the parameters to newly allocated flat buffers.
+        void flatten();
+
+        // True if all the parameters are currently views into the flat buffers.
+        // Only gathers the parameters again if a layout changed since the last check, otherwise
+        // compares the buffers of the parameters of the last flatten with their expected addresses.
+        bool is_flat() const;
+
+        /**
+         * Makes the data of all the parameters views into the flat data buffer of source, which
+         * must have the same structure, while the gradients stay in a buffer of this module.
+         * Used by replicas that read the parameters of a module but accumulate their own gradients.
+         * @note Flattening source again (e.g. registering a parameter) invalidates the shared data.
+         */
+        void share_parameters_from(Module<T>& source);
+
+        // The flat buffers of the module as raw pointers.
+        struct FlatRange {
+            T *data;
+            T *grad;
+            size_t size;
+        };
+
+        // Like flat_parameters() and flat_gradients(), without wrapping the buffers in tensors (which
+        // allocates their shapes) - for the loops that run on every training step.
+        FlatRange flat_range();
+
+        // A view of the data of all the parameters, as one vector.
+        Tensor<T> flat_parameters();
+
+        // A view of the gradients of all the parameters, as one vector.
+        Tensor<T> flat_gradients();
+
+        void zero_grad();
+
+        // The L2 norm of all the gradients together.
+        T grad_norm();
+
+        // Scales all the gradients so that their total L2 norm is at most max_norm.
+        // Returns the norm before clipping.
+        T clip_grad_norm_(T max_norm);
+
+    protected:
+        vector<pair<string, Variable<T>>> params;
+        vector<pair<string, shared_ptr<Module<T>>>> modules;
+
+    private:
+        struct FlatBuffers {
+            Tensor<T> data;
+            Tensor<T> grad;
+        };
+        // Shared by all the modules of the tree that was flattened, each of them owns a
+        // contiguous range of the buffers.
+        shared_ptr<FlatBuffers> flat;
+        size_t flat_offset = 0;
+        size_t flat_size = 0;
+        // The layout generation at which the buffers were last verified to be flat, plus 1 (0 - never).
+        mutable std::atomic<size_t> flat_generation{0};
+        // The parameters in the range of this module, and their offsets in it.
+        vector<pair<VariableBase<T> *, size_t>> flat_params;
+
+        void add_module(const string& name, shared_ptr<Module<T>> module);
+
+        void check_name(const string& name) const;
+
+        void gather_parameters(const string& prefix, vector<pair<string, Variable<T>>>& out,
+                               unordered_set<VariableBase<T> *>& visited) const;
+
+        // Assigns the range [offset, offset + size) of the buffers to this module and its
+        // submodules, returns the size.
+        size_t assign_flat_range(const shared_ptr<FlatBuffers>& buffers, size_t offset,
+                                 unordered_set<VariableBase<T> *>& visited);
+
+        inline void ensure_flat() {
+            if (!is_flat())
+                flatten();
+        }
+    };
+}
 
 #endif //TARGETPRACTICE_MODULE_H
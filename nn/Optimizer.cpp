@@ -0,0 +1,111 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Optimizer.h"
+#include <cmath>
+
+namespace nn {
+
+    template<typename T>
+    Optimizer<T>::Optimizer(Module<T>& module, T lr, ThreadPool& pool) : lr(lr), module(module), pool(pool) {}
+
+    template<typename T>
+    void Optimizer<T>::step() {
+        auto range = module.flat_range();
+        // First step (or the module changed) - start from a zero state.
+        if (state.dim() != 2 || state.shape[0] != num_state_buffers() || state.shape[1] != range.size)
+            allocate_state(range.size);
+        steps++;
+        prepare_step();
+        params_ptr = range.data;
+        grads_ptr = range.grad;
+        // Only captures 'this', so the task fits in the small buffer of std::function and isn't allocated.
+        pool.parallel_for(range.size, [this](size_t begin, size_t end) {
+            update(params_ptr, grads_ptr, state_ptrs.data(), begin, end);
+        }, min_chunk);
+    }
+
+    template<typename T>
+    void Optimizer<T>::allocate_state(size_t num_params) {
+        size_t num_buffers = num_state_buffers();
+        blas::memory::MemoryTag tag("optimizer");
+        state = blas::zeros<T>({num_buffers, num_params});
+        state_ptrs.resize(num_buffers);
+        for (size_t i = 0; i < num_buffers; ++i)
+            state_ptrs[i] = state.get_data_ptr() + i * num_params;
+    }
+
+    template<typename T>
+    void Optimizer<T>::set_state(const Tensor<T>& new_state, size_t num_steps) {
+        shape_t state_shape{num_state_buffers(), module.num_parameters()};
+        if (new_state.shape != state_shape)
+            throw std::invalid_argument("Expected an optimizer state of shape " + shape2str(state_shape) +
+                                        ", got " + shape2str(new_state.shape) + ".");
+        allocate_state(state_shape[1]);
+        state.copy_(new_state);
+        steps = num_steps;
+    }
+
+    template<typename T>
+    SGD<T>::SGD(Module<T>& module, T lr, T momentum, bool nesterov, T weight_decay, ThreadPool& pool) :
+            Optimizer<T>(module, lr, pool), momentum(momentum), weight_decay(weight_decay), nesterov(nesterov) {
+        if (nesterov && momentum == 0)
+            throw std::invalid_argument("Nesterov momentum requires a non-zero momentum.");
+    }
+
+    template<typename T>
+    void SGD<T>::update(T *params, const T *grads, T *const *state_ptrs, size_t begin, size_t end) {
+        const T lr = this->lr, mu = momentum, wd = weight_decay;
+        if (mu == 0) {
+            for (size_t i = begin; i < end; ++i)
+                params[i] -= lr * (grads[i] + wd * params[i]);
+            return;
+        }
+        T *velocity = state_ptrs[0];
+        for (size_t i = begin; i < end; ++i) {
+            T g = grads[i] + wd * params[i];
+            T v = mu * velocity[i] + g;
+            velocity[i] = v;
+            params[i] -= lr * (nesterov ? g + mu * v : v);
+        }
+    }
+
+    template<typename T>
+    Adam<T>::Adam(Module<T>& module, T lr, T beta1, T beta2, T eps, T weight_decay, bool decoupled_weight_decay,
+                  ThreadPool& pool) :
+            Optimizer<T>(module, lr, pool), beta1(beta1), beta2(beta2), eps(eps), weight_decay(weight_decay),
+            decoupled_weight_decay(decoupled_weight_decay) {}
+
+    template<typename T>
+    void Adam<T>::prepare_step() {
+        T bias_correction1 = 1 - std::pow(beta1, T(this->steps));
+        T bias_correction2 = 1 - std::pow(beta2, T(this->steps));
+        step_size = this->lr / bias_correction1;
+        sqrt_bias_correction2 = std::sqrt(bias_correction2);
+    }
+
+    template<typename T>
+    void Adam<T>::update(T *params, const T *grads, T *const *state_ptrs, size_t begin, size_t end) {
+        const T b1 = beta1, b2 = beta2, lr_decay = this->lr * weight_decay;
+        const T l2_decay = decoupled_weight_decay ? 0 : weight_decay;
+        const T decay = decoupled_weight_decay ? 1 - lr_decay : 1;
+        T *m = state_ptrs[0], *v = state_ptrs[1];
+        for (size_t i = begin; i < end; ++i) {
+            T g = grads[i] + l2_decay * params[i];
+            T m_i = b1 * m[i] + (1 - b1) * g;
+            T v_i = b2 * v[i] + (1 - b2) * g * g;
+            m[i] = m_i;
+            v[i] = v_i;
+            params[i] = decay * params[i] - step_size * m_i / (std::sqrt(v_i) / sqrt_bias_correction2 + eps);
+        }
+    }
+
+#define INSTANTIATE_OPTIMIZER(dtype)     \
+    template class Optimizer<dtype>;     \
+    template class SGD<dtype>;           \
+    template class Adam<dtype>;
+
+    INSTANTIATE_OPTIMIZER(double)
+    INSTANTIATE_OPTIMIZER(float)
+}
@@ -0,0 +1,125 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_OPTIMIZER_H
+#define TARGETPRACTICE_OPTIMIZER_H
+
+#include "Module.h"
+#include "utils/ThreadPool.h"
+
+namespace nn {
+
+    /**
+     * A base for optimizers of the parameters of a module.
+     * A step is a single loop over the flat parameter and gradient buffers of the module,
+     * split between the threads of a pool. The state of the optimizer (e.g. momentum) is
+     * stored the same way - num_state_buffers() contiguous buffers with the layout of the
+     * flat parameters, allocated on the first step.
+     * @tparam T the data type.
+     */
+    template<typename T>
+    class Optimizer {
+    public:
+        T lr;
+
+        Optimizer(Module<T>& module, T lr, ThreadPool& pool = ThreadPool::global());
+
+        virtual ~Optimizer() = default;
+
+        void step();
+
+        inline void zero_grad() { module.zero_grad(); }
+
+        inline size_t num_steps() const { return steps; }
+
+        // The state buffers, of shape (num_state_buffers(), num_parameters), empty before the first step.
+        inline Tensor<T>& get_state() { return state; }
+
+        // Restores the state buffers and the step count (e.g. from a checkpoint).
+        void set_state(const Tensor<T>& new_state, size_t num_steps);
+
+        // The number of state values per parameter.
+        virtual size_t num_state_buffers() const { return 0; }
+
+    protected:
+        Module<T>& module;
+        ThreadPool& pool;
+        size_t steps = 0;
+        Tensor<T> state;
+
+        // Called once per step, before the update (e.g. to compute the bias corrections).
+        virtual void prepare_step() {}
+
+        /**
+         * Updates the parameters in [begin, end) of the flat buffers.
+         * @param state_ptrs the state buffers, also indexed by the flat parameter index.
+         */
+        virtual void update(T *params, const T *grads, T *const *state_ptrs, size_t begin, size_t end) = 0;
+
+    private:
+        // Chunks smaller than this aren't worth waking another thread for.
+        static constexpr size_t min_chunk = 1 << 15;
+        vector<T *> state_ptrs;
+        T *params_ptr = nullptr;
+        const T *grads_ptr = nullptr;
+
+        void allocate_state(size_t num_params);
+    };
+
+    /**
+     * Stochastic gradient descent, with optional (Nesterov) momentum and L2 weight decay:
+     *   g = grad + weight_decay * p
+     *   v = momentum * v + g
+     *   p -= lr * (nesterov ? g + momentum * v : v)
+     */
+    template<typename T>
+    class SGD : public Optimizer<T> {
+    public:
+        T momentum, weight_decay;
+        bool nesterov;
+
+        SGD(Module<T>& module, T lr, T momentum = 0, bool nesterov = false, T weight_decay = 0,
+            ThreadPool& pool = ThreadPool::global());
+
+        size_t num_state_buffers() const override { return momentum != 0 ? 1 : 0; }
+
+    protected:
+        void update(T *params, const T *grads, T *const *state_ptrs, size_t begin, size_t end) override;
+    };
+
+    /**
+     * Adam (Kingma & Ba), with L2 weight decay added to the gradient.
+     * With decoupled_weight_decay the decay is applied to the parameters directly instead (AdamW).
+     */
+    template<typename T>
+    class Adam : public Optimizer<T> {
+    public:
+        T beta1, beta2, eps, weight_decay;
+        bool decoupled_weight_decay;
+
+        Adam(Module<T>& module, T lr = 1e-3, T beta1 = 0.9, T beta2 = 0.999, T eps = 1e-8, T weight_decay = 0,
+             bool decoupled_weight_decay = false, ThreadPool& pool = ThreadPool::global());
+
+        size_t num_state_buffers() const override { return 2; }
+
+    protected:
+        void prepare_step() override;
+
+        void update(T *params, const T *grads, T *const *state_ptrs, size_t begin, size_t end) override;
+
+    private:
+        T step_size = 0, sqrt_bias_correction2 = 1;
+    };
+
+    // Adam with decoupled weight decay (Loshchilov & Hutter).
+    template<typename T>
+    class AdamW : public Adam<T> {
+    public:
+        AdamW(Module<T>& module, T lr = 1e-3, T beta1 = 0.9, T beta2 = 0.999, T eps = 1e-8, T weight_decay = 1e-2,
+              ThreadPool& pool = ThreadPool::global()) :
+                Adam<T>(module, lr, beta1, beta2, eps, weight_decay, true, pool) {}
+    };
+}
+
+#endif //TARGETPRACTICE_OPTIMIZER_H
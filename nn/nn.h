@@ -0,0 +1,15 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_NN_H
+#define TARGETPRACTICE_NN_H
+
+#include "Module.h"
+#include "Linear.h"
+#include "Optimizer.h"
+#include "DataParallel.h"
+#include "DataLoader.h"
+#include "Checkpointer.h"
+
+#endif //TARGETPRACTICE_NN_H
@@ -1,4 +1,7 @@
 #!/bin/bash
+# Callgrind profile of an executable, as an SVG call graph.
+# For quick hardware counters of the benchmarks (IPC, cache and branch miss rates per kernel),
+# run them with --perf instead, e.g. bench/bench_blas --perf --filter=matmul
 
 EXEC_CMD="$@"
 echo "$EXEC_CMD"
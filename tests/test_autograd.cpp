@@ -2,6 +2,7 @@
 // Created by LevZ on 6/17/2020.
 //
 
+#include <thread>
 #include "../autograd/autograd.h"
 using namespace blas;
 using namespace autograd;
@@ -113,7 +114,7 @@ void test_multi_layer_perceptron()
     cout << "TEST AUTOGRAD MLP:" << endl;
     double alpha = 5e-2;
     auto x = linspace<double>(-1, 1, 500).const_view({500, 1});
-    auto y = x*x;
+    Tensor<double> y = x*x;
     auto input = InputBuffer<double>::make("x", x.const_view({-1, 1}));
     auto w1 = Parameter<double>::make("w1", uniform(-1., 1., {1, 8})),
          b1 = Parameter<double>::make("b1", ones<double>({8}));
@@ -154,11 +155,300 @@ void test_multi_layer_perceptron()
     }
 }
 
+void test_gradient_checkpointing()
+{
+    cout << "TEST AUTOGRAD GRADIENT CHECKPOINTING:" << endl;
+    auto x = linspace<double>(-1, 1, 100).reshape({100, 1});
+    auto input = InputBuffer<double>::make("x", x);
+    auto y_true = InputBuffer<double>::make("y_true", x * x);
+    auto w1 = Parameter<double>::make("w1", uniform(-1., 1., {1, 16})),
+         b1 = Parameter<double>::make("b1", ones<double>({16}));
+    auto w2 = Parameter<double>::make("w2", uniform(-1., 1., {16, 16})),
+         b2 = Parameter<double>::make("b2", ones<double>({16}));
+    auto w3 = Parameter<double>::make("w3", uniform(-1., 1., {16, 1})),
+         b3 = Parameter<double>::make("b3", ones<double>({1}));
+    vector<Variable<double>> params = {w1, b1, w2, b2, w3, b3};
+    auto build_loss = [&](bool use_checkpoint) {
+        auto h1 = relu(matmul(input, w1) + b1);
+        auto h2 = relu(matmul(h1, w2) + b2);
+        auto h3 = tanh(matmul(h2, w2) + b2);
+        if (use_checkpoint)
+            checkpoint(h3, {h1});
+        auto y_pred = matmul(h3, w3) + b3;
+        MSELoss<double> criterion{y_pred.shape()};
+        return criterion(y_pred, y_true);
+    };
+    auto loss = build_loss(false);
+    auto loss_checkpointed = build_loss(true);
+    checkpoint_memory_report(loss).print(cout);
+    checkpoint_memory_report(loss_checkpointed).print(cout);
+
+    loss->forward_recursive();
+    loss->zero_grad(true);
+    loss->backward();
+    vector<Tensor<double>> expected_grads;
+    for (const auto& p: params)
+        expected_grads.push_back(p.grad());
+
+    loss_checkpointed->forward_recursive();
+    loss_checkpointed->zero_grad(true);
+    loss_checkpointed->backward();
+    cout << "loss, loss_checkpointed = " << loss.data() << ", " << loss_checkpointed.data() << endl;
+    double max_diff = 0;
+    for (int i = 0; i < params.size(); ++i) {
+        auto diff = (params[i].grad() - expected_grads[i]).absl();
+        max_diff = std::max(max_diff, diff.reduce([](double x, double y) { return std::max(x, y); }).item());
+    }
+    cout << "max |grad - grad_checkpointed| = " << max_diff << endl;
+    if (max_diff > 1e-12)
+        throw std::runtime_error("Checkpointed gradients differ from the regular gradients.");
+}
+
+void test_no_grad()
+{
+    cout << "TEST AUTOGRAD NO GRAD:" << endl;
+    auto input = InputBuffer<double>::make("x", linspace<double>(-1, 1, 100).const_view({100, 1}));
+    auto w1 = Parameter<double>::make("w1", uniform(-1., 1., {1, 16})),
+         b1 = Parameter<double>::make("b1", ones<double>({16}));
+    auto w2 = Parameter<double>::make("w2", uniform(-1., 1., {16, 1}));
+    auto model = [&]() { return matmul(sigmoid(matmul(input, w1) + b1), w2); };
+    auto y = model();
+    auto y_no_grad = [&]() {
+        NoGradGuard guard;
+        return model();
+    }();
+    if (!is_grad_enabled())
+        throw std::runtime_error("NoGradGuard did not restore the grad mode.");
+    if (!y_no_grad->is_leaf() || y_no_grad->requires_grad || y_no_grad->has_grad_buffer())
+        throw std::runtime_error("Variables computed under NoGradGuard must be constants without a gradient.");
+    if (y_no_grad->get_name().empty())
+        throw std::runtime_error("Variables computed under NoGradGuard must be named after their functor.");
+    double max_diff = (y.data() - y_no_grad.data()).absl().reduce([](double x, double y) { return std::max(x, y); }).item();
+    cout << "max |y - y_no_grad| = " << max_diff << endl;
+    if (max_diff > 0)
+        throw std::runtime_error("NoGradGuard changed the result of the model.");
+}
+
+void test_broadcast_backward()
+{
+    cout << "TEST AUTOGRAD BROADCAST BACKWARD:" << endl;
+    auto x = Parameter<double>::make("x", linspace<double>(-1, 1, 100).reshape({100, 1}));
+    auto a = Parameter<double>::make("a", uniform(-1., 1., {1, 8}));
+    auto loss = sum(a * x);
+    loss->forward_recursive();
+    loss->zero_grad(true);
+    loss->backward();
+    // d(sum(a * x))/da = sum(x), d(sum(a * x))/dx = sum(a).
+    double max_diff = 0;
+    for (int j = 0; j < 8; ++j)
+        max_diff = std::max(max_diff, std::abs(a.grad()[{0, j}].item() - x.data().sum().item()));
+    for (int i = 0; i < 100; ++i)
+        max_diff = std::max(max_diff, std::abs(x.grad()[{i, 0}].item() - a.data().sum().item()));
+    cout << "max |grad - expected| = " << max_diff << endl;
+    if (max_diff > 1e-12)
+        throw std::runtime_error("Broadcast gradients are wrong.");
+}
+
+void test_shared_functor()
+{
+    cout << "TEST AUTOGRAD SHARED FUNCTOR:" << endl;
+    auto x = Parameter<double>::make("x", linspace<double>(-1, 1, 10));
+    auto functor = std::make_shared<MathFunctor<double>>(x.shape(), "exp");
+    auto y1 = (*functor)(x), y2 = (*functor)(x);
+    cout << "functor: " << functor->name() << ", variables: " << y1->get_name() << ", " << y2->get_name() << endl;
+    if (functor.use_count() != 3)
+        throw std::runtime_error("A functor owned by a shared_ptr must be shared by its variables.");
+    if (y1->get_name() != functor->name())
+        throw std::runtime_error("A variable must be named after its functor.");
+    y1->rename("y1");
+    if (y1->get_name() != "y1")
+        throw std::runtime_error("Renaming a variable must override the name of its functor.");
+}
+
+void test_elemwise_fusion()
+{
+    cout << "TEST AUTOGRAD ELEMWISE FUSION:" << endl;
+    auto x = InputBuffer<double>::make("x", linspace<double>(-1, 1, 100).reshape({100, 1}));
+    auto a = Parameter<double>::make("a", uniform(-1., 1., {8})),
+         b = Parameter<double>::make("b", uniform(-1., 1., {8}));
+    vector<Variable<double>> params = {a, b};
+    auto build_loss = [&](bool fuse) {
+        auto y = tanh(2. * sigmoid(a * x + b) - x) * (b * b) / 3.;
+        if (fuse) {
+            size_t chains = fuse_elemwise(y);
+            cout << "fused chains: " << chains << endl;
+            // The add of a * x + b, sigmoid, 2 * _, _ - x and tanh, all used once, make one chain.
+            if (chains != 1)
+                throw std::runtime_error("Expected the graph to be fused into a single chain.");
+        }
+        return sum(y);
+    };
+    auto loss = build_loss(false);
+    auto loss_fused = build_loss(true);
+
+    loss->forward_recursive();
+    loss->zero_grad(true);
+    loss->backward();
+    vector<Tensor<double>> expected_grads;
+    for (const auto& p: params)
+        expected_grads.push_back(p.grad());
+
+    loss_fused->forward_recursive();
+    loss_fused->zero_grad(true);
+    loss_fused->backward();
+    cout << "loss, loss_fused = " << loss.data() << ", " << loss_fused.data() << endl;
+    double max_diff = std::abs(loss.data().item() - loss_fused.data().item());
+    for (int i = 0; i < params.size(); ++i) {
+        auto diff = (params[i].grad() - expected_grads[i]).absl();
+        max_diff = std::max(max_diff, diff.reduce([](double x, double y) { return std::max(x, y); }).item());
+    }
+    cout << "max |fused - unfused| = " << max_diff << endl;
+    if (max_diff > 1e-12)
+        throw std::runtime_error("Fused functors differ from the unfused graph.");
+}
+
+void test_freeze()
+{
+    cout << "TEST AUTOGRAD FREEZE:" << endl;
+    auto x = InputBuffer<double>::make("x", uniform(-1., 1., {16, 4}));
+    auto w1 = Parameter<double>::make("w1", uniform(-1., 1., {4, 8})),
+         b1 = Parameter<double>::make("b1", uniform(-1., 1., {8})),
+         w2 = Parameter<double>::make("w2", uniform(-1., 1., {8, 2})),
+         scale = Parameter<double>::make("scale", uniform(-1., 1., {2}));
+    auto h = tanh(2. * sigmoid(matmul(x, w1) + b1) - 1.);
+    // Only depends on parameters - folded into a constant.
+    auto y = matmul(h, w2) * (scale * scale + 1.);
+    auto frozen = freeze(y, {x});
+    frozen->print(cout);
+    if (frozen->num_fused_steps() != 1 || frozen->arena_size() >= frozen->unplanned_size())
+        throw std::runtime_error("The frozen graph must fuse the element-wise chain and reuse the arena.");
+
+    vector<Tensor<double>> batches, expected;
+    for (int i = 0; i < 4; ++i) {
+        batches.push_back(uniform(-1., 1., {16, 4}));
+        x.data() = batches.back();
+        y->forward_recursive();
+        expected.push_back(y.data().contiguous());
+    }
+    // The frozen graph doesn't depend on the parameters anymore.
+    w1.data().fill_(0.);
+    vector<double> max_diffs(batches.size(), 0);
+    vector<std::thread> threads;
+    for (size_t i = 0; i < batches.size(); ++i)
+        threads.emplace_back([&, i]() {
+            for (int repeat = 0; repeat < 50; ++repeat) {
+                auto diff = (frozen->run({batches[i]}) - expected[i]).absl();
+                max_diffs[i] = std::max(max_diffs[i], diff.reduce([](double a, double b) { return std::max(a, b); }).item());
+            }
+        });
+    for (auto& thread: threads)
+        thread.join();
+    double max_diff = *std::max_element(max_diffs.begin(), max_diffs.end());
+    cout << "max |frozen - graph| = " << max_diff << endl;
+    if (max_diff > 1e-12)
+        throw std::runtime_error("The frozen graph differs from the graph it was compiled from.");
+}
+
+void test_micro_batcher()
+{
+    cout << "TEST AUTOGRAD MICRO BATCHER:" << endl;
+    const size_t batch = 8;
+    auto x = InputBuffer<double>::make("x", zeros<double>({batch, 4}));
+    auto w = Parameter<double>::make("w", uniform(-1., 1., {4, 3})),
+         b = Parameter<double>::make("b", uniform(-1., 1., {3}));
+    auto frozen = freeze(sigmoid(matmul(x, w) + b), {x});
+    MicroBatcher<double> batcher(frozen, {batch, std::chrono::microseconds(2000)});
+
+    // Every sample is expected at row 0 of a batch of its own.
+    vector<Tensor<double>> samples, expected;
+    for (int i = 0; i < 40; ++i) {
+        samples.push_back(uniform(-1., 1., {4}));
+        Tensor<double> single = zeros<double>({batch, 4});
+        single[0] = samples.back();
+        expected.push_back(frozen->run({single})[0].contiguous());
+    }
+    vector<double> max_diffs(4, 0);
+    vector<std::thread> clients;
+    for (size_t c = 0; c < max_diffs.size(); ++c)
+        clients.emplace_back([&, c]() {
+            vector<std::future<Tensor<double>>> results;
+            for (size_t i = c; i < samples.size(); i += max_diffs.size())
+                results.push_back(batcher.submit(samples[i]));
+            for (size_t k = 0; k < results.size(); ++k) {
+                auto diff = (results[k].get() - expected[c + k * max_diffs.size()]).absl();
+                max_diffs[c] = std::max(max_diffs[c], diff.reduce([](double a, double b) { return std::max(a, b); }).item());
+            }
+        });
+    for (auto& client: clients)
+        client.join();
+    double max_diff = *std::max_element(max_diffs.begin(), max_diffs.end());
+    cout << "requests: " << batcher.num_requests() << ", batches: " << batcher.num_batches()
+         << ", max |batched - single| = " << max_diff << endl;
+    if (max_diff > 1e-12 || batcher.num_requests() != samples.size() || batcher.num_batches() >= samples.size())
+        throw std::runtime_error("The batched results must match the single sample ones.");
+}
+
+void test_tracer()
+{
+    cout << "TEST TRACER:" << endl;
+    auto x = InputBuffer<double>::make("x", uniform(-1., 1., {8, 4}));
+    auto w = Parameter<double>::make("w", uniform(-1., 1., {4, 3}));
+    auto loss = sum(tanh(matmul(x, w)));
+    Tracer& tracer = Tracer::global();
+    tracer.start();
+    loss->forward_recursive();
+    loss->zero_grad(true);
+    loss->backward();
+    tracer.stop();
+    size_t forwards = 0, backwards = 0;
+    for (const auto& event: tracer.events()) {
+        forwards += string(event.category) == "forward";
+        backwards += string(event.category) == "backward";
+    }
+    cout << "forward events = " << forwards << ", backward events = " << backwards
+         << ", total events = " << tracer.num_events() << endl;
+    tracer.export_to("trace.json");
+    if (forwards != 3 || backwards != 3)
+        throw std::runtime_error("Every forward and backward of a node must be traced.");
+}
+
+void test_graph_profile()
+{
+    cout << "TEST GRAPH PROFILE:" << endl;
+    auto x = InputBuffer<double>::make("x", uniform(-1., 1., {64, 16}));
+    auto w = Parameter<double>::make("w", uniform(-1., 1., {16, 8}));
+    auto loss = sum(tanh(matmul(x, w)));
+    loss->forward_recursive();
+    loss->zero_grad(true);
+    loss->backward();
+    Tensor<double> expected_grad(w.grad());
+    GraphProfile<double> profile(loss, 3);
+    profile.print(cout);
+    GraphvizPrinter gvzp;
+    loss->gather_connection_graphviz(gvzp);
+    std::ostringstream dot;
+    profile.annotate(gvzp).print_dot(dot);
+    cout << dot.str();
+    // The profile leaves the gradients of a single backward.
+    double max_diff = (w.grad() - expected_grad).absl().reduce([](double x, double y) { return std::max(x, y); }).item();
+    if (profile.find(w->get_name()) == nullptr || dot.str().find("fillcolor") == string::npos || max_diff > 1e-12)
+        throw std::runtime_error("Every node must be profiled and annotated.");
+}
+
 int main()
 {
     test_autograd_simple();
     test_autograd_linear_regression();
     test_autograd_manual_linear_regression();
     test_multi_layer_perceptron();
+    test_gradient_checkpointing();
+    test_no_grad();
+    test_broadcast_backward();
+    test_shared_functor();
+    test_elemwise_fusion();
+    test_freeze();
+    test_micro_batcher();
+    test_tracer();
+    test_graph_profile();
     return 0;
 }
\ No newline at end of file
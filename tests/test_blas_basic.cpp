@@ -4,11 +4,201 @@
 
 #include "../blas/blas.h"
 #include "common.h"
+#include <fstream>
 #include <iostream>
 using namespace std;
 using namespace blas;
 
+void test_tensor_archive() {
+    cout << "TEST TENSOR ARCHIVE:" << endl;
+    Tensor<double> weights = linspace(-1., 1., 12).reshape({3, 4});
+    Tensor<float> bias({1.5f, -2.5f}, {2});
+    Tensor<long> steps(vector<long>{42}, {1});
+    TensorArchiveWriter writer;
+    writer.add("weights", weights).add("bias", bias).add("steps", steps)
+          .add("weights_t", weights.transpose());
+    writer.save("tensors.tpt");
+
+    MappedTensorArchive archive("tensors.tpt");
+    for (const auto& record: archive.records()) {
+        cout << record.name << ": " << dtype2str(record.dtype) << " " << shape2str(record.shape)
+             << " at " << record.offset << endl;
+        if (record.offset % 64 != 0)
+            throw std::runtime_error("Payloads must be 64 bytes aligned.");
+    }
+    auto loaded_weights = archive.get<double>("weights");
+    PRINT_EXPR(loaded_weights);
+    PRINT_EXPR(archive.get<double>("weights_t"));
+    if ((loaded_weights - weights).absl().sum().item() != 0 ||
+        (archive.get<double>("weights_t") - weights.transpose().contiguous()).absl().sum().item() != 0 ||
+        archive.get<float>("bias")[1].item() != -2.5f || archive.get<long>("steps").item() != 42)
+        throw std::runtime_error("The loaded tensors differ from the saved ones.");
+    // Writing to a mapped tensor doesn't change the file.
+    loaded_weights.fill_(0.);
+    if (MappedTensorArchive("tensors.tpt").get<double>("weights").sum().item() != weights.sum().item())
+        throw std::runtime_error("Mapped tensors must be copy-on-write.");
+    try {
+        archive.get<float>("weights");
+        throw std::logic_error("Getting a tensor with the wrong dtype must throw.");
+    } catch (const std::invalid_argument& e) {
+        cout << "expected error: " << e.what() << endl;
+    }
+}
+
+void test_npy() {
+    cout << "TEST NPY:" << endl;
+    Tensor<double> weights = linspace(-1., 1., 6).reshape({2, 3});
+    Tensor<float> bias({1.5f, -2.5f}, {2});
+    save_npy("weights.npy", weights);
+    save_npy("weights_t.npy", weights.transpose());
+    auto loaded = NpyArray::open("weights.npy");
+    PRINT_EXPR(loaded.get<double>());
+    if ((loaded.get<double>() - weights).absl().sum().item() != 0 ||
+        (load_npy<double>("weights_t.npy") - weights.transpose().contiguous()).absl().sum().item() != 0 ||
+        (load_npy<float>("weights.npy")[1][2].item() != float(weights[1][2].item())))
+        throw std::runtime_error("The loaded .npy differs from the saved tensor.");
+
+    // A Fortran ordered (2, 3) array is stored column by column.
+    {
+        string dict = "{'descr': '<f8', 'fortran_order': True, 'shape': (2, 3), }";
+        dict.append(128 - 10 - dict.size() - 1, ' ');
+        dict += '\n';
+        std::ofstream os("fortran.npy", std::ios::binary);
+        os.write("\x93NUMPY\x01\x00", 8);
+        os.put(char(dict.size())).put(0);
+        os << dict;
+        Tensor<double> columns = weights.transpose().contiguous();
+        os.write(reinterpret_cast<const char *>(columns.get_data_ptr()), columns.size * sizeof(double));
+    }
+    auto fortran = NpyArray::open("fortran.npy");
+    auto fortran_view = fortran.get_fortran<double>();
+    PRINT_EXPR(fortran_view);
+    if ((fortran_view.contiguous() - weights).absl().sum().item() != 0 ||
+        (fortran.load<double>() - weights).absl().sum().item() != 0)
+        throw std::runtime_error("The Fortran ordered .npy differs from the expected tensor.");
+
+    auto weights_t = weights.transpose();
+    save_npz<double>("arrays.npz", {{"weights", &weights}, {"weights_t", &weights_t}});
+    NpzArchive npz("arrays.npz");
+    for (const auto& name: npz.names())
+        cout << name << ": " << shape2str(npz[name].shape()) << endl;
+    if ((npz["weights_t"].load<double>() - weights.transpose().contiguous()).absl().sum().item() != 0 ||
+        npz["weights"].load<double>()[1][2].item() != weights[1][2].item())
+        throw std::runtime_error("The loaded .npz differs from the saved tensors.");
+    try {
+        loaded.get<float>();
+        throw std::logic_error("Viewing a .npy with the wrong dtype must throw.");
+    } catch (const std::invalid_argument& e) {
+        cout << "expected error: " << e.what() << endl;
+    }
+}
+
+void test_instrumentation() {
+    cout << "TEST INSTRUMENTATION:" << endl;
+    namespace instr = blas::instrumentation;
+    instr::reset();
+    auto a = uniform<double>(-1, 1, {32, 16}), b = uniform<double>(-1, 1, {16, 8});
+    for (int i = 0; i < 3; ++i)
+        matmul(a, b);
+    auto c = (a + a).sum();
+    auto stats = instr::snapshot();
+    if (!instr::is_enabled()) {
+        // Compiled out - the kernels must not record anything.
+        cout << "Compiled without instrumentation, recorded " << stats.size() << " kernels." << endl;
+        if (!stats.empty())
+            throw std::runtime_error("Kernels must not be recorded without instrumentation.");
+        return;
+    }
+    instr::print(cout, stats);
+    size_t matmul_calls = 0;
+    double matmul_flops = 0;
+    for (const auto& s: stats)
+        if (s.op == "matmul") {
+            matmul_calls += s.calls;
+            matmul_flops += s.flops;
+        }
+    cout << "matmul calls = " << matmul_calls << ", flops = " << matmul_flops << endl;
+    if (matmul_calls != 3 || matmul_flops != 3 * 2 * 32 * 16 * 8)
+        throw std::runtime_error("Wrong recorded matmul calls or flops.");
+}
+
+void test_memory_accounting() {
+    cout << "TEST MEMORY ACCOUNTING:" << endl;
+    namespace memory = blas::memory;
+    auto before = memory::snapshot();
+    memory::reset_peak();
+    {
+        Tensor<double> a(shape_t{100});
+        Tensor<double> s(1.0);
+        memory::MemoryTag tag("test");
+        Tensor<float> b(shape_t{50});
+        Tensor<double> view = Tensor<double>::wrap(a.get_data_ptr(), {10, 10});
+        auto during = memory::snapshot() - before;
+        during.print(cout);
+        if (during.total.live_count != 3 || during.total.live_bytes != 1008 ||
+            during.by_tag.at("test").live_bytes != 200)
+            throw std::runtime_error("Wrong live tensor memory.");
+    }
+    auto after = memory::snapshot() - before;
+    if (after.total.live_count != 0 || after.total.live_bytes != 0 || after.total.allocations != 3 ||
+        after.by_tag.at("test").peak_bytes != 200 || after.total.peak_bytes - before.total.live_bytes < 1008)
+        throw std::runtime_error("Wrong released tensor memory.");
+    cout << "Released all, peak = " << after.total.peak_bytes << " bytes." << endl;
+}
+
+void test_expressions() {
+    cout << "TEST EXPRESSIONS:" << endl;
+    auto check = [](const string& name, const Tensor<double>& actual, const Tensor<double>& expected) {
+        auto max_abs = [](double x, double y) { return std::max(std::abs(x), std::abs(y)); };
+        double error = std::abs((actual - expected).reduce(max_abs).item());
+        cout << name << ": max error = " << error << endl;
+        if (actual.shape != expected.shape || error > 1e-12)
+            throw std::runtime_error("Wrong result of the expression " + name + ".");
+    };
+    auto add = [](double x, double y) { return x + y; };
+    auto mul = [](double x, double y) { return x * y; };
+    auto a = uniform<double>(-1, 1, {4, 5}), b = uniform<double>(-1, 1, {4, 5}), c = uniform<double>(-1, 1, {4, 5});
+    auto column = uniform<double>(-1, 1, {4, 1}), row = uniform<double>(-1, 1, {5});
+    auto square = uniform<double>(-1, 1, {5, 5}), tall = uniform<double>(-1, 1, {8, 5});
+
+    Tensor<double> fused = a * b + c * 2. - 1.;
+    check("a * b + c * 2 - 1", fused, a.apply_tensors(b, mul).apply_tensors(c.apply(2., mul), add).apply(-1., add));
+    Tensor<double> broadcast = column * row + a;
+    check("(4, 1) * (5) + (4, 5)", broadcast, column.apply_tensors(row, mul).apply_tensors(a, add));
+    auto sliced = tall(Slice(0, 8, 2));
+    Tensor<double> with_slice = sliced + a;
+    check("sliced + a", with_slice, sliced.contiguous().apply_tensors(a, add));
+    auto transposed = square.transpose();
+    Tensor<double> with_transpose = transposed * square;
+    check("transposed * square", with_transpose, transposed.contiguous().apply_tensors(square, mul));
+    // Temporary operands are moved into the expression, so it can be kept and evaluated later.
+    auto kept_transposes = b.transpose() + a.transpose();
+    auto kept_temporary = zeros<double>({4, 5}).exp() * 2.;
+    check("kept b.transpose() + a.transpose()", kept_transposes,
+          b.transpose().contiguous().apply_tensors(a.transpose().contiguous(), add));
+    check("kept zeros.exp() * 2", kept_temporary, ones<double>({4, 5}).apply(2., mul));
+
+    // In place, and aliasing its own operands in another layout.
+    Tensor<double> expected = square.transpose().contiguous().apply_tensors(square, add);
+    square = square.transpose() + square;
+    check("square = square.transpose() + square", square, expected);
+    expected = a.apply_tensors(b.apply_tensors(c, mul), add);
+    a += b * c;
+    check("a += b * c", a, expected);
+    expected = tall.contiguous();
+    auto odd_rows = tall(Slice(1, 8, 2));
+    odd_rows = b - c;
+    for (long i = 0; i < 4; ++i)
+        expected[2 * i + 1] = b[i] - c[i];
+    check("tall(1::2) = b - c", tall, expected);
+}
+
 int main(){
+    test_tensor_archive();
+    test_npy();
+    test_instrumentation();
+    test_memory_accounting();
+    test_expressions();
     Tensor<double> t (
             {1, 2, 3,
              4, 5, 6},
@@ -19,7 +209,7 @@ int main(){
     PRINT_EXPR(t.permute({1, 2, 0}));
     auto t1 = t({1, 2});
     t1 = 900.0;
-    auto t2 = t * t1;
+    Tensor<double> t2 = t * t1;
     PRINT_EXPR(t);
     PRINT_EXPR(t1);
     PRINT_EXPR(t1 / 100.0);
@@ -36,7 +226,7 @@ int main(){
     PRINT_EXPR(t3.sum({0, 2}));
 
     PRINT_EXPR(t2 / 100.0 + t3);
-    auto t4 = t2 / 100.0 + t3;
+    Tensor<double> t4 = t2 / 100.0 + t3;
     PRINT_EXPR(log(t4));
     PRINT_EXPR(t4.log1p_());
     PRINT_EXPR(t1.log10_());
@@ -0,0 +1,461 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include "../nn/nn.h"
+#include "../bench/AllocationCounter.h"
+using namespace blas;
+using namespace autograd;
+using namespace nn;
+
+template<typename T>
+class Affine : public Module<T> {
+public:
+    Variable<T> weight, bias;
+
+    Affine(size_t in, size_t out) :
+            weight(this->register_parameter("weight", uniform<T>(-1, 1, {in, out}))),
+            bias(this->register_parameter("bias", zeros<T>({out}))) {}
+};
+
+template<typename T>
+class TwoLayers : public Module<T> {
+public:
+    shared_ptr<Affine<T>> first, second;
+
+    TwoLayers() :
+            first(this->register_module("first", std::make_shared<Affine<T>>(3, 4))),
+            second(this->register_module("second", std::make_shared<Affine<T>>(4, 2))) {}
+};
+
+void test_module_flat_buffers()
+{
+    cout << "TEST NN MODULE FLAT BUFFERS:" << endl;
+    TwoLayers<double> model;
+    auto first_weight = model.first->weight.data();
+    for (const auto& named_param: model.named_parameters())
+        cout << named_param.first << " " << shape2str(named_param.second.shape()) << endl;
+    cout << "num_parameters = " << model.num_parameters() << endl;
+    if (model.num_parameters() != 3 * 4 + 4 + 4 * 2 + 2)
+        throw std::runtime_error("Wrong number of parameters.");
+
+    auto flat = model.flat_parameters();
+    if (!model.is_flat() || flat.get_data_ptr() != model.first->weight.data().get_data_ptr())
+        throw std::runtime_error("The parameters must be views into the flat buffer.");
+    if ((model.first->weight.data() - first_weight).absl().sum().item() != 0)
+        throw std::runtime_error("Flattening must keep the values of the parameters.");
+    // A submodule owns a contiguous range of its parent's buffers.
+    if (model.second->flat_parameters().get_data_ptr() != model.second->weight.data().get_data_ptr() ||
+        model.second->flat_parameters().get_data_ptr() != flat.get_data_ptr() + 16)
+        throw std::runtime_error("A submodule must own a range of its parent's flat buffer.");
+
+    // The gradients of a backward pass land in the flat gradient buffer.
+    auto x = InputBuffer<double>::make("x", uniform<double>(-1, 1, {5, 3}));
+    auto loss = sum(matmul(matmul(x, model.first->weight) + model.first->bias, model.second->weight) +
+                    model.second->bias);
+    loss->forward_recursive();
+    model.zero_grad();
+    loss->backward();
+    double norm = model.grad_norm();
+    cout << "grad norm = " << norm << ", bias2 grad = " << model.second->bias.grad() << endl;
+    if (model.flat_gradients().get_data_ptr()[model.num_parameters() - 1] != 5)
+        throw std::runtime_error("The gradients must be views into the flat buffer.");
+    double clipped_norm = model.clip_grad_norm_(1.);
+    if (clipped_norm != norm || std::abs(model.grad_norm() - 1.) > 1e-5)
+        throw std::runtime_error("Clipping must scale the gradients to the max norm.");
+    model.zero_grad();
+    if (model.grad_norm() != 0)
+        throw std::runtime_error("zero_grad must zero all the gradients.");
+
+    // Registering a new parameter rebuilds the buffers lazily.
+    model.second->register_parameter("scale", ones<double>({2}));
+    if (model.is_flat())
+        throw std::runtime_error("A new parameter must invalidate the flat buffers.");
+    cout << "num_parameters after registering = " << model.flat_parameters().size << endl;
+    if (!model.is_flat() || model.flat_parameters().get_data_ptr()[model.num_parameters() - 1] != 1)
+        throw std::runtime_error("The flat buffers must be rebuilt with the new parameter.");
+
+    // Moving a parameter into the buffers of another module is noticed by the cached check.
+    {
+        Module<double> other;
+        other.register_parameter("bias", model.first->bias);
+        other.flatten();
+        if (model.is_flat())
+            throw std::runtime_error("Rebinding a parameter must invalidate the flat buffers.");
+        model.flatten();
+    }
+    if (!model.is_flat())
+        throw std::runtime_error("Flattening again must restore the flat buffers.");
+
+    // So is replacing the data of a parameter, which flattening again keeps.
+    model.first->bias.data() = ones<double>({4});
+    if (model.is_flat())
+        throw std::runtime_error("Replacing the data of a parameter must invalidate the flat buffers.");
+    if (model.flat_parameters().get_data_ptr()[12] != 1 || !model.is_flat())
+        throw std::runtime_error("The flat buffers must be rebuilt with the replaced data.");
+
+    // An expression of the same shape is evaluated into the flat buffer, as an update step does.
+    Tensor<double>& bias = model.first->bias.data();
+    bias = bias - 0.5 * bias;
+    if (!model.is_flat() || model.flat_parameters().get_data_ptr()[12] != 0.5)
+        throw std::runtime_error("Assigning an expression to a parameter must keep it in the flat buffers.");
+}
+
+void test_linear_fused()
+{
+    cout << "TEST NN LINEAR FUSED:" << endl;
+    auto x = Parameter<double>::make("x", uniform<double>(-1, 1, {6, 5}));
+    auto w = Parameter<double>::make("w", uniform<double>(-1, 1, {5, 3}));
+    auto b = Parameter<double>::make("b", uniform<double>(-1, 1, {3}));
+    vector<Variable<double>> params = {x, w, b};
+    auto get_grads = [&](const Variable<double>& out) {
+        auto loss = sum(out * out);
+        loss->forward_recursive();
+        loss->zero_grad(true);
+        loss->backward();
+        vector<Tensor<double>> grads;
+        for (const auto& p: params)
+            grads.push_back(p.grad());
+        return grads;
+    };
+    for (const string activation: {"", "relu", "sigmoid", "tanh"}) {
+        auto fused = linear(x, w, b, activation);
+        auto unfused = matmul(x, w) + b;
+        if (activation == "relu") unfused = relu(unfused);
+        if (activation == "sigmoid") unfused = sigmoid(unfused);
+        if (activation == "tanh") unfused = tanh(unfused);
+        auto fused_grads = get_grads(fused);
+        auto unfused_grads = get_grads(unfused);
+        double max_diff = (fused.data() - unfused.data()).absl().sum().item();
+        for (int i = 0; i < params.size(); ++i)
+            max_diff = std::max(max_diff, (fused_grads[i] - unfused_grads[i]).absl().sum().item());
+        cout << "activation \"" << activation << "\": max |fused - unfused| = " << max_diff << endl;
+        if (max_diff > 1e-12)
+            throw std::runtime_error("The fused linear functor differs from the unfused graph.");
+    }
+}
+
+void test_mlp()
+{
+    cout << "TEST NN MLP:" << endl;
+    MLP<double> model({1, 16, 16, 1}, "tanh");
+    auto x = InputBuffer<double>::make("x", linspace<double>(-1, 1, 64).reshape({64, 1}));
+    auto y = InputBuffer<double>::make("y", x.data() * x.data());
+    MSELoss<double> criterion{{64, 1}};
+    auto loss = criterion(model(x), y);
+    Adam<double> optimizer(model, 1e-2);
+    double first_loss = 0, loss_val = 0;
+    for (int i = 0; i < 500; ++i) {
+        loss_val = loss->forward_recursive().item();
+        if (i == 0)
+            first_loss = loss_val;
+        loss->zero_grad(true);
+        loss->backward();
+        optimizer.step();
+        if (i % 100 == 0)
+            cout << "Epoch " << i + 1 << ": loss= " << loss_val << endl;
+    }
+    cout << "final loss = " << loss_val << endl;
+    if (!(loss_val < first_loss / 2))
+        throw std::runtime_error("The MLP failed to train.");
+}
+
+void test_optimizers()
+{
+    cout << "TEST NN OPTIMIZERS:" << endl;
+    // The chunks of a parallel loop are non-empty and cover it exactly once (e.g. 7 on 6 threads).
+    {
+        ThreadPool six_threads(6);
+        for (size_t size = 1; size <= 20; ++size) {
+            std::atomic<size_t> covered{0}, empty_chunks{0};
+            six_threads.parallel_for(size, [&](size_t begin, size_t end) {
+                if (begin >= end || end > size)
+                    empty_chunks++;
+                else
+                    covered += end - begin;
+            });
+            if (covered != size || empty_chunks != 0)
+                throw std::runtime_error("Wrong chunks of a parallel loop of size " + std::to_string(size) + ".");
+        }
+    }
+    // Large enough to be split between the threads of the pool.
+    Affine<double> model(300, 300), model_single_thread(300, 300);
+    model_single_thread.flat_parameters().copy_(model.flat_parameters());
+    auto grads = uniform<double>(-1, 1, {model.num_parameters()});
+    ThreadPool pool(4), single_thread(1);
+    auto make = [&](const string& kind, Module<double>& module, ThreadPool& p) -> shared_ptr<Optimizer<double>> {
+        if (kind == "sgd")
+            return std::make_shared<SGD<double>>(module, 0.1, 0.9, true, 1e-2, p);
+        if (kind == "adam")
+            return std::make_shared<Adam<double>>(module, 0.1, 0.9, 0.999, 1e-8, 0., false, p);
+        return std::make_shared<AdamW<double>>(module, 0.1, 0.9, 0.999, 1e-8, 1e-2, p);
+    };
+    for (const string kind: {"sgd", "adam", "adamw"}) {
+        auto optimizer = make(kind, model, pool);
+        auto reference = make(kind, model_single_thread, single_thread);
+        auto before = model.flat_parameters().contiguous();
+        for (int i = 0; i < 3; ++i) {
+            model.flat_gradients().copy_(grads);
+            model_single_thread.flat_gradients().copy_(grads);
+            optimizer->step();
+            reference->step();
+        }
+        double diff = (model.flat_parameters() - model_single_thread.flat_parameters()).absl().sum().item();
+        double mean_step = (model.flat_parameters() - before).absl().sum().item() / model.num_parameters();
+        cout << kind << ": mean |step| = " << mean_step << ", |threads - single thread| = " << diff << endl;
+        if (diff != 0)
+            throw std::runtime_error("A multithreaded step must match the single threaded one exactly.");
+    }
+    // Nesterov momentum by hand.
+    Affine<double> small(2, 2);
+    SGD<double> sgd(small, 0.5, 0.9, true);
+    auto p0 = small.flat_parameters().contiguous();
+    small.flat_gradients().fill_(1.);
+    sgd.step();
+    small.flat_gradients().fill_(1.);
+    sgd.step();
+    // v1 = 1, p1 = p0 - 0.5 * (1 + 0.9), v2 = 1.9, p2 = p1 - 0.5 * (1 + 0.9 * 1.9)
+    double expected_delta = 0.5 * 1.9 + 0.5 * (1 + 0.9 * 1.9);
+    double sgd_diff = (p0 - small.flat_parameters() - expected_delta).absl().sum().item();
+    cout << "nesterov: |step - expected| = " << sgd_diff << endl;
+    if (sgd_diff > 1e-12)
+        throw std::runtime_error("Wrong Nesterov momentum update.");
+
+    // Once the state exists, a step (and zeroing the gradients) allocates nothing.
+    for (const string kind: {"sgd", "adam", "adamw"}) {
+        auto optimizer = make(kind, model, pool);
+        optimizer->step();
+        size_t allocations_before = bench::allocation_stats().count;
+        for (int i = 0; i < 10; ++i) {
+            optimizer->zero_grad();
+            optimizer->step();
+        }
+        size_t allocations = bench::allocation_stats().count - allocations_before;
+        cout << kind << ": heap allocations in 10 steps = " << allocations << endl;
+        if (allocations != 0)
+            throw std::runtime_error("An optimizer step must not allocate.");
+    }
+}
+
+void test_data_parallel()
+{
+    cout << "TEST NN DATA PARALLEL:" << endl;
+    vector<size_t> sizes{1, 16, 16, 1};
+    MLP<double> model(sizes, "tanh");
+    auto x = linspace<double>(-1, 1, 64).reshape({64, 1});
+    Tensor<double> y = x * x;
+    auto make_replica = [&]() { return std::make_shared<MLP<double>>(sizes, "tanh"); };
+    auto build_loss = [](Module<double>& replica, const Variable<double>& inputs, const Variable<double>& targets) {
+        MSELoss<double> criterion{targets.shape()};
+        return criterion(replica(inputs), targets);
+    };
+    // The gradients of the whole batch on a single graph.
+    auto x_buffer = InputBuffer<double>::make("x", x), y_buffer = InputBuffer<double>::make("y", y);
+    auto loss = build_loss(model, x_buffer, y_buffer);
+    double expected_loss = loss->forward_recursive().item();
+    loss->zero_grad(true);
+    loss->backward();
+    auto expected_grads = model.flat_gradients().contiguous();
+
+    ThreadPool pool(4);
+    // 5 replicas don't split the batch evenly.
+    DataParallel<double> trainer(model, make_replica, build_loss, 5, pool);
+    double parallel_loss = trainer.forward_backward(x, y);
+    double diff = (model.flat_gradients() - expected_grads).absl().sum().item();
+    cout << "loss = " << expected_loss << ", parallel loss = " << parallel_loss
+         << ", |grad - parallel grad| = " << diff << endl;
+    if (std::abs(parallel_loss - expected_loss) > 1e-12 || diff > 1e-12)
+        throw std::runtime_error("Data parallel gradients differ from the gradients of the whole batch.");
+
+    // A fixed reduction order - the same result regardless of the number of threads.
+    ThreadPool single_thread(1);
+    DataParallel<double> single_thread_trainer(model, make_replica, build_loss, 5, single_thread);
+    single_thread_trainer.forward_backward(x, y);
+    auto single_thread_grads = model.flat_gradients().contiguous();
+    trainer.forward_backward(x, y);
+    if ((model.flat_gradients() - single_thread_grads).absl().sum().item() != 0)
+        throw std::runtime_error("Data parallel gradients must not depend on the number of threads.");
+
+    Adam<double> optimizer(model, 1e-2, 0.9, 0.999, 1e-8, 0., false, pool);
+    double loss_val = 0;
+    for (int i = 0; i < 300; ++i) {
+        loss_val = trainer.step(x, y, optimizer);
+        if (i % 100 == 0)
+            cout << "Epoch " << i + 1 << ": loss= " << loss_val << endl;
+    }
+    cout << "final loss = " << loss_val << endl;
+    if (!(loss_val < expected_loss / 2))
+        throw std::runtime_error("Data parallel training failed.");
+}
+
+void test_data_loader()
+{
+    cout << "TEST NN DATA LOADER:" << endl;
+    auto x = linspace<double>(0, 9, 10).reshape({10, 1});
+    DataLoaderOptions options;
+    options.batch_size = 4;
+    options.num_workers = 2;
+    DataLoader<double> loader(std::make_shared<TensorSource<double>>(x, 2. * x), options);
+    DataLoader<double>::Batch batch;
+    for (int epoch = 0; epoch < 2; ++epoch) {
+        loader.start_epoch();
+        vector<double> seen;
+        while (loader.next(batch)) {
+            cout << "inputs " << shape2str(batch.inputs.shape) << ": " << batch.inputs.reshape({-1}) << endl;
+            if ((batch.targets - 2. * batch.inputs).absl().sum().item() != 0)
+                throw std::runtime_error("The targets must be collated with their inputs.");
+            seen.insert(seen.end(), batch.inputs.get_data_ptr(), batch.inputs.get_data_ptr() + batch.inputs.size);
+        }
+        std::sort(seen.begin(), seen.end());
+        if (seen.size() != 10 || seen.front() != 0 || seen.back() != 9 || std::unique(seen.begin(), seen.end()) != seen.end())
+            throw std::runtime_error("An epoch must cover every sample exactly once.");
+    }
+
+    // Batches are swapped into input buffers without copying.
+    string path = "data_loader_test.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        for (int i = 0; i < 12; ++i) {
+            float record[3] = {float(i), float(-i), float(i * i)};
+            out.write(reinterpret_cast<const char *>(record), sizeof(record));
+        }
+    }
+    DataLoaderOptions file_options;
+    file_options.batch_size = 5;
+    file_options.drop_last = true;
+    file_options.shuffle = false;
+    DataLoader<float> file_loader(std::make_shared<MappedFileSource<float>>(path, shape_t{2}, shape_t{1}),
+                                  file_options);
+    auto inputs = InputBuffer<float>::make("inputs", Tensor<float>({5, 2}));
+    auto targets = InputBuffer<float>::make("targets", Tensor<float>({5, 1}));
+    std::unordered_set<float *> buffers{inputs.data().get_data_ptr()};
+    long allocations_after_first_epoch = 0;
+    for (int epoch = 0; epoch < 3; ++epoch) {
+        file_loader.start_epoch();
+        size_t num_batches = 0;
+        while (true) {
+            float *previous = inputs.data().get_data_ptr();
+            if (!file_loader.next(inputs, targets))
+                break;
+            if (epoch == 0)
+                cout << "inputs: " << inputs.data() << " targets: " << targets.data() << endl;
+            // A swap gives the input buffer another tensor of the ring, a copy would keep its own.
+            if (inputs.data().get_data_ptr() == previous)
+                throw std::runtime_error("A batch must be swapped into the input buffer, not copied.");
+            buffers.insert(inputs.data().get_data_ptr());
+            if (targets.data()[{4, 0}].item() != (num_batches * 5 + 4) * (num_batches * 5 + 4))
+                throw std::runtime_error("Wrong sample read from the mapped file.");
+            num_batches++;
+        }
+        if (num_batches != 2)
+            throw std::runtime_error("drop_last must drop the smaller last batch.");
+        if (epoch == 0)
+            allocations_after_first_epoch = blas::memory::usage().allocations;
+    }
+    long new_allocations = blas::memory::usage().allocations - allocations_after_first_epoch;
+    cout << "distinct input buffers: " << buffers.size() << ", tensors allocated after the first epoch: "
+         << new_allocations << endl;
+    // The ring of prefetch + 1 buffers and the initial tensor of the input buffer, reused every epoch.
+    if (buffers.size() > file_options.prefetch + 2 || new_allocations != 0)
+        throw std::runtime_error("Batches must cycle through the buffers of the ring, not fresh allocations.");
+
+    // Generated samples, collated on the calling thread.
+    DataLoaderOptions generator_options;
+    generator_options.batch_size = 3;
+    generator_options.num_workers = 0;
+    DataLoader<double> generator_loader(std::make_shared<GeneratorSource<double>>(
+            7, shape_t{2}, std::nullopt, [](size_t index, double *input, double *) {
+                input[0] = index;
+                input[1] = index * 10;
+            }), generator_options);
+    generator_loader.start_epoch();
+    size_t total = 0;
+    while (generator_loader.next(batch))
+        total += batch.inputs.shape[0];
+    if (total != 7)
+        throw std::runtime_error("The generated epoch must have all the samples.");
+}
+
+void test_checkpointer()
+{
+    cout << "TEST NN CHECKPOINTER:" << endl;
+    std::filesystem::remove_all("checkpoints");
+    TwoLayers<double> model;
+    Adam<double> adam(model, 0.1);
+    auto grads = uniform<double>(-1, 1, {model.num_parameters()});
+    auto train_step = [&](Module<double>& module, Optimizer<double>& optimizer) {
+        module.flat_gradients().copy_(grads);
+        optimizer.step();
+    };
+    train_step(model, adam);
+    Checkpointer<double> checkpointer(model, &adam, "checkpoints", {true, 8});
+    checkpointer.save(1);
+    // Only the bias of the second layer changes, so the next save only writes it.
+    model.second->bias.data().fill_(0.5);
+    checkpointer.save_async(2);
+    auto expected_params = model.flat_parameters().contiguous();
+    auto expected_state = adam.get_state().contiguous();
+    // The snapshot was taken, training continues while it's written.
+    train_step(model, adam);
+    checkpointer.wait();
+    blas::MappedTensorArchive incremental(checkpointer.path_of(2));
+    for (const auto& record: incremental.records())
+        cout << "checkpoint 2: " << record.name << " " << shape2str(record.shape) << endl;
+    if (incremental.records().size() != 4 || !incremental.contains("param/second.bias"))
+        throw std::runtime_error("An incremental checkpoint must only hold the changed tensors.");
+
+    // A new model and optimizer continue exactly from the checkpoint.
+    TwoLayers<double> restored;
+    Adam<double> restored_adam(restored, 0.1);
+    Checkpointer<double> restorer(restored, &restored_adam, "checkpoints");
+    cout << "latest checkpoint: " << *restorer.latest() << endl;
+    restorer.restore(*restorer.latest());
+    double params_diff = (restored.flat_parameters() - expected_params).absl().sum().item();
+    double state_diff = (restored_adam.get_state() - expected_state).absl().sum().item();
+    cout << "restored: |params diff| = " << params_diff << ", |state diff| = " << state_diff
+         << ", steps = " << restored_adam.num_steps() << endl;
+    if (params_diff != 0 || state_diff != 0 || restored_adam.num_steps() != 1)
+        throw std::runtime_error("The restored module and optimizer differ from the checkpoint.");
+    checkpointer.restore(2);
+    train_step(model, adam);
+    train_step(restored, restored_adam);
+    if ((restored.flat_parameters() - model.flat_parameters()).absl().sum().item() != 0)
+        throw std::runtime_error("Training from a restored checkpoint must be deterministic.");
+
+    // Saving an id of the current chain again rewrites it as a full checkpoint, not as its own parent.
+    checkpointer.save(3);
+    model.second->bias.data().fill_(-0.5);
+    checkpointer.save(3);
+    blas::MappedTensorArchive resaved(checkpointer.path_of(3));
+    if (resaved.get<long>("checkpoint/parent").item() != -1)
+        throw std::runtime_error("Saving a checkpoint of the chain again must write a full checkpoint.");
+    expected_params = model.flat_parameters().contiguous();
+    restorer.restore(3);
+    if ((restored.flat_parameters() - expected_params).absl().sum().item() != 0)
+        throw std::runtime_error("Restoring a checkpoint saved twice must load the second save.");
+
+    // After going back to 3, saving 3 again starts a new timeline - its old increment 4 is deleted.
+    model.second->bias.data().fill_(1.5);
+    checkpointer.save(4);
+    checkpointer.restore(3);
+    checkpointer.save(3);
+    cout << "latest checkpoint after saving 3 again: " << *checkpointer.latest() << endl;
+    if (std::filesystem::exists(checkpointer.path_of(4)) || *checkpointer.latest() != 3)
+        throw std::runtime_error("Overwriting a checkpoint must delete the increments saved on top of it.");
+}
+
+int main()
+{
+    test_module_flat_buffers();
+    test_linear_fused();
+    test_optimizers();
+    test_mlp();
+    test_data_parallel();
+    test_data_loader();
+    test_checkpointer();
+    return 0;
+}
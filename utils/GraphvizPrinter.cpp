@@ -29,11 +29,41 @@ size_t GraphvizPrinter::create_node(const string& name, const string& style) {
     return nodes[name] = nodes.size();
 }
 
+// Newlines and quotes as DOT escapes, inside a quoted label.
+static string escape_label(const string& s) {
+    string out;
+    for (char c: s) {
+        if (c == '\n')
+            out += "\\n";
+        else if (c == '"')
+            out += "\\\"";
+        else
+            out += c;
+    }
+    return out;
+}
+
+void GraphvizPrinter::annotate_node(const string& name, const string& annotation, const string& fill_color) {
+    annotations[name] = annotation;
+    if (!fill_color.empty())
+        fill_colors[name] = fill_color;
+}
+
 ostream&  GraphvizPrinter::print_dot(ostream& os) {
     os << "digraph g{" << endl;
     // First pass: Define all nodes:
-    for (const auto& [label, id]: nodes)
-        os << "    gvzpv_" << id << " [label=\"" << label << "\" " << styles[label] << " ]" << endl;
+    for (const auto& [label, id]: nodes) {
+        os << "    gvzpv_" << id << " [label=\"" << label;
+        auto annotation = annotations.find(label);
+        if (annotation != annotations.end())
+            os << "\\n" << escape_label(annotation->second);
+        os << "\" " << styles[label];
+        // Attributes given later override the ones of the style.
+        auto fill_color = fill_colors.find(label);
+        if (fill_color != fill_colors.end())
+            os << " style=\"filled\" fillcolor=\"" << fill_color->second << "\"";
+        os << " ]" << endl;
+    }
     // Second pass: Define connections:
     for (const auto& conn: connections)
         os << "    " << conn << endl;
@@ -21,9 +21,17 @@ public:
     void export_to(const string& filename);
 
     size_t create_node(const string& name, const string& style = "");
+
+    /**
+     * Adds lines (separated by '\n') under the label of a node, e.g. its measured time,
+     * and fills the node with fill_color if it's not empty (any Graphviz color, e.g. "0.0 0.5 1.0").
+     */
+    void annotate_node(const string& name, const string& annotation, const string& fill_color = "");
 private:
     unordered_map<string /*label*/, size_t /*id*/> nodes;
     unordered_map<string /*label*/, string /*style*/> styles;
+    unordered_map<string /*label*/, string /*annotation*/> annotations;
+    unordered_map<string /*label*/, string /*color*/> fill_colors;
     unordered_set<string /*node1 -> node2*/ > connections;
     static const unordered_set<string> available_formats;
 };
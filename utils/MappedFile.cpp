@@ -0,0 +1,41 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "MappedFile.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const string& path) : path(path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Cannot open '" + path + "': " + strerror(errno));
+    struct stat st{};
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+        close(fd);
+        throw runtime_error("Cannot stat '" + path + "': " + strerror(error));
+    }
+    length = st.st_size;
+    if (length > 0) {
+        void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            int error = errno;
+            close(fd);
+            throw runtime_error("Cannot map '" + path + "': " + strerror(error));
+        }
+        address = static_cast<char *>(mapped);
+    }
+    // The mapping stays valid after the file is closed.
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (address)
+        munmap(address, length);
+}
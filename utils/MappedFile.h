@@ -0,0 +1,40 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_MAPPEDFILE_H
+#define TARGETPRACTICE_MAPPEDFILE_H
+
+#include <string>
+
+using namespace std;
+
+/**
+ * A file mapped into memory (read-only file, copy-on-write pages).
+ * The pages are loaded lazily by the OS and shared between all the processes that map the
+ * file, until they are written to - writes are private to the mapping and never reach the file.
+ */
+class MappedFile {
+public:
+    // Throws runtime_error if the file can't be opened or mapped.
+    explicit MappedFile(const string& path);
+
+    MappedFile(const MappedFile&) = delete;
+
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    inline char *data() const { return address; }
+
+    inline size_t size() const { return length; }
+
+    inline const string& get_path() const { return path; }
+
+private:
+    string path;
+    char *address = nullptr;
+    size_t length = 0;
+};
+
+#endif //TARGETPRACTICE_MAPPEDFILE_H
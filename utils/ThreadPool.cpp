@@ -0,0 +1,110 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "ThreadPool.h"
+#include "Tracer.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+thread_local bool ThreadPool::inside_task = false;
+
+ThreadPool::ThreadPool(size_t num_threads) {
+    for (size_t i = 1; i < num_threads; ++i) {
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+        Tracer::global().set_thread_name("ThreadPool worker " + to_string(i), workers.back().get_id());
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(state_mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for (auto& worker: workers)
+        worker.join();
+}
+
+size_t ThreadPool::default_num_threads() {
+    if (const char *env = getenv("TP_NUM_THREADS"))
+        return max<long>(1, stol(env));
+    return max<size_t>(1, thread::hardware_concurrency());
+}
+
+ThreadPool& ThreadPool::global() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::worker_loop() {
+    size_t seen_generation = 0;
+    while (true) {
+        {
+            unique_lock<mutex> lock(state_mutex);
+            work_cv.wait(lock, [&] { return stopping || generation != seen_generation; });
+            if (stopping)
+                return;
+            seen_generation = generation;
+            active_workers++;
+        }
+        run_chunks();
+        {
+            lock_guard<mutex> lock(state_mutex);
+            active_workers--;
+        }
+        done_cv.notify_one();
+    }
+}
+
+void ThreadPool::run_chunks() {
+    bool was_inside_task = inside_task;
+    inside_task = true;
+    size_t chunk;
+    while ((chunk = next_chunk++) < num_chunks) {
+        size_t begin = chunk * chunk_size, end = min(loop_size, begin + chunk_size);
+        try {
+            (*task)(begin, end);
+        } catch (...) {
+            lock_guard<mutex> lock(state_mutex);
+            if (!error)
+                error = current_exception();
+        }
+        lock_guard<mutex> lock(state_mutex);
+        finished_chunks++;
+    }
+    inside_task = was_inside_task;
+}
+
+void ThreadPool::parallel_for(size_t size, const task_t& loop_task, size_t min_chunk) {
+    min_chunk = max<size_t>(min_chunk, 1);
+    size_t chunks = min(num_threads(), (size + min_chunk - 1) / min_chunk);
+    if (chunks <= 1 || inside_task) {
+        if (size > 0)
+            loop_task(0, size);
+        return;
+    }
+    lock_guard<mutex> call_lock(call_mutex);
+    {
+        unique_lock<mutex> lock(state_mutex);
+        // A worker that woke up too late for the previous loop may still be leaving it.
+        done_cv.wait(lock, [&] { return active_workers == 0; });
+        task = &loop_task;
+        loop_size = size;
+        chunk_size = (size + chunks - 1) / chunks;
+        // Rounding the chunk size up may leave fewer (non-empty) chunks than threads, e.g. 7 in chunks of 2.
+        num_chunks = (size + chunk_size - 1) / chunk_size;
+        next_chunk = 0;
+        finished_chunks = 0;
+        error = nullptr;
+        generation++;
+    }
+    work_cv.notify_all();
+    run_chunks();
+    unique_lock<mutex> lock(state_mutex);
+    done_cv.wait(lock, [&] { return finished_chunks == num_chunks && active_workers == 0; });
+    task = nullptr;
+    if (error)
+        rethrow_exception(error);
+}
@@ -0,0 +1,76 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_THREADPOOL_H
+#define TARGETPRACTICE_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * A fixed pool of worker threads that runs one parallel loop at a time.
+ * A loop is split into at most one contiguous chunk per thread (the calling thread
+ * runs chunks too), so the chunk boundaries only depend on the size and the number
+ * of threads. Nothing is allocated per loop.
+ * Loops started from inside a chunk run inline on the calling thread.
+ */
+class ThreadPool {
+public:
+    using task_t = function<void(size_t /*begin*/, size_t /*end*/)>;
+
+    // num_threads includes the calling thread, so 1 means no worker threads.
+    explicit ThreadPool(size_t num_threads = default_num_threads());
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool();
+
+    inline size_t num_threads() const { return workers.size() + 1; }
+
+    /**
+     * Runs task over [0, size), split into contiguous chunks of at least min_chunk elements,
+     * and returns once all of them are done. The first exception thrown by a chunk is rethrown.
+     */
+    void parallel_for(size_t size, const task_t& task, size_t min_chunk = 1);
+
+    // The pool shared by the library, with default_num_threads() threads.
+    static ThreadPool& global();
+
+    // The value of the environment variable TP_NUM_THREADS if set, else the number of cores.
+    static size_t default_num_threads();
+
+private:
+    vector<thread> workers;
+    // Serializes parallel_for calls from different threads.
+    mutex call_mutex;
+    mutex state_mutex;
+    condition_variable work_cv, done_cv;
+    bool stopping = false;
+    size_t generation = 0;
+
+    // The current loop, only modified while no worker is running it.
+    const task_t *task = nullptr;
+    size_t loop_size = 0, chunk_size = 0, num_chunks = 0;
+    atomic<size_t> next_chunk{0};
+    size_t finished_chunks = 0;
+    size_t active_workers = 0;
+    exception_ptr error;
+
+    static thread_local bool inside_task;
+
+    void worker_loop();
+
+    void run_chunks();
+};
+
+#endif //TARGETPRACTICE_THREADPOOL_H
@@ -0,0 +1,105 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#include "Tracer.h"
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+atomic<bool> Tracer::tracing{false};
+
+Tracer& Tracer::global() {
+    static Tracer tracer;
+    return tracer;
+}
+
+void Tracer::start() {
+    lock_guard<mutex> lock(events_mutex);
+    recorded_events.clear();
+    origin = chrono::steady_clock::now();
+    tracing.store(true, memory_order_relaxed);
+}
+
+void Tracer::stop() {
+    tracing.store(false, memory_order_relaxed);
+}
+
+size_t Tracer::thread_index(thread::id id) {
+    auto it = thread_ids.find(id);
+    if (it == thread_ids.end())
+        it = thread_ids.emplace(id, thread_ids.size()).first;
+    return it->second;
+}
+
+void Tracer::record(string name, const char *category, chrono::steady_clock::time_point begin,
+                    chrono::steady_clock::time_point end, vector<pair<string, string>> args) {
+    lock_guard<mutex> lock(events_mutex);
+    // A scope that was open when the trace was (re)started.
+    if (begin < origin)
+        return;
+    double begin_us = chrono::duration<double, micro>(begin - origin).count();
+    double duration_us = chrono::duration<double, micro>(end - begin).count();
+    recorded_events.push_back({move(name), category, begin_us, duration_us,
+                               thread_index(this_thread::get_id()), move(args)});
+}
+
+void Tracer::set_thread_name(const string& name, thread::id id) {
+    lock_guard<mutex> lock(events_mutex);
+    thread_names[thread_index(id)] = name;
+}
+
+size_t Tracer::num_events() const {
+    lock_guard<mutex> lock(events_mutex);
+    return recorded_events.size();
+}
+
+vector<Tracer::Event> Tracer::events() const {
+    lock_guard<mutex> lock(events_mutex);
+    return recorded_events;
+}
+
+static string json_escape(const string& s) {
+    string out;
+    for (char c: s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+ostream& Tracer::write_json(ostream& os) const {
+    lock_guard<mutex> lock(events_mutex);
+    os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for (const auto& thread_name: thread_names) {
+        os << (first ? "\n" : ",\n") << R"({"name": "thread_name", "ph": "M", "pid": 0, "tid": )"
+           << thread_name.first << R"(, "args": {"name": ")" << json_escape(thread_name.second) << "\"}}";
+        first = false;
+    }
+    os << fixed << setprecision(3);
+    for (const auto& event: recorded_events) {
+        os << (first ? "\n" : ",\n") << R"({"name": ")" << json_escape(event.name) << R"(", "cat": ")"
+           << event.category << R"(", "ph": "X", "pid": 0, "tid": )" << event.thread << ", \"ts\": "
+           << event.begin << ", \"dur\": " << event.duration;
+        if (!event.args.empty()) {
+            os << ", \"args\": {";
+            for (size_t i = 0; i < event.args.size(); ++i)
+                os << (i ? ", \"" : "\"") << json_escape(event.args[i].first) << "\": \""
+                   << json_escape(event.args[i].second) << "\"";
+            os << "}";
+        }
+        os << "}";
+        first = false;
+    }
+    os << defaultfloat << "\n]}" << endl;
+    return os;
+}
+
+void Tracer::export_to(const string& filename) const {
+    ofstream os(filename);
+    if (!os)
+        throw runtime_error("Couldn't open '" + filename + "' for the trace.");
+    write_json(os);
+}
@@ -0,0 +1,110 @@
+//
+// Created by LevZ on 10/19/2020.
+//
+
+#ifndef TARGETPRACTICE_TRACER_H
+#define TARGETPRACTICE_TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Records the execution of graphs and kernels as Chrome trace events (the trace_event JSON format,
+ * opened by chrome://tracing or ui.perfetto.dev): every traced scope becomes a complete event with its
+ * begin time, duration, thread, name and arguments (e.g. the shapes of its tensors).
+ * The autograd forward and backward of every node are traced, and the blas kernels too when the
+ * instrumentation is compiled in (see blas/Instrumentation.h).
+ * Tracing is off until started - a traced scope then costs a single relaxed atomic load.
+ */
+class Tracer {
+public:
+    struct Event {
+        string name;
+        const char *category;
+        // Microseconds since the trace was started.
+        double begin, duration;
+        size_t thread;
+        vector<pair<string, string>> args;
+    };
+
+    // The tracer of the process.
+    static Tracer& global();
+
+    static inline bool is_tracing() { return tracing.load(memory_order_relaxed); }
+
+    // Drops the previous events and starts recording.
+    void start();
+
+    void stop();
+
+    void record(string name, const char *category, chrono::steady_clock::time_point begin,
+                chrono::steady_clock::time_point end, vector<pair<string, string>> args = {});
+
+    // Names a thread in the traces (e.g. "ThreadPool worker 3").
+    void set_thread_name(const string& name, thread::id id = this_thread::get_id());
+
+    size_t num_events() const;
+
+    vector<Event> events() const;
+
+    ostream& write_json(ostream& os) const;
+
+    void export_to(const string& filename) const;
+
+private:
+    static atomic<bool> tracing;
+    mutable mutex events_mutex;
+    chrono::steady_clock::time_point origin;
+    vector<Event> recorded_events;
+    // Small, stable ids of the threads, in the order they were first seen.
+    unordered_map<thread::id, size_t> thread_ids;
+    unordered_map<size_t, string> thread_names;
+
+    size_t thread_index(thread::id id);
+};
+
+/**
+ * Records its scope as an event if the tracer is on when it starts. The name and the
+ * arguments are only built (by set) when it's recorded.
+ */
+class ScopedTrace {
+public:
+    explicit ScopedTrace(const char *category) : category(category), active(Tracer::is_tracing()) {
+        if (active)
+            begin = chrono::steady_clock::now();
+    }
+
+    ~ScopedTrace() {
+        if (active)
+            Tracer::global().record(move(name), category, begin, chrono::steady_clock::now(), move(args));
+    }
+
+    inline bool is_active() const { return active; }
+
+    inline void set(string name, vector<pair<string, string>> args = {}) {
+        this->name = move(name);
+        this->args = move(args);
+    }
+
+private:
+    const char *category;
+    bool active;
+    chrono::steady_clock::time_point begin;
+    string name;
+    vector<pair<string, string>> args;
+};
+
+#define TRACE_SCOPE(category, ...)                         \
+    ScopedTrace _scoped_trace(category);                   \
+    if (_scoped_trace.is_active()) _scoped_trace.set(__VA_ARGS__)
+
+#endif //TARGETPRACTICE_TRACER_H